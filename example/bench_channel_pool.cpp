@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#include <io/internal_channel.h>
+#include <io/channel.h>
+#include <io/internal/io_channel_impl.h>
+using namespace std;
+
+// Connection pool benchmark.
+// Run it on every node of the config. Each node creates `tasks` channels one after the other,
+// says hello to every other computation node and destroys the channel again. With `keep` the
+// config sets CONNECT_PARAMS.KEEP_CONNECTIONS, so that the tasks after the first one take the
+// connections from the pool instead of connecting again. Compare the channel creation times.
+// usage: bench_channel_pool <config file> <node id> [tasks] [keep|close]
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    printf("usage: %s <config file> <node id> [tasks] [keep|close]\n", argv[0]);
+    return -1;
+  }
+  const char* file_name = argv[1];
+  const char* node_id = argv[2];
+  int tasks = argc > 3 ? atoi(argv[3]) : 50;
+  bool keep = argc > 4 ? string(argv[4]) == "keep" : true;
+
+  string config_str = "";
+  char buf[1024];
+  FILE* fp = fopen(file_name, "r");
+  if (fp == nullptr) {
+    printf("open file %s error", file_name);
+    return -1;
+  }
+  while (fgets(buf, sizeof(buf), fp) != nullptr) {
+    config_str += string(buf);
+  }
+  fclose(fp);
+
+  rapidjson::Document doc;
+  doc.Parse(config_str.c_str());
+  if (!doc.HasMember("CONNECT_PARAMS"))
+    doc.AddMember("CONNECT_PARAMS", rapidjson::Value(rapidjson::kObjectType), doc.GetAllocator());
+  rapidjson::Value& params = doc["CONNECT_PARAMS"];
+  if (params.HasMember("KEEP_CONNECTIONS"))
+    params.RemoveMember("KEEP_CONNECTIONS");
+  params.AddMember("KEEP_CONNECTIONS", keep, doc.GetAllocator());
+  rapidjson::StringBuffer sb;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+  doc.Accept(writer);
+  config_str = sb.GetString();
+
+  vector<double> creates;
+  uint64_t hits = 0, misses = 0, attach_us = 0;
+  for (int t = 0; t < tasks; t++) {
+    string task_id = "task" + to_string(t);
+    auto beg = chrono::steady_clock::now();
+    IChannel* channel = ::CreateInternalChannel(task_id.c_str(), node_id, config_str.c_str(), nullptr);
+    if (channel == nullptr) {
+      printf("%s create channel of %s failed\n", node_id, task_id.c_str());
+      return -1;
+    }
+    creates.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - beg).count());
+
+    // every node says hello to every other one, so that all of them are in the task
+    const NodeIDMap* computation_nodes = channel->GetComputationNodeIDs();
+    char hello = 1;
+    for (int i = 0; i < computation_nodes->node_count; i++) {
+      if (computation_nodes->pairs[i]->node_id != string(node_id))
+        channel->Send(computation_nodes->pairs[i]->node_id, "01", &hello, 1);
+    }
+    for (int i = 0; i < computation_nodes->node_count; i++) {
+      const char* peer = computation_nodes->pairs[i]->node_id;
+      if (peer == string(node_id))
+        continue;
+      channel->Recv(peer, "01", &hello, 1);
+      if (t == tasks - 1) {
+        rosetta::io::NetStat stat = ((rosetta::io::TCPChannel*)channel)->GetNetStat(peer);
+        hits += stat.pool_hits();
+        misses += stat.pool_misses();
+        attach_us += stat.attach_us();
+      }
+    }
+    ::DestroyInternalChannel(channel);
+    // without the pool, the last task of a node closes the server, which must not happen
+    // under a peer connecting for the next task already. give the peers time to close
+    if (!keep)
+      this_thread::sleep_for(chrono::milliseconds(50));
+  }
+
+  double first = creates[0];
+  sort(creates.begin() + 1, creates.end());
+  printf("%s %s tasks:%d\n", node_id, keep ? "keep" : "close", tasks);
+  printf("create us: first %.1f, then p50 %.1f max %.1f\n", first, creates[creates.size() / 2], creates.back());
+  printf("pool hits %lu misses %lu, attach us per task %.1f\n", hits, misses,
+    hits + misses > 0 ? (double)attach_us / (hits + misses) : 0.0);
+  return 0;
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <rapidjson/document.h>
+#include <io/internal_channel.h>
+#include <io/channel.h>
+#include <io/internal/io_channel_impl.h>
+using namespace std;
+
+// Channel startup benchmark.
+// Run it on every node of the config, e.g. 3 to 10 of them on one host. The node with party id p
+// starts p * `stagger ms` later than party 0, so that the first ones connect to servers not
+// listening yet. Each node prints when its channel was up, and the attempts and time its
+// connects took; the spread between the last start and the last channel up is the startup cost.
+// usage: bench_channel_startup <config file> <node id> [stagger ms]
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    printf("usage: %s <config file> <node id> [stagger ms]\n", argv[0]);
+    return -1;
+  }
+  const char* file_name = argv[1];
+  const char* node_id = argv[2];
+  int stagger = argc > 3 ? atoi(argv[3]) : 20;
+
+  string config_str = "";
+  char buf[1024];
+  FILE* fp = fopen(file_name, "r");
+  if (fp == nullptr) {
+    printf("open file %s error", file_name);
+    return -1;
+  }
+  while (fgets(buf, sizeof(buf), fp) != nullptr) {
+    config_str += string(buf);
+  }
+  fclose(fp);
+
+  // the party id of this node, from the config
+  int party_id = 0;
+  rapidjson::Document doc;
+  doc.Parse(config_str.c_str());
+  if (doc.IsObject() && doc.HasMember("COMPUTATION_NODES") && doc["COMPUTATION_NODES"].HasMember(node_id))
+    party_id = doc["COMPUTATION_NODES"][node_id].GetInt();
+  this_thread::sleep_for(chrono::milliseconds(stagger * party_id));
+
+  auto wall_ms = []() {
+    return chrono::duration<double, milli>(chrono::system_clock::now().time_since_epoch()).count();
+  };
+  double start = wall_ms();
+  IChannel* channel = ::CreateInternalChannel("bench", node_id, config_str.c_str(), nullptr);
+  double up = wall_ms();
+  if (channel == nullptr) {
+    printf("%s create channel failed after %.1fms\n", node_id, up - start);
+    return -1;
+  }
+
+  // every node says hello to every other one, so that all the channels are up before leaving
+  const NodeIDMap* computation_nodes = channel->GetComputationNodeIDs();
+  char hello = 1;
+  for (int i = 0; i < computation_nodes->node_count; i++) {
+    if (computation_nodes->pairs[i]->node_id != string(node_id))
+      channel->Send(computation_nodes->pairs[i]->node_id, "01", &hello, 1);
+  }
+  uint64_t attempts = 0, connect_us = 0;
+  for (int i = 0; i < computation_nodes->node_count; i++) {
+    const char* peer = computation_nodes->pairs[i]->node_id;
+    if (peer == string(node_id))
+      continue;
+    channel->Recv(peer, "01", &hello, 1);
+    rosetta::io::NetStat stat = ((rosetta::io::TCPChannel*)channel)->GetNetStat(peer);
+    attempts += stat.connect_attempts();
+    connect_us = max(connect_us, stat.connect_us());
+  }
+  printf("%s start %.1f up %.1f, create %.1fms, connect attempts %lu, slowest connect %.1fms\n", node_id, start, up,
+    up - start, attempts, connect_us / 1000.0);
+  ::DestroyInternalChannel(channel);
+  return 0;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#include <io/internal_channel.h>
+#include <io/channel.h>
+#include <io/internal/io_channel_impl.h>
+using namespace std;
+
+// Send coalescing benchmark.
+// The first computation node sends rounds of `messages` 8-byte messages to the second one,
+// which answers once all of them are there, then plays ping-pong with single messages.
+// `coalesce us` goes to CONNECT_PARAMS.COALESCE_US (0 disables it). Bursts should be
+// coalesced into few writes, while ping-pong, sending one message at a time, should not be held.
+// usage: bench_coalescing <config file> <node id> [coalesce us] [messages] [rounds]
+static void print_times(const char* name, vector<double>& times) {
+  sort(times.begin(), times.end());
+  printf("%s us: p50 %.1f p99 %.1f\n", name, times[times.size() / 2], times[times.size() * 99 / 100]);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    printf("usage: %s <config file> <node id> [coalesce us] [messages] [rounds]\n", argv[0]);
+    return -1;
+  }
+  const char* file_name = argv[1];
+  const char* node_id = argv[2];
+  int coalesce_us = argc > 3 ? atoi(argv[3]) : 100;
+  int messages = argc > 4 ? atoi(argv[4]) : 64;
+  int rounds = argc > 5 ? atoi(argv[5]) : 2000;
+
+  string config_str = "";
+  char buf[1024];
+  FILE* fp = fopen(file_name, "r");
+  if (fp == nullptr) {
+    printf("open file %s error", file_name);
+    return -1;
+  }
+  while (fgets(buf, sizeof(buf), fp) != nullptr) {
+    config_str += string(buf);
+  }
+  fclose(fp);
+
+  rapidjson::Document doc;
+  doc.Parse(config_str.c_str());
+  if (!doc.HasMember("CONNECT_PARAMS"))
+    doc.AddMember("CONNECT_PARAMS", rapidjson::Value(rapidjson::kObjectType), doc.GetAllocator());
+  rapidjson::Value& params = doc["CONNECT_PARAMS"];
+  if (params.HasMember("COALESCE_US"))
+    params.RemoveMember("COALESCE_US");
+  params.AddMember("COALESCE_US", coalesce_us, doc.GetAllocator());
+  rapidjson::StringBuffer sb;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+  doc.Accept(writer);
+  config_str = sb.GetString();
+
+  IChannel* channel = ::CreateInternalChannel("bench", node_id, config_str.c_str(), nullptr);
+  const NodeIDMap* computation_nodes = channel->GetComputationNodeIDs();
+  string sender, receiver;
+  for (int i = 0; i < computation_nodes->node_count; i++) {
+    if (computation_nodes->pairs[i]->party_id == 0)
+      sender = computation_nodes->pairs[i]->node_id;
+    if (computation_nodes->pairs[i]->party_id == 1)
+      receiver = computation_nodes->pairs[i]->node_id;
+  }
+
+  vector<string> ids(messages);
+  for (int m = 0; m < messages; m++) {
+    char id[16];
+    snprintf(id, sizeof(id), "d0%04x", m);
+    ids[m] = id;
+  }
+
+  uint64_t value = 0;
+  char ack = 0;
+  if (sender == node_id) {
+    vector<double> bursts, pings;
+    rosetta::io::NetStat beg = ((rosetta::io::TCPChannel*)channel)->GetNetStat(receiver.c_str());
+    for (int r = 0; r < rounds; r++) {
+      auto t = chrono::steady_clock::now();
+      for (int m = 0; m < messages; m++) {
+        value = r;
+        channel->Send(receiver.c_str(), ids[m].c_str(), (const char*)&value, sizeof(value));
+      }
+      channel->Recv(receiver.c_str(), "d1", &ack, 1);
+      bursts.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - t).count());
+    }
+    rosetta::io::NetStat mid = ((rosetta::io::TCPChannel*)channel)->GetNetStat(receiver.c_str());
+    for (int r = 0; r < rounds; r++) {
+      auto t = chrono::steady_clock::now();
+      channel->Send(receiver.c_str(), "d2", (const char*)&value, sizeof(value));
+      channel->Recv(receiver.c_str(), "d1", &ack, 1);
+      pings.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - t).count());
+    }
+    rosetta::io::NetStat end = ((rosetta::io::TCPChannel*)channel)->GetNetStat(receiver.c_str());
+
+    printf("coalesce us:%d messages:%d rounds:%d\n", coalesce_us, messages, rounds);
+    print_times("burst round", bursts);
+    print_times("ping-pong", pings);
+    rosetta::io::NetStat b = mid - beg, p = end - mid;
+    printf("bursts: coalesced writes %lu, frames per write %.1f, added delay per write %.1f us\n",
+      b.coalesced_writes(), b.coalesced_writes() ? (double)b.coalesced_frames() / b.coalesced_writes() : 0.0,
+      b.coalesced_writes() ? (double)b.coalesce_delay_us() / b.coalesced_writes() : 0.0);
+    printf("ping-pong: coalesced writes %lu\n", p.coalesced_writes());
+  } else if (receiver == node_id) {
+    for (int r = 0; r < rounds; r++) {
+      for (int m = 0; m < messages; m++)
+        channel->Recv(sender.c_str(), ids[m].c_str(), (char*)&value, sizeof(value));
+      channel->Send(sender.c_str(), "d1", &ack, 1);
+    }
+    for (int r = 0; r < rounds; r++) {
+      channel->Recv(sender.c_str(), "d2", (char*)&value, sizeof(value));
+      channel->Send(sender.c_str(), "d1", &ack, 1);
+    }
+  }
+  ::DestroyInternalChannel(channel);
+  return 0;
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <io/internal_channel.h>
+#include <io/channel.h>
+using namespace std;
+
+// Corked round benchmark.
+// Each round the first computation node sends `messages` 8-byte messages to the second one,
+// which answers once all of them are there. With `corked` the sender corks the channel and
+// flushes each round, otherwise every Send goes out by itself. Compare round times and the
+// TCP segments sent by the host (OutSegs of /proc/net/snmp, so keep the machine quiet).
+// usage: bench_corked_round <config file> <node id> [messages] [rounds] [corked|plain]
+static uint64_t out_segments() {
+  FILE* fp = fopen("/proc/net/snmp", "r");
+  if (fp == nullptr)
+    return 0;
+  char header[2048], values[2048];
+  uint64_t segs = 0;
+  while (fgets(header, sizeof(header), fp) != nullptr && fgets(values, sizeof(values), fp) != nullptr) {
+    if (strncmp(header, "Tcp:", 4) != 0)
+      continue;
+    // find the OutSegs column
+    int column = 0;
+    char* save = nullptr;
+    for (char* p = strtok_r(header, " \n", &save); p != nullptr; p = strtok_r(nullptr, " \n", &save), column++) {
+      if (strcmp(p, "OutSegs") == 0)
+        break;
+    }
+    save = nullptr;
+    char* p = strtok_r(values, " \n", &save);
+    for (int i = 0; i < column && p != nullptr; i++)
+      p = strtok_r(nullptr, " \n", &save);
+    if (p != nullptr)
+      segs = strtoull(p, nullptr, 10);
+  }
+  fclose(fp);
+  return segs;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    printf("usage: %s <config file> <node id> [messages] [rounds] [corked|plain]\n", argv[0]);
+    return -1;
+  }
+  const char* file_name = argv[1];
+  const char* node_id = argv[2];
+  int messages = argc > 3 ? atoi(argv[3]) : 64;
+  int rounds = argc > 4 ? atoi(argv[4]) : 2000;
+  bool corked = argc > 5 ? string(argv[5]) == "corked" : true;
+
+  string config_str = "";
+  char buf[1024];
+  FILE* fp = fopen(file_name, "r");
+  if (fp == nullptr) {
+    printf("open file %s error", file_name);
+    return -1;
+  }
+  while (fgets(buf, sizeof(buf), fp) != nullptr) {
+    config_str += string(buf);
+  }
+  fclose(fp);
+
+  IChannel* channel = ::CreateInternalChannel("bench", node_id, config_str.c_str(), nullptr);
+  const NodeIDMap* computation_nodes = channel->GetComputationNodeIDs();
+  string sender, receiver;
+  for (int i = 0; i < computation_nodes->node_count; i++) {
+    if (computation_nodes->pairs[i]->party_id == 0)
+      sender = computation_nodes->pairs[i]->node_id;
+    if (computation_nodes->pairs[i]->party_id == 1)
+      receiver = computation_nodes->pairs[i]->node_id;
+  }
+
+  vector<string> ids(messages);
+  for (int m = 0; m < messages; m++) {
+    char id[16];
+    snprintf(id, sizeof(id), "c0%04x", m);
+    ids[m] = id;
+  }
+
+  uint64_t value = 0;
+  char ack = 0;
+  if (sender == node_id) {
+    if (corked)
+      channel->SetCorked(true);
+    vector<double> times;
+    times.reserve(rounds);
+    uint64_t segs = out_segments();
+    for (int r = 0; r < rounds; r++) {
+      auto beg = chrono::steady_clock::now();
+      for (int m = 0; m < messages; m++) {
+        value = r;
+        channel->Send(receiver.c_str(), ids[m].c_str(), (const char*)&value, sizeof(value));
+      }
+      if (corked)
+        channel->Flush();
+      channel->Recv(receiver.c_str(), "c1", &ack, 1);
+      times.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - beg).count());
+    }
+    segs = out_segments() - segs;
+    sort(times.begin(), times.end());
+    printf("%s messages:%d rounds:%d\n", corked ? "corked" : "plain", messages, rounds);
+    printf("round us: p50 %.1f p99 %.1f, tcp segments per round %.1f\n", times[times.size() / 2],
+      times[times.size() * 99 / 100], (double)segs / rounds);
+  } else if (receiver == node_id) {
+    int bad = 0;
+    for (int r = 0; r < rounds; r++) {
+      for (int m = 0; m < messages; m++) {
+        channel->Recv(sender.c_str(), ids[m].c_str(), (char*)&value, sizeof(value));
+        if (value != r)
+          bad++;
+      }
+      channel->Send(sender.c_str(), "c1", &ack, 1);
+    }
+    if (bad > 0)
+      printf("bad:%d\n", bad);
+  }
+  ::DestroyInternalChannel(channel);
+  return 0;
+}
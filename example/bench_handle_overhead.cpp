@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <io/internal_channel.h>
+#include <io/channel.h>
+using namespace std;
+
+// Per-call overhead of Send/Recv for 16-byte messages, by strings and by handles.
+// The first computation node sends `rounds` messages with each API. The second one
+// waits until all of them are buffered, then times the receive calls alone.
+// usage: bench_handle_overhead <config file> <node id> [rounds]
+static double ns_per_call(chrono::steady_clock::time_point beg, int rounds) {
+  return chrono::duration<double, nano>(chrono::steady_clock::now() - beg).count() / rounds;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    printf("usage: %s <config file> <node id> [rounds]\n", argv[0]);
+    return -1;
+  }
+  const char* file_name = argv[1];
+  const char* node_id = argv[2];
+  int rounds = argc > 3 ? atoi(argv[3]) : 200000;
+
+  string config_str = "";
+  char buf[1024];
+  FILE* fp = fopen(file_name, "r");
+  if (fp == nullptr) {
+    printf("open file %s error", file_name);
+    return -1;
+  }
+  while (fgets(buf, sizeof(buf), fp) != nullptr) {
+    config_str += string(buf);
+  }
+  fclose(fp);
+
+  IChannel* channel = ::CreateInternalChannel("bench", node_id, config_str.c_str(), nullptr);
+  const NodeIDMap* computation_nodes = channel->GetComputationNodeIDs();
+  string sender, receiver;
+  for (int i = 0; i < computation_nodes->node_count; i++) {
+    if (computation_nodes->pairs[i]->party_id == 0)
+      sender = computation_nodes->pairs[i]->node_id;
+    if (computation_nodes->pairs[i]->party_id == 1)
+      receiver = computation_nodes->pairs[i]->node_id;
+  }
+
+  char message[16] = {0};
+  char done = 0;
+  if (sender == node_id) {
+    int peer = channel->ResolvePeer(receiver.c_str());
+    int msg = channel->RegisterMessageId("0b");
+    auto beg = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+      channel->Send(receiver.c_str(), "0a", message, sizeof(message));
+    }
+    double by_string = ns_per_call(beg, rounds);
+    beg = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+      channel->Send(peer, msg, message, sizeof(message));
+    }
+    double by_handle = ns_per_call(beg, rounds);
+    channel->Send(receiver.c_str(), "0c", &done, 1);
+    printf("send ns/call: strings %.0f handles %.0f\n", by_string, by_handle);
+    channel->Recv(receiver.c_str(), "0d", &done, 1);
+  } else if (receiver == node_id) {
+    int peer = channel->ResolvePeer(sender.c_str());
+    int msg = channel->RegisterMessageId("0b");
+    // everything sent before the marker is buffered once the marker is there
+    channel->Recv(sender.c_str(), "0c", &done, 1);
+    auto beg = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+      channel->Recv(sender.c_str(), "0a", message, sizeof(message));
+    }
+    double by_string = ns_per_call(beg, rounds);
+    beg = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+      channel->Recv(peer, msg, message, sizeof(message));
+    }
+    double by_handle = ns_per_call(beg, rounds);
+    printf("recv ns/call: strings %.0f handles %.0f\n", by_string, by_handle);
+    channel->Send(sender.c_str(), "0d", &done, 1);
+  }
+  ::DestroyInternalChannel(channel);
+  return 0;
+}
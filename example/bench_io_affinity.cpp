@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#include <io/internal_channel.h>
+#include <io/channel.h>
+#include <io/internal/netutil.h>
+using namespace std;
+
+// IO thread pinning benchmark.
+// The first two computation nodes play ping-pong with 8-byte messages while `compute threads`
+// threads multiply matrices next to them. With `io cpus` (e.g. "0-1") the IO threads are pinned
+// there through CONNECT_PARAMS.IO_CPUS and the compute threads to the remaining cpus; without it
+// everything floats. Compare the round-trip spread of both runs.
+// usage: bench_io_affinity <config file> <node id> [rounds] [io cpus] [compute threads]
+static void compute_kernel(const vector<int>& cpus, atomic<bool>& stop) {
+  if (!cpus.empty()) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int cpu : cpus)
+      CPU_SET(cpu, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+  }
+  const int n = 256;
+  vector<double> a(n * n, 1.0), b(n * n, 2.0), c(n * n, 0.0);
+  while (!stop) {
+    for (int i = 0; i < n && !stop; i++)
+      for (int k = 0; k < n; k++)
+        for (int j = 0; j < n; j++)
+          c[i * n + j] += a[i * n + k] * b[k * n + j];
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    printf("usage: %s <config file> <node id> [rounds] [io cpus] [compute threads]\n", argv[0]);
+    return -1;
+  }
+  const char* file_name = argv[1];
+  const char* node_id = argv[2];
+  int rounds = argc > 3 ? atoi(argv[3]) : 20000;
+  string io_cpus = argc > 4 ? argv[4] : "";
+  int compute_threads = argc > 5 ? atoi(argv[5]) : (int)thread::hardware_concurrency();
+
+  string config_str = "";
+  char buf[1024];
+  FILE* fp = fopen(file_name, "r");
+  if (fp == nullptr) {
+    printf("open file %s error", file_name);
+    return -1;
+  }
+  while (fgets(buf, sizeof(buf), fp) != nullptr) {
+    config_str += string(buf);
+  }
+  fclose(fp);
+
+  // pin the IO threads and keep the compute threads off their cpus
+  vector<int> compute_cpus;
+  if (!io_cpus.empty()) {
+    vector<int> pinned;
+    if (!netutil::parse_cpu_list(io_cpus, pinned)) {
+      printf("invalid cpu list %s\n", io_cpus.c_str());
+      return -1;
+    }
+    for (int cpu = 0; cpu < (int)thread::hardware_concurrency(); cpu++) {
+      if (find(pinned.begin(), pinned.end(), cpu) == pinned.end())
+        compute_cpus.push_back(cpu);
+    }
+    if (compute_cpus.empty())
+      compute_cpus = pinned;
+
+    rapidjson::Document doc;
+    doc.Parse(config_str.c_str());
+    if (!doc.HasMember("CONNECT_PARAMS"))
+      doc.AddMember("CONNECT_PARAMS", rapidjson::Value(rapidjson::kObjectType), doc.GetAllocator());
+    rapidjson::Value& params = doc["CONNECT_PARAMS"];
+    if (params.HasMember("IO_CPUS"))
+      params.RemoveMember("IO_CPUS");
+    params.AddMember("IO_CPUS", rapidjson::Value(io_cpus.c_str(), doc.GetAllocator()), doc.GetAllocator());
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+    doc.Accept(writer);
+    config_str = sb.GetString();
+  }
+
+  IChannel* channel = ::CreateInternalChannel("bench", node_id, config_str.c_str(), nullptr);
+  const NodeIDMap* computation_nodes = channel->GetComputationNodeIDs();
+  string pinger, ponger;
+  for (int i = 0; i < computation_nodes->node_count; i++) {
+    if (computation_nodes->pairs[i]->party_id == 0)
+      pinger = computation_nodes->pairs[i]->node_id;
+    if (computation_nodes->pairs[i]->party_id == 1)
+      ponger = computation_nodes->pairs[i]->node_id;
+  }
+
+  atomic<bool> stop(false);
+  vector<thread> kernels;
+  if (pinger == node_id || ponger == node_id) {
+    for (int t = 0; t < compute_threads; t++)
+      kernels.push_back(thread(compute_kernel, compute_cpus, std::ref(stop)));
+  }
+
+  vector<double> rtts;
+  uint64_t value = 0;
+  if (pinger == node_id) {
+    rtts.reserve(rounds);
+    for (int r = 0; r < rounds; r++) {
+      auto beg = chrono::steady_clock::now();
+      channel->Send(ponger.c_str(), "01", (const char*)&value, sizeof(value));
+      channel->Recv(ponger.c_str(), "02", (char*)&value, sizeof(value));
+      rtts.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - beg).count());
+    }
+  } else if (ponger == node_id) {
+    for (int r = 0; r < rounds; r++) {
+      channel->Recv(pinger.c_str(), "01", (char*)&value, sizeof(value));
+      value++;
+      channel->Send(pinger.c_str(), "02", (const char*)&value, sizeof(value));
+    }
+  }
+  stop = true;
+  for (auto& t : kernels)
+    t.join();
+
+  if (pinger == node_id) {
+    double sum = 0, sum2 = 0;
+    for (double rtt : rtts) {
+      sum += rtt;
+      sum2 += rtt * rtt;
+    }
+    double mean = sum / rtts.size();
+    double stddev = sqrt(max(0.0, sum2 / rtts.size() - mean * mean));
+    sort(rtts.begin(), rtts.end());
+    printf("io cpus:%s compute threads:%d rounds:%d\n", io_cpus.empty() ? "-" : io_cpus.c_str(),
+      compute_threads, rounds);
+    printf("rtt us: mean %.1f stddev %.1f p50 %.1f p99 %.1f p99.9 %.1f max %.1f\n", mean, stddev,
+      rtts[rtts.size() / 2], rtts[rtts.size() * 99 / 100], rtts[rtts.size() * 999 / 1000], rtts.back());
+  }
+  ::DestroyInternalChannel(channel);
+  return 0;
+}
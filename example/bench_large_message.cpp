@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <sys/resource.h>
+#include <io/internal_channel.h>
+#include <io/channel.h>
+using namespace std;
+
+// Large message benchmark.
+// The first computation node sends `rounds` messages of `megabytes` MB to the second one.
+// With mode `expect` the receiver announces each length first, with `place` it also hands
+// over its destination buffer; `plain` receives as usual. Compare time and peak memory.
+// usage: bench_large_message <config file> <node id> [megabytes] [rounds] [plain|expect|place]
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    printf("usage: %s <config file> <node id> [megabytes] [rounds] [plain|expect|place]\n", argv[0]);
+    return -1;
+  }
+  const char* file_name = argv[1];
+  const char* node_id = argv[2];
+  uint64_t length = (argc > 3 ? atol(argv[3]) : 400) * 1024 * 1024;
+  int rounds = argc > 4 ? atoi(argv[4]) : 3;
+  string mode = argc > 5 ? argv[5] : "expect";
+
+  string config_str = "";
+  char buf[1024];
+  FILE* fp = fopen(file_name, "r");
+  if (fp == nullptr) {
+    printf("open file %s error", file_name);
+    return -1;
+  }
+  while (fgets(buf, sizeof(buf), fp) != nullptr) {
+    config_str += string(buf);
+  }
+  fclose(fp);
+
+  IChannel* channel = ::CreateInternalChannel("bench", node_id, config_str.c_str(), nullptr);
+  const NodeIDMap* computation_nodes = channel->GetComputationNodeIDs();
+  string sender, receiver;
+  for (int i = 0; i < computation_nodes->node_count; i++) {
+    if (computation_nodes->pairs[i]->party_id == 0)
+      sender = computation_nodes->pairs[i]->node_id;
+    if (computation_nodes->pairs[i]->party_id == 1)
+      receiver = computation_nodes->pairs[i]->node_id;
+  }
+
+  vector<char> data(length);
+  char ack = 0;
+  if (sender == node_id) {
+    for (int r = 0; r < rounds; r++) {
+      for (uint64_t i = 0; i < length; i += 4096)
+        data[i] = (char)(i / 4096 + r);
+      channel->Recv(receiver.c_str(), "02", &ack, 1);
+      channel->Send(receiver.c_str(), "01", data.data(), length);
+    }
+  } else if (receiver == node_id) {
+    double elapsed = 0;
+    int bad = 0;
+    for (int r = 0; r < rounds; r++) {
+      if (mode == "expect")
+        channel->Expect(sender.c_str(), "01", length);
+      else if (mode == "place")
+        channel->Expect(sender.c_str(), "01", length, data.data());
+      auto beg = chrono::steady_clock::now();
+      channel->Send(sender.c_str(), "02", &ack, 1);
+      channel->Recv(sender.c_str(), "01", data.data(), length);
+      elapsed += chrono::duration<double, milli>(chrono::steady_clock::now() - beg).count();
+      for (uint64_t i = 0; i < length; i += 4096) {
+        if (data[i] != (char)(i / 4096 + r)) {
+          bad++;
+          break;
+        }
+      }
+    }
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    printf("mode:%s message:%luMB rounds:%d bad:%d\n", mode.c_str(), length / 1024 / 1024, rounds, bad);
+    printf("per message %.1fms, %.1fMB/s, max rss %ldMB\n", elapsed / rounds,
+      length / 1024.0 / 1024.0 * rounds / (elapsed / 1000), ru.ru_maxrss / 1024);
+  }
+  ::DestroyInternalChannel(channel);
+  return 0;
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#include <io/internal_channel.h>
+#include <io/channel.h>
+#include <io/internal/io_channel_impl.h>
+using namespace std;
+
+// Lazy connection benchmark.
+// Run it on every node of the config, e.g. 10 of them on one host. The computation nodes form
+// a ring, each one exchanging a message with its two neighbours only. With `lazy` the config
+// sets CONNECT_PARAMS.LAZY_CONNECT, so that a node connects to its neighbours on first use
+// instead of to every node at channel creation. Compare the creation and exchange times,
+// the connections set up and the threads of the process.
+// usage: bench_lazy_connect <config file> <node id> [lazy|eager]
+static int thread_count() {
+  FILE* fp = fopen("/proc/self/status", "r");
+  if (fp == nullptr)
+    return 0;
+  char line[256];
+  int threads = 0;
+  while (fgets(line, sizeof(line), fp) != nullptr) {
+    if (strncmp(line, "Threads:", 8) == 0)
+      threads = atoi(line + 8);
+  }
+  fclose(fp);
+  return threads;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    printf("usage: %s <config file> <node id> [lazy|eager]\n", argv[0]);
+    return -1;
+  }
+  const char* file_name = argv[1];
+  const char* node_id = argv[2];
+  bool lazy = argc > 3 ? string(argv[3]) == "lazy" : true;
+
+  string config_str = "";
+  char buf[1024];
+  FILE* fp = fopen(file_name, "r");
+  if (fp == nullptr) {
+    printf("open file %s error", file_name);
+    return -1;
+  }
+  while (fgets(buf, sizeof(buf), fp) != nullptr) {
+    config_str += string(buf);
+  }
+  fclose(fp);
+
+  rapidjson::Document doc;
+  doc.Parse(config_str.c_str());
+  if (!doc.HasMember("CONNECT_PARAMS"))
+    doc.AddMember("CONNECT_PARAMS", rapidjson::Value(rapidjson::kObjectType), doc.GetAllocator());
+  rapidjson::Value& params = doc["CONNECT_PARAMS"];
+  if (params.HasMember("LAZY_CONNECT"))
+    params.RemoveMember("LAZY_CONNECT");
+  params.AddMember("LAZY_CONNECT", lazy, doc.GetAllocator());
+  rapidjson::StringBuffer sb;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+  doc.Accept(writer);
+  config_str = sb.GetString();
+
+  auto beg = chrono::steady_clock::now();
+  IChannel* channel = ::CreateInternalChannel("bench", node_id, config_str.c_str(), nullptr);
+  double create_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - beg).count();
+  if (channel == nullptr) {
+    printf("%s create channel failed\n", node_id);
+    return -1;
+  }
+  int threads = thread_count();
+
+  // the neighbours in the ring of the computation nodes, by party id
+  const NodeIDMap* computation_nodes = channel->GetComputationNodeIDs();
+  int n = computation_nodes->node_count;
+  vector<string> by_party(n);
+  int party_id = -1;
+  for (int i = 0; i < n; i++) {
+    by_party[computation_nodes->pairs[i]->party_id] = computation_nodes->pairs[i]->node_id;
+    if (computation_nodes->pairs[i]->node_id == string(node_id))
+      party_id = computation_nodes->pairs[i]->party_id;
+  }
+  string next = by_party[(party_id + 1) % n], prev = by_party[(party_id + n - 1) % n];
+
+  char hello = 1;
+  channel->Send(next.c_str(), "01", &hello, 1);
+  channel->Send(prev.c_str(), "01", &hello, 1);
+  channel->Recv(next.c_str(), "01", &hello, 1);
+  channel->Recv(prev.c_str(), "01", &hello, 1);
+  double exchange_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - beg).count();
+
+  uint64_t connections = 0;
+  const NodeIDVec* connected_nodes = channel->GetConnectedNodeIDs();
+  for (int i = 0; i < connected_nodes->node_count; i++) {
+    rosetta::io::NetStat stat = ((rosetta::io::TCPChannel*)channel)->GetNetStat(connected_nodes->node_ids[i]);
+    connections += stat.pool_hits() + stat.pool_misses();
+  }
+  printf("%s %s create %.1fms, ring exchange done %.1fms, connections %lu of %d, threads %d after create %d\n",
+    node_id, lazy ? "lazy" : "eager", create_ms, exchange_ms, connections, connected_nodes->node_count,
+    thread_count(), threads);
+  ::DestroyInternalChannel(channel);
+  return 0;
+}
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <io/internal_channel.h>
+#include <io/channel.h>
+using namespace std;
+
+// Message handler benchmark.
+// The first computation node sends 8-byte requests to the second one, each round with its own
+// message id, and waits for the answer. With `handler` the second node answers from an OnMessage
+// handler on the IO thread, with `recv` from a Recv loop on the main thread. Compare round trips.
+// usage: bench_on_message <config file> <node id> [rounds] [handler|recv]
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    printf("usage: %s <config file> <node id> [rounds] [handler|recv]\n", argv[0]);
+    return -1;
+  }
+  const char* file_name = argv[1];
+  const char* node_id = argv[2];
+  int rounds = argc > 3 ? atoi(argv[3]) : 20000;
+  bool handler = argc > 4 ? string(argv[4]) == "handler" : true;
+
+  string config_str = "";
+  char buf[1024];
+  FILE* fp = fopen(file_name, "r");
+  if (fp == nullptr) {
+    printf("open file %s error", file_name);
+    return -1;
+  }
+  while (fgets(buf, sizeof(buf), fp) != nullptr) {
+    config_str += string(buf);
+  }
+  fclose(fp);
+
+  IChannel* channel = ::CreateInternalChannel("bench", node_id, config_str.c_str(), nullptr);
+  const NodeIDMap* computation_nodes = channel->GetComputationNodeIDs();
+  string client, server;
+  for (int i = 0; i < computation_nodes->node_count; i++) {
+    if (computation_nodes->pairs[i]->party_id == 0)
+      client = computation_nodes->pairs[i]->node_id;
+    if (computation_nodes->pairs[i]->party_id == 1)
+      server = computation_nodes->pairs[i]->node_id;
+  }
+
+  vector<string> ids(rounds);
+  for (int r = 0; r < rounds; r++) {
+    char id[16];
+    snprintf(id, sizeof(id), "f0%06x", r);
+    ids[r] = id;
+  }
+
+  uint64_t value = 0;
+  char ack = 0;
+  if (client == node_id) {
+    channel->Recv(server.c_str(), "f2", &ack, 1);
+    vector<double> rtts;
+    rtts.reserve(rounds);
+    for (int r = 0; r < rounds; r++) {
+      auto beg = chrono::steady_clock::now();
+      value = r;
+      channel->Send(server.c_str(), ids[r].c_str(), (const char*)&value, sizeof(value));
+      channel->Recv(server.c_str(), "f1", (char*)&value, sizeof(value));
+      rtts.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - beg).count());
+      if (value != r + 1)
+        printf("bad answer %lu in round %d\n", value, r);
+    }
+    sort(rtts.begin(), rtts.end());
+    printf("%s rounds:%d\n", handler ? "handler" : "recv", rounds);
+    printf("rtt us: p50 %.1f p99 %.1f max %.1f\n", rtts[rtts.size() / 2], rtts[rtts.size() * 99 / 100], rtts.back());
+  } else if (server == node_id) {
+    if (handler) {
+      mutex mtx;
+      condition_variable cv;
+      int answered = 0;
+      channel->OnMessage(client.c_str(), "f0", [&](const char* node, const char* id, const char* data, uint64_t length) {
+        uint64_t answer = *(const uint64_t*)data + 1;
+        channel->Send(node, "f1", (const char*)&answer, sizeof(answer));
+        unique_lock<mutex> lck(mtx);
+        if (++answered == rounds)
+          cv.notify_all();
+      });
+      channel->Send(client.c_str(), "f2", &ack, 1);
+      unique_lock<mutex> lck(mtx);
+      cv.wait(lck, [&]() { return answered == rounds; });
+      lck.unlock();
+      channel->OnMessage(client.c_str(), "f0", nullptr);
+    } else {
+      channel->Send(client.c_str(), "f2", &ack, 1);
+      for (int r = 0; r < rounds; r++) {
+        channel->Recv(client.c_str(), ids[r].c_str(), (char*)&value, sizeof(value));
+        value++;
+        channel->Send(client.c_str(), "f1", (const char*)&value, sizeof(value));
+      }
+    }
+  }
+  ::DestroyInternalChannel(channel);
+  return 0;
+}
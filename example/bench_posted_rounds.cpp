@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <io/internal_channel.h>
+#include <io/channel.h>
+using namespace std;
+
+// Posted receive benchmark.
+// The first computation node sends `rounds` messages of `kilobytes` KB to the second one,
+// which computes a while on each of them. With `posted` the receiver posts all the rounds
+// upfront with PostRecvs and waits on them one by one, so the messages land in their buffers
+// while it computes; with `plain` it calls Recv every round. Compare the receiver's time.
+// usage: bench_posted_rounds <config file> <node id> [kilobytes] [rounds] [posted|plain]
+static uint64_t compute(const char* data, uint64_t length) {
+  uint64_t sum = 0;
+  for (int pass = 0; pass < 4; pass++)
+    for (uint64_t i = 0; i < length; i++)
+      sum = sum * 31 + (unsigned char)data[i];
+  return sum;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    printf("usage: %s <config file> <node id> [kilobytes] [rounds] [posted|plain]\n", argv[0]);
+    return -1;
+  }
+  const char* file_name = argv[1];
+  const char* node_id = argv[2];
+  uint64_t length = (argc > 3 ? atol(argv[3]) : 256) * 1024;
+  int rounds = argc > 4 ? atoi(argv[4]) : 64;
+  bool posted = argc > 5 ? string(argv[5]) == "posted" : true;
+
+  string config_str = "";
+  char buf[1024];
+  FILE* fp = fopen(file_name, "r");
+  if (fp == nullptr) {
+    printf("open file %s error", file_name);
+    return -1;
+  }
+  while (fgets(buf, sizeof(buf), fp) != nullptr) {
+    config_str += string(buf);
+  }
+  fclose(fp);
+
+  IChannel* channel = ::CreateInternalChannel("bench", node_id, config_str.c_str(), nullptr);
+  const NodeIDMap* computation_nodes = channel->GetComputationNodeIDs();
+  string sender, receiver;
+  for (int i = 0; i < computation_nodes->node_count; i++) {
+    if (computation_nodes->pairs[i]->party_id == 0)
+      sender = computation_nodes->pairs[i]->node_id;
+    if (computation_nodes->pairs[i]->party_id == 1)
+      receiver = computation_nodes->pairs[i]->node_id;
+  }
+
+  vector<string> ids(rounds);
+  for (int r = 0; r < rounds; r++) {
+    char id[16];
+    snprintf(id, sizeof(id), "e0%04x", r);
+    ids[r] = id;
+  }
+
+  vector<vector<char>> data(rounds, vector<char>(length));
+  char ack = 0;
+  if (sender == node_id) {
+    channel->Recv(receiver.c_str(), "e1", &ack, 1);
+    channel->Send(receiver.c_str(), "e2", &ack, 1);
+    channel->Recv(receiver.c_str(), "e1", &ack, 1);
+    for (int r = 0; r < rounds; r++) {
+      for (uint64_t i = 0; i < length; i += 4096)
+        data[r][i] = (char)(i / 4096 + r);
+      channel->Send(receiver.c_str(), ids[r].c_str(), data[r].data(), length);
+    }
+    channel->Recv(receiver.c_str(), "e1", &ack, 1);
+  } else if (receiver == node_id) {
+    vector<MessageDesc> msgs(rounds);
+    for (int r = 0; r < rounds; r++) {
+      msgs[r].node_id = sender.c_str();
+      msgs[r].id = ids[r].c_str();
+      msgs[r].data = data[r].data();
+      msgs[r].length = length;
+    }
+    // warm the connections up before timing
+    channel->Send(sender.c_str(), "e1", &ack, 1);
+    channel->Recv(sender.c_str(), "e2", &ack, 1);
+
+    int bad = 0;
+    uint64_t sum = 0;
+    auto beg = chrono::steady_clock::now();
+    vector<IORequestPtr> requests;
+    if (posted)
+      requests = channel->PostRecvs(msgs.data(), rounds);
+    channel->Send(sender.c_str(), "e1", &ack, 1);
+    for (int r = 0; r < rounds; r++) {
+      int64_t ret = 0;
+      if (posted) {
+        requests[r]->Wait();
+        ret = requests[r]->Result();
+      } else {
+        ret = channel->Recv(sender.c_str(), ids[r].c_str(), data[r].data(), length);
+      }
+      if (ret != (int64_t)length)
+        bad++;
+      for (uint64_t i = 0; i < length; i += 4096) {
+        if (data[r][i] != (char)(i / 4096 + r)) {
+          bad++;
+          break;
+        }
+      }
+      sum += compute(data[r].data(), length);
+    }
+    double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - beg).count();
+    channel->Send(sender.c_str(), "e1", &ack, 1);
+    printf("%s message:%luKB rounds:%d bad:%d (%lu)\n", posted ? "posted" : "plain", length / 1024, rounds, bad,
+      sum % 10);
+    printf("total %.1fms, per round %.1fus\n", elapsed, elapsed * 1000 / rounds);
+  }
+  ::DestroyInternalChannel(channel);
+  return 0;
+}
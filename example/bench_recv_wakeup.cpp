@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <sys/resource.h>
+#include <io/internal_channel.h>
+#include <io/channel.h>
+#include <io/internal/io_channel_impl.h>
+using namespace std;
+
+// Many-thread receive benchmark.
+// The first computation node sends `rounds` 8-byte messages on each of `threads` message ids,
+// interleaving the ids, and the second one receives them with one thread per id.
+// usage: bench_recv_wakeup <config file> <node id> [threads] [rounds]
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    printf("usage: %s <config file> <node id> [threads] [rounds]\n", argv[0]);
+    return -1;
+  }
+  const char* file_name = argv[1];
+  const char* node_id = argv[2];
+  int threads = argc > 3 ? atoi(argv[3]) : 32;
+  int rounds = argc > 4 ? atoi(argv[4]) : 1000;
+
+  string config_str = "";
+  char buf[1024];
+  FILE* fp = fopen(file_name, "r");
+  if (fp == nullptr) {
+    printf("open file %s error", file_name);
+    return -1;
+  }
+  while (fgets(buf, sizeof(buf), fp) != nullptr) {
+    config_str += string(buf);
+  }
+  fclose(fp);
+
+  IChannel* channel = ::CreateInternalChannel("bench", node_id, config_str.c_str(), nullptr);
+  const NodeIDMap* computation_nodes = channel->GetComputationNodeIDs();
+  string sender, receiver;
+  for (int i = 0; i < computation_nodes->node_count; i++) {
+    if (computation_nodes->pairs[i]->party_id == 0)
+      sender = computation_nodes->pairs[i]->node_id;
+    if (computation_nodes->pairs[i]->party_id == 1)
+      receiver = computation_nodes->pairs[i]->node_id;
+  }
+
+  vector<string> ids(threads);
+  for (int t = 0; t < threads; t++) {
+    char id[16];
+    snprintf(id, sizeof(id), "b0%04x", t);
+    ids[t] = id;
+  }
+
+  struct rusage ru_beg, ru_end;
+  getrusage(RUSAGE_SELF, &ru_beg);
+  auto beg = chrono::steady_clock::now();
+  if (sender == node_id) {
+    for (int r = 0; r < rounds; r++) {
+      for (int t = 0; t < threads; t++) {
+        uint64_t value = r;
+        channel->Send(receiver.c_str(), ids[t].c_str(), (const char*)&value, sizeof(value));
+      }
+    }
+  } else if (receiver == node_id) {
+    vector<thread> workers(threads);
+    for (int t = 0; t < threads; t++) {
+      workers[t] = thread([&, t]() {
+        for (int r = 0; r < rounds; r++) {
+          uint64_t value = 0;
+          channel->Recv(sender.c_str(), ids[t].c_str(), (char*)&value, sizeof(value));
+          if (value != r) {
+            printf("thread %d round %d got %lu\n", t, r, value);
+          }
+        }
+      });
+    }
+    for (int t = 0; t < threads; t++) {
+      workers[t].join();
+    }
+  }
+  auto end = chrono::steady_clock::now();
+  getrusage(RUSAGE_SELF, &ru_end);
+
+  if (receiver == node_id) {
+    uint64_t messages = (uint64_t)threads * rounds;
+    printf("threads:%d rounds:%d elapsed:%ldms\n", threads, rounds,
+      (long)chrono::duration_cast<chrono::milliseconds>(end - beg).count());
+    printf("voluntary ctx switches:%ld involuntary ctx switches:%ld per message:%.2f\n",
+      ru_end.ru_nvcsw - ru_beg.ru_nvcsw, ru_end.ru_nivcsw - ru_beg.ru_nivcsw,
+      (double)(ru_end.ru_nvcsw - ru_beg.ru_nvcsw + ru_end.ru_nivcsw - ru_beg.ru_nivcsw) / messages);
+    rosetta::io::NetStat stat = ((rosetta::io::TCPChannel*)channel)->GetNetStat(sender.c_str());
+    printf("recv wakeups:%lu futile wakeups:%lu per message:%.2f\n", stat.recv_wakeups(),
+      stat.recv_futile_wakeups(), (double)stat.recv_wakeups() / messages);
+  }
+  ::DestroyInternalChannel(channel);
+  return 0;
+}
@@ -29,18 +29,15 @@ int main(int argc, char* argv[]) {
   
   IChannel* channel = ::CreateInternalChannel("test", node_id, config_str.c_str(), nullptr);
   vector<string> connected_nodes = ::decode_vector(channel->GetConnectedNodeIDs());
-  int config_str_size = config_str.size();
   const char* data_id = "config str";
   for (int i = 0; i < connected_nodes.size(); i++) {
-    channel->Send(connected_nodes[i].c_str(), data_id, (const char*)&config_str_size, sizeof(int));
-    channel->Send(connected_nodes[i].c_str(), data_id, config_str.data(), config_str_size);
+    channel->Send(connected_nodes[i].c_str(), data_id, config_str.data(), config_str.size());
     printf("send data to %s\n", connected_nodes[i].c_str());
   }
   for (int i = 0; i < connected_nodes.size(); i++) {
-    int data_size = 0;
-    channel->Recv(connected_nodes[i].c_str(), data_id, (char*)&data_size, sizeof(int));
-    string data(data_size, 0);
-    channel->Recv(connected_nodes[i].c_str(), data_id, &data[0], data_size);
+    // one message per Send, no need to send the size first
+    string data;
+    int data_size = channel->RecvMessage(connected_nodes[i].c_str(), data_id, data);
     printf("recv data from %s, size:%d\n", connected_nodes[i].c_str(), data_size);
   }
   ::DestroyInternalChannel(channel);
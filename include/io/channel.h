@@ -23,6 +23,9 @@
 #include <map>
 #include <functional>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
 using namespace std;
 /**
  * @brief error_callback definition
@@ -60,6 +63,94 @@ typedef struct {
 
 typedef void(*error_callback)(const char*, const char*, int, const char*, void*);
 
+/**
+ * @brief MessagePriority is the send class of a message. Urgent messages (handshakes,
+ * barriers, short rounds) go ahead of the bulk data queued to the same node, between two messages.
+ * The class belongs to the message id, so that the messages of one id keep their order.
+*/
+typedef enum {
+   MSG_PRIORITY_BULK = 0,
+   MSG_PRIORITY_URGENT = 1,
+   MSG_PRIORITY_CLASSES = 2,
+} MessagePriority;
+
+/**
+ * @brief MessageDesc describes one message of a batched SendV/RecvV.
+*/
+typedef struct {
+   const char* node_id;
+   const char* id;
+   char* data;
+   uint64_t length;
+   int64_t result; // set to the result of this message, as Send/Recv would return it
+} MessageDesc;
+
+/**
+ * @brief IORequest is the completion handle of an asynchronous Send or Recv.
+ * Its result is what the blocking call would have returned.
+ * @note the callback runs on the thread completing the operation: an IO thread, or
+ * the calling thread if the operation completes immediately. It must not block.
+*/
+class IORequest {
+public:
+  typedef std::function<void(int64_t result)> Callback;
+
+  explicit IORequest(Callback callback = nullptr) : callback_(callback) {}
+
+  /**
+   * @brief Test whether the operation has completed, without blocking
+  */
+  bool Test();
+
+  /**
+   * @brief Wait wait for the operation to complete
+   * @param timeout milliseconds to wait at most, -1 to wait forever
+   * @return true if the operation has completed, false on timeout
+  */
+  bool Wait(int64_t timeout = -1);
+
+  /**
+   * @brief Result the result of a completed operation
+   * @return
+   *  the message length on success, -1 on error
+  */
+  int64_t Result();
+
+  /**
+   * @brief Complete called by channel implementations once the operation is done.
+   * The callback has returned before any waiter sees the request completed.
+  */
+  void Complete(int64_t result);
+
+private:
+  friend class IChannel;
+  struct Waiter {
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool fired = false;
+  };
+
+  Callback callback_ = nullptr;
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  bool done_ = false;
+  int64_t result_ = -1;
+  vector<shared_ptr<Waiter>> waiters_; // WaitAny callers watching this request
+};
+typedef shared_ptr<IORequest> IORequestPtr;
+
+/**
+ * @brief SendSpan is a buffer lent by IChannel::AcquireSendBuffer, to build one message in place.
+ * Write the message at data (length bytes), then publish it with IChannel::CommitSend.
+*/
+struct SendSpan {
+  char* data = nullptr;
+  uint64_t length = 0;
+  string node_id;
+  string id;
+  shared_ptr<void> owner = nullptr; // the channel memory data points into
+};
+
 /// Channel interface definition
 /// the functionality is sending a message to peer and 
 /// receiving a message from peer
@@ -75,16 +166,17 @@ public:
   virtual void SetErrorCallback(error_callback error_cb)= 0;
 
   /**
-   * @brief Recv receive a message from message queue， for the target node (blocking for timeout microseconds, default waiting forever)
+   * @brief Recv receive a message from message queue， for the target node (blocking for timeout milliseconds, default waiting forever)
    * @param node_id target node id for message receiving.
    * @param id identity of a message, could be a task id or message id.
    * @param data buffer to receive a message.
    * @param length data length expect to receive
-   * @param timeout timeout to receive a message.
+   * @param timeout timeout to receive a message, in milliseconds like IORequest::Wait. -1 to wait forever
    * @return 
    *  return message length if receive a message successfully
    *  0 if peer is disconnected  
    *  -1 if it gets a exception or error
+   *  -3 (E_TIMEOUT) if the message is not there in time, nothing is consumed then
   */
   virtual int64_t Recv(const char* node_id, const char* id, char* data, uint64_t length, int64_t timeout=-1) = 0;
 
@@ -140,6 +232,398 @@ public:
    * return node id of all the nodes establishing connection with the current node
   */
   virtual const NodeIDVec* GetConnectedNodeIDs() = 0;
+
+  // added later, behind the members above so that their vtable slots stay where the
+  // implementations built against the earlier interface expect them
+
+  /**
+   * @brief ResolvePeer resolve a node id once, for the handle versions of Send and Recv
+   * @return 
+   *  a small non-negative handle of the node
+   *  -1 if node_id is not connected or the channel has no handles
+  */
+  virtual int ResolvePeer(const char* node_id) { return -1; }
+
+  /**
+   * @brief RegisterMessageId register a message id once, for the handle versions of Send and Recv.
+   * Registering the same id again returns the same handle.
+   * @return 
+   *  a small non-negative handle of the message id
+   *  -1 if there are too many or the channel has no handles
+  */
+  virtual int RegisterMessageId(const char* id) { return -1; }
+
+  /**
+   * @brief Send send a message to a node, by the handles of ResolvePeer and RegisterMessageId.
+   * Same as the other Send, without parsing nor looking up the ids on each call.
+   * @return 
+   *  return length of data has been sent if send a message successfully
+   *  -1 if gets exceptions or error
+  */
+  virtual int64_t Send(int peer, int msg, const char* data, uint64_t length) { return -1; }
+
+  /**
+   * @brief Recv receive a message from a node, by the handles of ResolvePeer and RegisterMessageId.
+   * @param timeout milliseconds to wait at most as in the other Recv, -1 to wait forever
+   * @return 
+   *  message length if receive a message successfully
+   *  -1 if it gets a exception or error
+   *  -3 (E_TIMEOUT) if the message is not there in time, nothing is consumed then
+  */
+  virtual int64_t Recv(int peer, int msg, char* data, uint64_t length, int64_t timeout=-1) { return -1; }
+
+  /**
+   * @brief SendWithPriority send a message in the given priority class, see MessagePriority.
+   * Same as SetMessagePriority then Send: the later messages of id go in that class too
+   * @return 
+   *  return length of data has been sent if send a message successfully
+   *  -1 if gets exceptions or error
+  */
+  virtual int64_t SendWithPriority(const char* node_id, const char* id, const char* data, uint64_t length, int priority) {
+    return Send(node_id, id, data, length);
+  }
+
+  /**
+   * @brief SetMessagePriority send every later message of id in the given priority class,
+   * see MessagePriority. If the class changes, what is queued is written first, so that
+   * the later messages of id do not overtake the earlier ones
+  */
+  virtual void SetMessagePriority(const char* id, int priority) {}
+
+  /**
+   * @brief RecvMessage receive one whole message, exactly what one Send of the peer sent,
+   * without knowing its length in advance
+   * @param node_id target node id for message receiving.
+   * @param id identity of a message, could be a task id or message id.
+   * @param data set to the message, the channel hands its buffer over without copying
+   * @param timeout milliseconds to wait at most as in Recv, -1 to wait forever
+   * @return 
+   *  message length if receive a message successfully
+   *  -1 if it gets a exception or error, or the channel does not keep message boundaries
+   *  -3 (E_TIMEOUT) if no message is there in time
+  */
+  virtual int64_t RecvMessage(const char* node_id, const char* id, string& data, int64_t timeout=-1) { return -1; }
+
+  /**
+   * @brief Probe wait for the next message and return its length, without receiving it
+   * @return 
+   *  length of the next message of id from node_id
+   *  -1 if it gets a exception or error, or the channel does not keep message boundaries
+   *  -3 (E_TIMEOUT) if no message is there within timeout milliseconds, as in Recv
+  */
+  virtual int64_t Probe(const char* node_id, const char* id, int64_t timeout=-1) { return -1; }
+
+  /**
+   * @brief Expect announce the length of the next message of an id, so that its storage is
+   * set aside once, ahead of time, instead of growing while a large message streams in.
+   * @param node_id the node the message comes from
+   * @param id identity of a message, could be a task id or message id.
+   * @param length the length of the message, a message of another length is received as usual
+   * @param data optional, the buffer the message is received into by the channel. Receiving
+   * it later into the same buffer copies nothing. It must stay valid until then.
+   * @return 
+   *  0 if the storage is set aside
+   *  -1 if it gets a exception or error, or the channel does not support it
+  */
+  virtual int Expect(const char* node_id, const char* id, uint64_t length, char* data = nullptr) { return -1; }
+
+  /**
+   * @brief Cancel drop the data received for a message id and not read yet.
+   * The receivers waiting on it, blocked or asynchronous, return -5 (E_CANCELED).
+   * A message already coming into the buffer of a posted receive is dropped too, the
+   * buffer is the caller's again once Cancel returns. Data arriving later is kept, as for any message.
+   * @param node_id the node the message comes from
+   * @param id identity of a message, could be a task id or message id.
+   * @return 
+   *  bytes dropped
+   *  -1 if it gets a exception or error
+  */
+  virtual int64_t Cancel(const char* node_id, const char* id) { return -1; }
+
+  /**
+   * @brief PurgeTask cancel, on every node, the message ids starting with task_id,
+   * and drop their messages arriving from now on, e.g. after the task aborts.
+   * The connections pooled for later tasks keep dropping them until a channel with the task id
+   * of this one is created again, and only for the latest purges.
+   * @param task_id prefix of the message ids of the task, encoded as message ids
+   * @return 
+   *  bytes dropped
+   *  -1 if it gets a exception or error
+  */
+  virtual int64_t PurgeTask(const char* task_id) { return -1; }
+
+  /**
+   * called with each whole message of a handled id, data is only valid during the call
+  */
+  typedef std::function<void(const char* node_id, const char* id, const char* data, uint64_t length)> MessageHandler;
+
+  /**
+   * @brief OnMessage have the messages arriving from now on with an id starting with id_prefix
+   * delivered to handler instead of being kept for Recv, e.g. for a result node aggregating outputs.
+   * The handler runs on the IO thread of the node, as soon as a message is complete, so no thread
+   * has to wait on the ids. It must not wait for other messages from the same node.
+   * The longest matching prefix wins, messages placed by Expect or PostRecvs are left to their receivers.
+   * The handlers belong to the task of the channel and are removed when it is destroyed. Tasks on
+   * the same connections can not handle the same prefix, give them prefixes of their own.
+   * @param node_id the node the messages come from, null or empty for every node
+   * @param id_prefix prefix of the message ids, encoded as message ids, not empty
+   * @param handler null stops handling the prefix, a message already taken may still be delivered
+   * @return 
+   *  0 on success
+   *  -1 if it gets a exception or error, another task handles id_prefix, or the channel does not support it
+  */
+  virtual int OnMessage(const char* node_id, const char* id_prefix, MessageHandler handler) { return -1; }
+
+  /**
+   * @brief Fork create n sub-channels over the connections of this channel, without new sockets.
+   * Each has its own message id namespace and statistics, for parallel threads that would
+   * otherwise have to make their message ids unique. Every node must fork in the same order.
+   * A sub-channel must be released before its parent is destroyed.
+   * @return 
+   *  the n sub-channels, or none if the channel cannot fork
+  */
+  virtual vector<shared_ptr<IChannel>> Fork(int n) { return vector<shared_ptr<IChannel>>(); }
+
+  /**
+   * @brief RecvAsync post a receive and return without waiting for the message
+   * @param node_id target node id for message receiving.
+   * @param id identity of a message, could be a task id or message id.
+   * @param data buffer to receive a message, must stay valid until the request completes.
+   * @param length data length expect to receive
+   * @param callback optional, called with the result on completion
+   * @return
+   *  the completion handle of the receive
+   * @note channels without native support complete the receive before returning.
+  */
+  virtual IORequestPtr RecvAsync(const char* node_id, const char* id, char* data, uint64_t length, IORequest::Callback callback = nullptr) {
+    IORequestPtr request = make_shared<IORequest>(callback);
+    request->Complete(Recv(node_id, id, data, length));
+    return request;
+  }
+
+  /**
+   * @brief SendAsync send a message to target node without waiting for it to be written
+   * @param node_id target node id for message receiving
+   * @param id identity of a message, could be a task id or message id.
+   * @param data buffer to send, it may be reused as soon as SendAsync returns
+   * @param length data length expect to send
+   * @param callback optional, called with the result on completion
+   * @return
+   *  the completion handle of the send, completed once the message is written to the socket,
+   *  with -4 (E_UNCONNECTED) if the connection fails or closes before
+   * @note channels without native support complete the send before returning.
+  */
+  virtual IORequestPtr SendAsync(const char* node_id, const char* id, const char* data, uint64_t length, IORequest::Callback callback = nullptr) {
+    IORequestPtr request = make_shared<IORequest>(callback);
+    request->Complete(Send(node_id, id, data, length));
+    return request;
+  }
+
+  /**
+   * @brief Broadcast send the same message to several nodes
+   * @param node_ids target node ids
+   * @param id identity of a message, could be a task id or message id.
+   * @param data buffer to send
+   * @param length data length expect to send
+   * @return 
+   *  return length of data has been sent if sent to every node successfully
+   *  -1 if gets exceptions or error
+  */
+  virtual int64_t Broadcast(const NodeIDVec* node_ids, const char* id, const char* data, uint64_t length) {
+    int64_t ret = length;
+    for (int i = 0; i < node_ids->node_count; i++) {
+      if (Send(node_ids->node_ids[i], id, data, length) < 0)
+        ret = -1;
+    }
+    return ret;
+  }
+
+  /**
+   * @brief RecvFirstK receive message id from the first k nodes of node_ids that deliver it.
+   * The messages of the other nodes stay queued for later receives.
+   * @param node_ids candidate nodes
+   * @param id identity of a message, could be a task id or message id.
+   * @param data k blocks of length bytes, filled in arrival order
+   * @param length length of each message
+   * @param k number of messages to receive
+   * @param which k indexes into node_ids, which[j] is the sender of block j
+   * @return 
+   *  total length received, -1 if it gets an error
+   * @note channels without native support receive from the first k nodes in list order.
+  */
+  virtual int64_t RecvFirstK(const NodeIDVec* node_ids, const char* id, char* data, uint64_t length, int k, int* which) {
+    if (k <= 0 || k > node_ids->node_count)
+      return -1;
+    int64_t total = 0;
+    for (int j = 0; j < k; j++) {
+      which[j] = j;
+      if (Recv(node_ids->node_ids[j], id, data + j * length, length) < 0)
+        return -1;
+      total += length;
+    }
+    return total;
+  }
+
+  /**
+   * @brief RecvAny receive message id from whichever node of node_ids delivers it first
+   * @param which set to the index in node_ids of the sender
+   * @return 
+   *  message length, -1 if it gets an error
+  */
+  virtual int64_t RecvAny(const NodeIDVec* node_ids, const char* id, char* data, uint64_t length, int* which) {
+    return RecvFirstK(node_ids, id, data, length, 1, which);
+  }
+
+  /**
+   * @brief AcquireSendBuffer lend a buffer to write a message in place, instead of Send copying it
+   * @param node_id target node id for message receiving
+   * @param id identity of a message, could be a task id or message id.
+   * @param length length of the message
+   * @return 
+   *  a span of length writable bytes, to be passed to CommitSend
+  */
+  virtual SendSpan AcquireSendBuffer(const char* node_id, const char* id, uint64_t length) {
+    SendSpan span;
+    shared_ptr<char> buffer(new char[length > 0 ? length : 1], std::default_delete<char[]>());
+    span.data = buffer.get();
+    span.length = length;
+    span.node_id = node_id;
+    span.id = id;
+    span.owner = buffer;
+    return span;
+  }
+
+  /**
+   * @brief CommitSend send the message written into a span of AcquireSendBuffer.
+   * The span is released and must not be used any more.
+   * @return 
+   *  return length of data has been sent if send a message successfully
+   *  -1 if gets exceptions or error
+  */
+  virtual int64_t CommitSend(SendSpan& span) {
+    int64_t ret = Send(span.node_id.c_str(), span.id.c_str(), span.data, span.length);
+    span = SendSpan();
+    return ret;
+  }
+
+  /**
+   * @brief SendV send a batch of messages, to one or several nodes
+   * @param msgs the messages, sent in order for each node
+   * @param count number of messages
+   * @return 
+   *  total length of data has been sent, -1 if any message failed
+  */
+  virtual int64_t SendV(MessageDesc* msgs, int count) {
+    int64_t total = 0;
+    for (int i = 0; i < count; i++) {
+      msgs[i].result = Send(msgs[i].node_id, msgs[i].id, msgs[i].data, msgs[i].length);
+      total = (total < 0 || msgs[i].result < 0) ? -1 : total + msgs[i].result;
+    }
+    return total;
+  }
+
+  /**
+   * @brief RecvV receive a batch of messages, from one or several nodes.
+   * Returns once every message has been received, whatever their arrival order.
+   * @param msgs the messages to receive, in order for each node and message id
+   * @param count number of messages
+   * @return 
+   *  total length of data received, -1 if any message failed
+  */
+  virtual int64_t RecvV(MessageDesc* msgs, int count) {
+    int64_t total = 0;
+    for (int i = 0; i < count; i++) {
+      msgs[i].result = Recv(msgs[i].node_id, msgs[i].id, msgs[i].data, msgs[i].length);
+      total = (total < 0 || msgs[i].result < 0) ? -1 : total + msgs[i].result;
+    }
+    return total;
+  }
+
+  /**
+   * @brief PostRecvs post a sequence of receives at once, e.g. those of the next rounds of a
+   * protocol, and return without waiting. Each buffer is filled as its message arrives, while the
+   * caller goes on computing, and written right there by the channel when it can tell which
+   * message goes where. Wait on the requests one by one as the rounds need them.
+   * @param msgs the messages to receive, in order for each node and message id.
+   * Each data must stay valid until its request completes.
+   * @param count number of messages
+   * @param callback optional, called with the result of each receive as it completes
+   * @return
+   *  one completion handle per message, in the order of msgs
+   * @note channels without native support complete the receives before returning.
+  */
+  virtual vector<IORequestPtr> PostRecvs(MessageDesc* msgs, int count, IORequest::Callback callback = nullptr) {
+    vector<IORequestPtr> requests;
+    for (int i = 0; i < count; i++) {
+      requests.push_back(RecvAsync(msgs[i].node_id, msgs[i].id, msgs[i].data, msgs[i].length, callback));
+    }
+    return requests;
+  }
+
+  /**
+   * @brief Exchange all-to-all exchange among node_ids, the current node included.
+   * Block i of send_data goes to node_ids[i], block i of recv_data comes from node_ids[i].
+   * All the transfers are issued at once and complete in whatever order the peers deliver.
+   * @param node_ids the participants, the same list on every node
+   * @param id identity of the messages
+   * @param send_data node_count blocks of length bytes
+   * @param recv_data node_count blocks of length bytes
+   * @param length block length
+   * @return 
+   *  0 on success, -1 if any transfer failed
+  */
+  virtual int64_t Exchange(const NodeIDVec* node_ids, const char* id, const char* send_data, char* recv_data, uint64_t length);
+
+  /**
+   * @brief Gather every node of node_ids sends send_data to root,
+   * which receives the block of node_ids[i] into block i of recv_data
+   * @param root the receiving node
+   * @param recv_data node_count blocks of length bytes, used on root only
+   * @return 
+   *  0 on success, -1 if any transfer failed
+  */
+  virtual int64_t Gather(const char* root, const NodeIDVec* node_ids, const char* id, const char* send_data, char* recv_data, uint64_t length);
+
+  /**
+   * @brief Scatter root sends block i of send_data to node_ids[i], which receives it into recv_data
+   * @param root the sending node
+   * @param send_data node_count blocks of length bytes, used on root only
+   * @return 
+   *  0 on success, -1 if any transfer failed
+  */
+  virtual int64_t Scatter(const char* root, const NodeIDVec* node_ids, const char* id, const char* send_data, char* recv_data, uint64_t length);
+
+  /**
+   * @brief Barrier return once every node of node_ids has entered the barrier
+   * @return 
+   *  0 on success, -1 if any transfer failed
+  */
+  virtual int64_t Barrier(const NodeIDVec* node_ids, const char* id);
+
+  /**
+   * @brief WaitAll wait for all the requests to complete
+   * @param timeout milliseconds to wait at most, -1 to wait forever
+   * @return
+   *  true if all the requests have completed, false on timeout
+  */
+  static bool WaitAll(const vector<IORequestPtr>& requests, int64_t timeout = -1);
+
+  /**
+   * @brief WaitAny wait for one of the requests to complete
+   * @param timeout milliseconds to wait at most, -1 to wait forever
+   * @return
+   *  the index of a completed request, -1 on timeout or if requests is empty
+  */
+  static int WaitAny(const vector<IORequestPtr>& requests, int64_t timeout = -1);
+
+  /**
+   * @brief SetCorked cork or uncork the connections of the channel. While corked, Send only
+   * queues the messages, Flush then writes them together, e.g. the messages of one round.
+   * They are also written once enough of them are queued. Uncorking lets the queue go.
+   * Sub-channels share the connections, so the setting applies to all of them. Other tasks on
+   * the same connections are not corked, a message of theirs takes the queue along with it.
+   */
+  virtual void SetCorked(bool corked) {}
 };// IChannel
 
 
@@ -25,6 +25,16 @@
 namespace rosetta {
 namespace io {
 
+/**
+ * How setting up a connection went, times in microseconds from the start of connect.
+ */
+struct connect_timing {
+  int attempts = 0;
+  int64_t connected_us = 0; // TCP connection established
+  int64_t acked_us = 0; // server ack received
+  int64_t ready_us = 0; // handshake done, the connection is usable
+};
+
 class TCPClient : public Socket {
  public:
   TCPClient(const string& task_id, const string& node_id, const std::string& host, int port) 
@@ -37,6 +47,7 @@ class TCPClient : public Socket {
   void setsid(const string& sid) { sid_ = sid; }
   void setsslid(const string& sslid) { sslid_ = sslid; }
   shared_ptr<Connection> get_connection() { return conn_; }
+  const connect_timing& timing() const { return timing_; }
   static uint64_t get_unrecv_size();
 
  public:
@@ -44,21 +55,33 @@ class TCPClient : public Socket {
    * \param timeout ms
    */
   bool connect(int64_t timeout, int64_t conn_retries);
+  /**
+   * connect several clients at once, see connect
+   */
+  static bool connect_all(const vector<TCPClient*>& clients, int64_t timeout, int64_t conn_retries);
   void close();
   bool closed() { return !connected_; }
   bool is_first_connect() { return is_first_connect_; }
 
   virtual bool init_ssl() { return true; }
 
+ protected:
+  int prepare_connect();
+  int start_connect();
+  bool finish_connect();
+  void give_up_connect();
+
  protected:
   string host_ = ""; // Domain www.xxxx.yyy
   string ip_ = ""; // IP xxx.xxx.xxx.xxx
   int port_ = 0;
+  string node_address_ = ""; // ip:port
   int fd_ = -1;
   string node_id_ = "";
   string task_id_ = "";
   bool connected_ = false;
   bool is_first_connect_ = false;
+  connect_timing timing_;
   shared_ptr<Connection> conn_ = nullptr;
   static map<string, shared_ptr<Connection>> connections_;
   static vector<shared_ptr<Connection>> recycle_connections_;
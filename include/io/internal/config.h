@@ -29,6 +29,8 @@ using namespace std;
 #include <rapidjson/document.h>
 using rapidjson::Document;
 
+#include "io/internal/netutil.h"
+
 namespace rosetta {
 namespace io {
 struct Node {
@@ -126,6 +128,16 @@ class ChannelConfig {
   ResultNodeConfig result_config_;
   int connect_timeout_ = 10 * 1000; // ms
   int connect_retries_ = 5;
+  netutil::IOThreadAffinity io_affinity_; // IO_CPUS, IO_NUMA_LOCAL, IO_THREAD_NAMES
+  int coalesce_us_ = 0; // COALESCE_US, 0 to write every message at once
+  int coalesce_bytes_ = 64 * 1024; // COALESCE_BYTES
+  bool keep_connections_ = false; // KEEP_CONNECTIONS, pool the connections for the next tasks
+  bool lazy_connect_ = false; // LAZY_CONNECT, connect to a peer when it is first used
+  vector<string> prewarm_nodes_; // PREWARM_NODES, connected to each other at once even if lazy
+
+ public:
+  //! the connection between node_id and peer is set up at channel creation
+  bool is_eager(const string& node_id, const string& peer) const;
 };
 
 }
@@ -17,20 +17,156 @@
 // ==============================================================================
 
 #pragma once
+#include "io/channel.h"
 #include "io/internal/cycle_buffer.h"
+#include "io/internal/message_queue.h"
+#include "io/internal/simple_buffer.h"
 #include "io/internal/socket.h"
 #include "io/internal/ssl_socket.h"
+#include "io/internal/stat.h"
+
+#include <sys/uio.h>
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <map>
 #include <iostream>
 #include <mutex>
 #include <thread>
+#include <vector>
 using namespace std;
 
 namespace rosetta {
 namespace io {
 
+/**
+ * A receiver blocked on one message id.
+ * Waiters of the same id are queued in arrival order, and only the head is
+ * woken up once its length can be read, or once a message is there if whole_message.
+ * An asynchronous receiver (done is set) does not wait: whoever makes it ready
+ * reads the message into data and calls done with the result.
+ * If claim is set, it is asked for the destination first, a null one drops the
+ * waiter without consuming the message (e.g. another peer answered first).
+ * A canceled waiter is ready with result E_CANCELED, E_TIMEOUT once its deadline
+ * passed or E_UNCONNECTED once the connection closed, and already out of the queue.
+ */
+struct recv_waiter {
+  uint64_t length = 0;
+  bool whole_message = false;
+  bool ready = false;
+  bool canceled = false;
+  std::condition_variable cv;
+  char* data = nullptr;
+  std::function<void(ssize_t)> done = nullptr;
+  std::function<char*()> claim = nullptr;
+  ssize_t result = -1;
+};
+
+/**
+ * Storage set aside by expect for the next message of an id, either the receiver's
+ * own buffer or a string allocated ahead of time.
+ */
+struct expected_message {
+  uint64_t length = 0;
+  char* data = nullptr;
+  string storage;
+};
+
+/**
+ * A frame the reactor has started writing into a caller's buffer. A cancel revokes it:
+ * the reactor writes the rest aside, loop_recv drops the frame, and the buffer is the
+ * caller's again. Protected by mapbuffer_mtx_.
+ */
+struct placement {
+  bool revoked = false;
+};
+
+/**
+ * What the connection keeps for one message id: the messages received and the receivers
+ * waiting, in arrival order. Protected by mapbuffer_mtx_.
+ */
+struct id_slot {
+  message_queue messages;
+  deque<shared_ptr<recv_waiter>> waiters;
+  deque<expected_message> expected;
+  deque<shared_ptr<placement>> placed; // frames started into a caller's buffer, not dispatched yet
+  int registered = 0; // handle caches of the tasks holding it, see slot_of. never erased meanwhile
+};
+
+/**
+ * A frame the reactor receives straight into its own storage instead of buffer_,
+ * because it is large or expected. Its payload goes into data if set, into payload otherwise.
+ * It is handed to loop_recv after the first `mark` bytes ever written into buffer_.
+ */
+struct incoming_frame {
+  uint64_t mark = 0;
+  string id;
+  string payload;
+  char* data = nullptr;
+  shared_ptr<placement> placed; // set if data is a caller's buffer
+  uint64_t length = 0;
+  uint64_t filled = 0;
+};
+
+/**
+ * Called by loop_recv with each whole message of a handled id prefix, instead of queueing it.
+ * data is only valid during the call.
+ */
+typedef std::function<void(const string& node_id, const string& id, const char* data, uint64_t length)> message_handler;
+
+/**
+ * A handler set by a task with Connection::on_message, removed when the task stops.
+ */
+struct prefix_handler {
+  string task_id;
+  string prefix;
+  message_handler handler;
+};
+
+/**
+ * One message of a batched send or receive.
+ */
+struct msg_desc {
+  string id;
+  char* data = nullptr;
+  uint64_t length = 0;
+  ssize_t result = -1;
+};
+
+/**
+ * A frame queued by reference, possibly by several connections (see BasicIO::broadcast).
+ * A bulk one goes on the wire after the first `mark` bytes ever queued into send_buffer_.
+ */
+struct shared_frame {
+  uint64_t mark = 0;
+  shared_ptr<simple_buffer> frame = nullptr;
+  uint64_t offset = 0; // already written inline
+  int priority = MSG_PRIORITY_BULK;
+  chrono::steady_clock::time_point queued_at;
+};
+
+/**
+ * The end of a frame copied into send_buffer_, in bytes ever queued.
+ * loop_send only cuts send_buffer_ there, so that urgent frames go between two messages.
+ */
+struct frame_mark {
+  uint64_t end = 0;
+  int priority = MSG_PRIORITY_BULK;
+  chrono::steady_clock::time_point queued_at;
+};
+
+/**
+ * What loop_send takes out of the send queue at once, in wire order.
+ */
+struct send_chunk {
+  char* bytes = nullptr; // copied out of send_buffer_
+  vector<shared_ptr<simple_buffer>> frames;
+  vector<pair<const char*, uint64_t>> segments;
+};
+
 struct Connection {
  public:
   Connection(int _fd, int _events, bool _is_server, const string& node_id);
@@ -43,21 +179,67 @@ struct Connection {
 
  public:
   ssize_t send(const char* data, size_t len, int64_t timeout = -1L);
-  ssize_t put_into_send_buffer(const char* data, size_t len, int64_t timeout = -1L);
-  ssize_t send(const string& id, const char* data, uint64_t length, int64_t timeout = -1L);
+  ssize_t put_into_send_buffer(const char* data, size_t len, int64_t timeout = -1L, bool corked = false);
+  //! corked if the task sending is, see uncork
+  ssize_t send(const string& id, const char* data, uint64_t length, int64_t timeout = -1L, int priority = MSG_PRIORITY_BULK, bool corked = false);
+  //! wait at most timeout milliseconds if timeout >= 0, E_TIMEOUT then
   ssize_t recv(const string& id, char* data, uint64_t length, int64_t timeout = -1L);
+  /**
+   * receive on a registered message id, see BasicIO::register_id. slots is the cache of the task
+   * by handle, guarded by mapbuffer_mtx_. id is only read the first time
+   */
+  ssize_t recv(vector<shared_ptr<id_slot>>& slots, int handle, const string& id, char* data, uint64_t length, int64_t timeout = -1L);
+  //! let go of the slots cached by a task, before it leaves the connection
+  void release_slots(vector<shared_ptr<id_slot>>& slots);
+  //! receive one whole message, as sent by one send. the payload is moved into data
+  ssize_t recv_message(const string& id, string& data, int64_t timeout = -1L);
+  //! wait for the next message of id and return its size, without consuming it
+  ssize_t probe(const string& id, int64_t timeout = -1L);
+  ssize_t sendv(vector<msg_desc>& msgs, bool corked = false);
+  //! send a message already framed, without copying it. the frame may be shared by several connections
+  ssize_t send_frame(const shared_ptr<simple_buffer>& frame, uint64_t length, int priority = MSG_PRIORITY_BULK, bool corked = false);
+  //! receive without blocking, done is called with the result once data is filled
+  void recv_async(const string& id, char* data, uint64_t length, std::function<void(ssize_t)> done);
+  //! receive without blocking into data, written there by the reactor if possible, see place_next
+  void post_recv(const string& id, char* data, uint64_t length, std::function<void(ssize_t)> done);
+  //! queue an asynchronous waiter on id, see recv_waiter
+  void post_waiter(const string& id, const shared_ptr<recv_waiter>& waiter);
+  //! remove a waiter that has not been served yet
+  void cancel_waiter(const string& id, const shared_ptr<recv_waiter>& waiter);
+  //! receive a batch without blocking, done is called once all of msgs are filled
+  void recvv(vector<msg_desc>& msgs, std::function<void()> done);
+  //! the messages of a corked task are only queued, until flush, until cork_limit_ bytes are
+  //! queued, or until a task not corked queues one. uncork lets what they queued go now
+  void uncork();
+  //! write what is queued now, on the caller thread
+  void flush();
+  //! hold the messages sent in quick succession for up to max_delay_us, or until max_bytes
+  //! are queued, and write them at once. 0 writes every message at once. the tasks share the
+  //! send queue, the settings of the first are kept until it stops
+  void set_coalescing(const string& task_id, uint64_t max_delay_us, uint64_t max_bytes);
+  //! set storage aside for the next message of id, which must be length bytes long.
+  //! if data is set the message is received right there, and must stay valid until read
+  void expect(const string& id, uint64_t length, char* data);
+  //! drop what has been received for id and fail its receivers with E_CANCELED. returns bytes dropped
+  uint64_t cancel(const string& id);
+  //! cancel every id starting with prefix, and if drop_later the messages arriving later,
+  //! until task_id, the task purging, starts on the connection again
+  uint64_t purge(const string& task_id, const string& prefix, bool drop_later = true);
+  //! hand the messages arriving from now on with an id starting with prefix to handler,
+  //! on the receiving thread, until task_id stops. a null handler removes the prefix.
+  //! false if another task handles the prefix
+  bool on_message(const string& task_id, const string& prefix, message_handler handler);
 
   // Read & Write
  public:
   ssize_t peek(int sockfd, void* buf, size_t len);
   ssize_t readn(int connfd, char* vptr, size_t n);
   ssize_t writen(int connfd, const char* vptr, size_t n);
-  void write(const char* data, size_t len) {
-    buffer_->write(data, len);
-    log_debug << "recv data from " << node_id_ << " size:" << len;
-    std::unique_lock<std::mutex> lck(buffer_mtx_);
-    buffer_cv_.notify_all();
-  }
+  ssize_t writev_all(struct iovec* iov, int iovcnt);
+  //! called by the reactor when the socket becomes writable again
+  void on_writable();
+  //! called by the reactor with the bytes read from the socket
+  void write(const char* data, size_t len);
 
   virtual ssize_t readImpl(int fd, char* data, size_t len) {
     ssize_t ret = ::read(fd, data, len);
@@ -67,6 +249,8 @@ struct Connection {
     ssize_t ret = ::write(fd, data, len);
     return ret;
   }
+  //! whether send can write a message on the caller thread, bypassing send_buffer_
+  virtual bool can_send_inline() const { return true; }
 
   void start(const string& task_id);
   void stop(const string& task_id);
@@ -76,7 +260,11 @@ struct Connection {
   bool is_reuseable() {
     return reuseable_;
   }
+  //! the socket is open and the peer has not closed its side, as far as can be told without reading
+  bool is_alive();
   uint64_t get_unrecv_size();
+  //! time the messages of a priority class spent queued before loop_send took them
+  TimingStat get_queue_delay(int priority);
 
 private:
   void start_recv();
@@ -88,8 +276,42 @@ private:
   void do_start(const string& task_id);
   void do_stop(const string& task_id);
   void flush_send_buffer();
+  ssize_t send_inline(const string& id, const char* data, uint64_t length, int priority, bool corked);
+  bool write_or_queue(struct iovec* iov, int iovcnt, bool try_write, int priority, bool corked);
+  void queue_frame(const shared_ptr<simple_buffer>& frame, uint64_t offset, int priority, bool corked);
+  bool send_queue_empty();
+  bool can_write_now(int priority, bool corked);
+  bool coalesce_now();
+  bool send_queue_ready();
+  void notify_sender();
+  void take_send_queue(send_chunk& chunk);
+  void take_bulk(vector<shared_frame>& plan, uint64_t& bytes, uint64_t quantum, chrono::steady_clock::time_point now);
+  void write_send_chunk(send_chunk& chunk);
+  bool start_incoming(const char* id, size_t id_len, uint64_t length);
+  bool place_next(id_slot& slot, char* data, uint64_t length);
+  bool incoming_ready();
+  void revoke_locked(id_slot& slot);
+  bool unplace(const string& id, const shared_ptr<placement>& placed);
+  shared_ptr<id_slot> get_slot(const string& id);
+  id_slot& slot_of(vector<shared_ptr<id_slot>>& slots, int handle, const string& id);
+  shared_ptr<recv_waiter> ready_waiter(id_slot& slot);
+  void dispatch_waiters(id_slot& slot, vector<shared_ptr<recv_waiter>>& ready);
+  shared_ptr<recv_waiter> wait_turn(unique_lock<mutex>& lck, id_slot& slot, uint64_t length, bool whole_message, int64_t timeout = -1);
+  void end_turn(unique_lock<mutex>& lck, id_slot& slot, const shared_ptr<recv_waiter>& waiter);
+  ssize_t recv_from(unique_lock<mutex>& lck, id_slot& slot, char* data, uint64_t length, int64_t timeout = -1);
+  static void wake_waiters(const vector<shared_ptr<recv_waiter>>& ready);
+  uint64_t cancel_locked(const string& id, vector<shared_ptr<recv_waiter>>& canceled);
+  void fail_locked(id_slot& slot, vector<shared_ptr<recv_waiter>>& failed);
+  void end_recv_locked(vector<shared_ptr<recv_waiter>>& failed);
+  bool is_purged(const string& id);
+  message_handler* handler_of(const string& id);
+  bool wait_writable();
+  bool wait_readable();
 
  protected:
+  //! fail every receiver still waiting with E_UNCONNECTED, once the connection is closed
+  void fail_waiters();
+
   std::mutex mtx_send_;
   std::atomic<int> atomic_send_{0};
 
@@ -108,6 +330,7 @@ private:
 
   int fd_ = -1;
   int events_ = 0;
+  int epollfd_ = -1; // the reactor this connection is registered in
   bool is_server_ = false;
   string client_ip_ = "";
   int client_port_ = 0;
@@ -117,21 +340,87 @@ private:
   //! buffer manage
   //! for all messages
   shared_ptr<cycle_buffer> buffer_ = nullptr;
+  //! frame parsing in write, only touched by the reactor
+  string recv_head_; // header of the next frame, when it spans two reads
+  uint64_t frame_left_ = 0; // bytes of the current frame still to go into buffer_
+  bool receiving_ = false; // incoming_ is being filled
+  //! the reactor fills incoming_ under incoming_mtx_, so that a cancel can redirect it
+  incoming_frame incoming_;
+  std::mutex incoming_mtx_;
+  uint64_t buffered_bytes_ = 0; // bytes ever written into buffer_
+  //! frames received in their own storage, protected by buffer_mtx_
+  deque<incoming_frame> incoming_frames_;
+  uint64_t unbuffered_bytes_ = 0; // bytes ever read out of buffer_, by loop_recv
+  //! payloads from this size on are received into their own storage
+  uint64_t recv_direct_bytes_ = 1024 * 1024;
+  //! number of expected_message waiting in the slots
+  std::atomic<int> expected_count_{0};
+  //! frames whose header the reactor has parsed, and those loop_recv has put into their slot,
+  //! protected by mapbuffer_mtx_. they differ while frames are in flight
+  std::atomic<uint64_t> frames_parsed_{0};
+  uint64_t frames_dispatched_ = 0;
+  //! the whole frames received when the connection closed, and whether loop_recv has
+  //! dispatched them all, failing the waiters left. protected by mapbuffer_mtx_
+  uint64_t frames_at_close_ = UINT64_MAX;
+  bool recv_ended_ = false;
   //! for one message which id is msg_id_t
-  map<string, shared_ptr<cycle_buffer>> mapbuffer_;
+  map<string, shared_ptr<id_slot>> mapbuffer_;
+  //! id prefixes whose messages are dropped on arrival, with the task purging them, oldest first.
+  //! each frame is checked against all of them, so only the latest few are kept, enough for
+  //! the tasks of a burst of aborts. protected by mapbuffer_mtx_
+  deque<pair<string, string>> purged_prefixes_;
+  static const size_t max_purged_prefixes_ = 32;
+  //! id prefixes whose messages go to a handler, one task each, protected by mapbuffer_mtx_
+  vector<prefix_handler> handlers_;
   shared_ptr<cycle_buffer> send_buffer_ = nullptr;
   std::mutex mapbuffer_mtx_;
   std::mutex buffer_mtx_;
   std::mutex send_buffer_mtx_;
-  std::condition_variable mapbuffer_cv_;
   std::condition_variable buffer_cv_;
   std::condition_variable send_buffer_cv_;
+  //! loop_send is writing data taken out of send_buffer_, protected by send_buffer_mtx_
+  bool sending_ = false;
+  //! frames queued by reference, ordered against send_buffer_ by byte counts.
+  //! all protected by send_buffer_mtx_
+  deque<shared_frame> shared_frames_;
+  deque<frame_mark> frame_marks_;
+  uint64_t queued_bytes_ = 0; // bytes ever written into send_buffer_
+  uint64_t drained_bytes_ = 0; // bytes ever taken out of send_buffer_
+  //! the head of send_buffer_/shared_frames_ is the rest of a frame partly on the wire
+  bool partial_head_ = false;
+  //! urgent frames, sent between two bulk messages
+  deque<shared_frame> urgent_frames_;
+  //! bytes of each class loop_send takes in turn, urgent first
+  uint64_t send_quantum_ = 256 * 1024;
+  //! bytes queued in shared_frames_ and urgent_frames_
+  uint64_t frame_bytes_ = 0;
+  //! a task not corked queued something, loop_send takes the queue without waiting for
+  //! cork_limit_ bytes. cleared once the queue is empty
+  bool release_ = false;
+  uint64_t cork_limit_ = 64 * 1024;
+  //! coalescing of the messages sent in quick succession, see set_coalescing
+  uint64_t coalesce_us_ = 0;
+  uint64_t coalesce_bytes_ = 64 * 1024;
+  int coalesce_min_frames_ = 4; // frames expected within coalesce_us_ to hold them
+  double send_gap_us_ = 0; // moving average of the time between two sends
+  chrono::steady_clock::time_point last_send_at_;
+  bool holding_ = false; // the queue is held since hold_since_
+  chrono::steady_clock::time_point hold_since_;
+  TimingStat queue_delay_[MSG_PRIORITY_CLASSES];
+
+  //! the socket buffer is not full. a writer waits for EPOLLOUT otherwise
+  bool writable_ = true;
+  std::mutex writable_mtx_;
+  std::condition_variable writable_cv_;
+  //! number of threads dispatching epoll events
+  static std::atomic<int> reactors_;
 
   map<string, bool> stop_works_;
   std::mutex stop_work_mtx_;
-  std::condition_variable stop_work_cv_;
 
   int task_count_ = 0;
+  string coalescing_task_; // whose settings of set_coalescing are used, while it is attached
+  uint64_t tasks_started_ = 0; // tasks that ever attached, a pool hit for all but the first
   std::mutex task_mtx_;
   std::condition_variable task_cv_;
 
@@ -143,6 +432,8 @@ private:
   map<string, std::thread*> threads_;
   std::mutex thread_mtx_;
 
+  NetStat_st stat_;
+
   SSL_CTX* ctx_ = nullptr; // do not delete this pointer in this class
 };
 
@@ -157,6 +448,7 @@ class SSLConnection : public Connection {
   virtual bool handshake();
   virtual ssize_t readImpl(int fd, char* data, size_t len);
   virtual ssize_t writeImpl(int fd, const char* data, size_t len);
+  virtual bool can_send_inline() const { return false; }
 };
 
 } // namespace io
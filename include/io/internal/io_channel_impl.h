@@ -21,6 +21,7 @@
 
 #include "io/channel.h"
 #include "io/internal/config.h"
+#include "io/internal/stat.h"
 
 #if USE_EMP_IO
 #include "cc/third_party/emp-toolkit/emp-tool/emp-tool/emp-tool.h"
@@ -57,10 +58,10 @@ class TCPChannel : public IChannel{
   public:
 #if USE_EMP_IO
     TCPChannel(string task_id, string ip, int port, shared_ptr<emp::NetIO> net_io, const string& node_id, shared_ptr<io::ChannelConfig> config)
-      : _net_io(net_io), node_id_(node_id), config_(config), task_id_(task_id), ip_(ip), port_(port){ };
+      : _net_io(net_io), node_id_(node_id), config_(config), task_id_(task_id), fork_namespace_(fork_namespace(task_id)), ip_(ip), port_(port){ };
 #else
     TCPChannel(string task_id, shared_ptr<io::BasicIO> net_io, const string& node_id, shared_ptr<io::ChannelConfig> config)
-      : _net_io(net_io), node_id_(node_id), config_(config), task_id_(task_id){ };
+      : _net_io(net_io), node_id_(node_id), config_(config), task_id_(task_id), fork_namespace_(fork_namespace(task_id)){ };
 #endif
 
     virtual ~TCPChannel();
@@ -71,8 +72,62 @@ class TCPChannel : public IChannel{
 
     virtual int64_t Send(const char* node_id, const char* id, const char* data, uint64_t length, int64_t timeout = -1);
 
+    virtual int64_t RecvMessage(const char* node_id, const char* id, string& data, int64_t timeout = -1);
+
+    virtual int64_t Probe(const char* node_id, const char* id, int64_t timeout = -1);
+
+    virtual int Expect(const char* node_id, const char* id, uint64_t length, char* data = nullptr);
+
+    virtual int64_t Cancel(const char* node_id, const char* id);
+
+    virtual int64_t PurgeTask(const char* task_id);
+
+    virtual int OnMessage(const char* node_id, const char* id_prefix, MessageHandler handler);
+
+    virtual vector<shared_ptr<IChannel>> Fork(int n);
+
+    virtual IORequestPtr RecvAsync(const char* node_id, const char* id, char* data, uint64_t length, IORequest::Callback callback = nullptr);
+
+    virtual vector<IORequestPtr> PostRecvs(MessageDesc* msgs, int count, IORequest::Callback callback = nullptr);
+
+    virtual IORequestPtr SendAsync(const char* node_id, const char* id, const char* data, uint64_t length, IORequest::Callback callback = nullptr);
+
+    virtual int64_t Broadcast(const NodeIDVec* node_ids, const char* id, const char* data, uint64_t length);
+
+    virtual int64_t RecvFirstK(const NodeIDVec* node_ids, const char* id, char* data, uint64_t length, int k, int* which);
+
+    virtual int ResolvePeer(const char* node_id);
+
+    virtual int RegisterMessageId(const char* id);
+
+    virtual int64_t Send(int peer, int msg, const char* data, uint64_t length);
+
+    virtual int64_t Recv(int peer, int msg, char* data, uint64_t length, int64_t timeout = -1);
+
+    virtual int64_t SendWithPriority(const char* node_id, const char* id, const char* data, uint64_t length, int priority);
+
+    virtual void SetMessagePriority(const char* id, int priority);
+
+    virtual SendSpan AcquireSendBuffer(const char* node_id, const char* id, uint64_t length);
+
+    virtual int64_t CommitSend(SendSpan& span);
+
+    virtual int64_t SendV(MessageDesc* msgs, int count);
+
+    virtual int64_t RecvV(MessageDesc* msgs, int count);
+
+    virtual int64_t Exchange(const NodeIDVec* node_ids, const char* id, const char* send_data, char* recv_data, uint64_t length);
+
+    virtual int64_t Gather(const char* root, const NodeIDVec* node_ids, const char* id, const char* send_data, char* recv_data, uint64_t length);
+
+    virtual int64_t Scatter(const char* root, const NodeIDVec* node_ids, const char* id, const char* send_data, char* recv_data, uint64_t length);
+
+    virtual int64_t Barrier(const NodeIDVec* node_ids, const char* id);
+
     virtual void Flush();
 
+    virtual void SetCorked(bool corked);
+
     virtual const NodeIDVec* GetDataNodeIDs();
 
     virtual const NodeIDMap* GetComputationNodeIDs();
@@ -85,6 +140,21 @@ class TCPChannel : public IChannel{
 
     void SetConnectedNodeIDs(const vector<string>& connected_nodes) { connected_nodes_ = connected_nodes; }
 
+    /**
+     * @brief network statistics of the connection with node_id
+     */
+    NetStat GetNetStat(const char* node_id);
+
+    /**
+     * @brief timing of the collectives run on this channel, by name ("Exchange", "Gather", ...)
+     */
+    map<string, CollectiveStat> GetCollectiveStat();
+
+    /**
+     * @brief time the messages of a priority class spent queued for node_id, see MessagePriority
+     */
+    TimingStat GetQueueDelayStat(const char* node_id, int priority);
+
   private:
     const vector<string>& getDataNodeIDs();
 
@@ -96,6 +166,13 @@ class TCPChannel : public IChannel{
     
     const vector<string>& getConnectedNodeIDs();
 
+    void addCollectiveTime(const string& name, int64_t us);
+
+  private:
+    static string fork_namespace(const string& task_id);
+    //! a decoded message id in the reserved range of the sub-channels, but not of this task's
+    bool is_reserved(const string& msg_id);
+
 #if USE_EMP_IO
     shared_ptr<emp::NetIO> GetSubIO(string id);
 #endif
@@ -116,6 +193,10 @@ class TCPChannel : public IChannel{
     vector<string> connected_nodes_;
     string node_id_;
     string task_id_;
+    string fork_namespace_; // decoded, the ids of the sub-channels of the task start with it
+    std::atomic<uint32_t> forks_{0};
+    std::mutex collective_stat_mtx_;
+    map<string, CollectiveStat> collective_stat_;
 
 };
 } // namespace io
@@ -0,0 +1,65 @@
+// ==============================================================================
+// Copyright 2020 The LatticeX Foundation
+// This file is part of the Rosetta library.
+//
+// The Rosetta library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The Rosetta library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the Rosetta library. If not, see <http://www.gnu.org/licenses/>.
+// ==============================================================================
+#pragma once
+
+#include <deque>
+#include <string>
+using namespace std;
+
+namespace rosetta {
+namespace io {
+
+/**
+ * The received messages of one message id, kept as the payloads loop_recv parsed.
+ * 
+ * Byte reads may span several messages, take() hands over the head message,
+ * without a copy if nothing of it has been read yet.
+ * A placed message was already written by the reactor into the receiver's buffer
+ * (see Connection::expect), reading it back into that buffer copies nothing.
+ * Not thread safe, the connection guards it with mapbuffer_mtx_.
+ */
+struct message_queue {
+  struct entry {
+    string bytes;
+    char* placed = nullptr;
+    uint64_t length = 0;
+    const char* data() const { return placed != nullptr ? placed : bytes.data(); }
+  };
+  deque<entry> messages_;
+  uint64_t offset_ = 0; // bytes of the head message already read
+  uint64_t size_ = 0; // bytes not read yet
+
+  uint64_t size() const { return size_; }
+  bool empty() const { return messages_.empty(); }
+  bool can_read(uint64_t length) const { return size_ >= length; }
+
+ public:
+  void push(string&& message);
+  void push_placed(char* data, uint64_t length);
+  /**
+   * The caller must make sure that can read length size bytes data
+   */
+  int64_t read(char* data, uint64_t length);
+  /**
+   * What is left of the head message, the queue must not be empty
+   */
+  uint64_t front_size() const { return messages_.front().length - offset_; }
+  string take();
+};
+} // namespace io
+} // namespace rosetta
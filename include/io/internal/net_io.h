@@ -91,6 +91,120 @@ class BasicIO {
  public:
   ssize_t recv(const string& node_id, char* data, uint64_t length, const string& id, int64_t timeout);
   ssize_t send(const string& node_id, const char* data, uint64_t length, const string& id, int64_t timeout);
+  ssize_t send(const string& node_id, const char* data, uint64_t length, const string& id, int64_t timeout, int priority);
+  /**
+   * handle of a peer, an index into a table built by init. -1 if node_id is not a peer
+   */
+  int resolve_peer(const string& node_id);
+  /**
+   * handle of a message id, registered once. -1 if there are too many
+   */
+  int register_id(const string& id);
+  /**
+   * send and receive by handles, without looking up nor copying the node id and message id
+   */
+  ssize_t send(int peer, int msg, const char* data, uint64_t length);
+  ssize_t recv(int peer, int msg, char* data, uint64_t length, int64_t timeout = -1L);
+  /**
+   * the priority class of the later messages of id, MSG_PRIORITY_BULK by default.
+   * flushes the connections if it changes, see IChannel::SetMessagePriority
+   */
+  void set_priority(const string& id, int priority);
+  int get_priority(const string& id);
+  ssize_t recv_message(const string& node_id, string& data, const string& id, int64_t timeout = -1L);
+  ssize_t probe(const string& node_id, const string& id, int64_t timeout = -1L);
+  /**
+   * post a receive, done is called with the result on the receiving thread of the connection
+   * or on the caller thread if the data is already there
+   */
+  void recv_async(const string& node_id, char* data, uint64_t length, const string& id, std::function<void(ssize_t)> done);
+  /**
+   * receive without blocking, the reactor writing the message into data if possible
+   */
+  void post_recv(const string& node_id, char* data, uint64_t length, const string& id, std::function<void(ssize_t)> done);
+  /**
+   * send the same message to every node of node_ids.
+   * the message is framed once, the connections share the frame instead of copying it
+   */
+  ssize_t broadcast(const vector<string>& node_ids, const char* data, uint64_t length, const string& id);
+  /**
+   * receive message id from the first k of node_ids to deliver it.
+   * a claiming waiter is posted on each connection, the caller waits once for all k
+   */
+  ssize_t recv_first_k(const vector<string>& node_ids, char* data, uint64_t length, const string& id, int k, int* which);
+  /**
+   * send a message the caller framed, see TCPChannel::AcquireSendBuffer
+   */
+  ssize_t send_frame(const string& node_id, const shared_ptr<simple_buffer>& frame, uint64_t length, const string& id);
+  /**
+   * batched send of messages, grouped by node id
+   */
+  void sendv(map<string, vector<msg_desc>>& msgs);
+  /**
+   * batched receive of messages, grouped by node id.
+   * posts the receives to every connection first and returns once all of them are filled
+   */
+  void recvv(map<string, vector<msg_desc>>& msgs);
+  /**
+   * set storage aside for the next message of id from node_id, see Connection::expect
+   */
+  int expect(const string& node_id, const string& id, uint64_t length, char* data);
+  /**
+   * drop what has been received for id from node_id, its receivers return E_CANCELED.
+   * returns the bytes dropped
+   */
+  ssize_t cancel(const string& node_id, const string& id);
+  /**
+   * cancel the ids starting with prefix on every connection, and if drop_later their messages arriving later.
+   * returns the bytes dropped
+   */
+  ssize_t purge(const string& prefix, bool drop_later = true);
+  /**
+   * hand the messages from node_id, or from every node if node_id is empty, with an id
+   * starting with prefix to handler, see Connection::on_message
+   */
+  int on_message(const string& node_id, const string& prefix, message_handler handler);
+  /**
+   * cork or uncork the messages of this task, on every connection. the other tasks
+   * sharing a connection are not held, see Connection::uncork
+   */
+  void set_corked(bool corked);
+  /**
+   * write what is queued on every connection
+   */
+  void flush();
+  /**
+   * statistics of the connection with node_id
+   */
+  NetStat get_stat(const string& node_id);
+  /**
+   * time the messages of a priority class spent in the send queue of the connection with node_id
+   */
+  TimingStat get_queue_delay(const string& node_id, int priority);
+
+ protected:
+  /**
+   * the connection with a peer. in lazy mode (CONNECT_PARAMS.LAZY_CONNECT) it is set up here
+   * on first use if connect, nullptr if it can not be or if node_id is not a peer
+   */
+  Connection* connection(const string& node_id, bool connect = true);
+  Connection* connection(int peer, bool connect = true);
+  bool connect_peer(int peer);
+  /**
+   * in lazy mode, a message for a peer which connects to this node but has not yet is held
+   * back, and sent by a thread waiting for the peer, instead of blocking the caller until the
+   * peer uses this node too. true if held back, frame being the message or nullptr to copy data
+   */
+  bool defer(int peer, const shared_ptr<simple_buffer>& frame, const string& id, const char* data, uint64_t length, int priority);
+  shared_ptr<TCPClient> new_client(int server_index);
+  //! the connection of a client connected to server sid
+  shared_ptr<Connection> client_connection(const string& sid, TCPClient* client);
+  //! the connection of client cid, once it has connected to this node, waiting at most timeout ms
+  shared_ptr<Connection> accepted_connection(const string& cid, int64_t timeout);
+  //! put the connection with node_id into connection_map, with the settings of the other connections
+  void add_connection(const string& node_id, const shared_ptr<Connection>& conn);
+  //! the connections set up so far, with connection_map_mtx_
+  vector<Connection*> connected();
 
  protected:
   int parties_ = -1;
@@ -113,7 +227,46 @@ class BasicIO {
   map<string, shared_ptr<Connection>> connection_map;
   error_callback handler = nullptr;
   std::mutex clients_mtx_;
-  shared_ptr<ChannelConfig> channel_config_ = nullptr;
+  shared_ptr<ChannelConfig> channel_config_ = nullptr; // required, init fails without
+  map<string, int> priorities_; // message id --> priority class
+  std::mutex priorities_mtx_;
+
+  //! the entries of connection_map by peer handle, built by init
+  vector<shared_ptr<Connection>*> peers_;
+  map<string, int> peer_handles_;
+  //! lazy mode, by peer handle. connection_map has the entry of the peer once ready
+  struct lazy_peer {
+    string node_id;
+    int server_index = -1; // into server_infos_ if this node connects to the peer
+    std::atomic<bool> ready{false};
+    std::mutex mtx; // one thread sets the connection up
+    //! the messages held back by defer, sent once the connection is ready
+    struct deferred_frame {
+      shared_ptr<simple_buffer> frame;
+      uint64_t length;
+      int priority;
+    };
+    vector<deferred_frame> deferred;
+    std::mutex deferred_mtx;
+    std::thread connector; // waits for the peer for the deferred messages
+    bool connecting = false; // the connector runs, with deferred_mtx
+  };
+  vector<unique_ptr<lazy_peer>> lazy_peers_;
+  //! guards the entries of connection_map set after init, and the settings they get then
+  std::mutex connection_map_mtx_;
+  std::atomic<bool> corked_{false}; // read by the sends without locking
+  map<string, message_handler> handlers_; // by id prefix, of on_message for every node
+  vector<string> purged_prefixes_; // of purge with drop_later
+  //! registered message ids by handle. the arrays never grow, so that the handle paths
+  //! read them without locking. written under priorities_mtx_
+  static const int max_message_handles_ = 4096;
+  unique_ptr<string[]> handle_ids_ = nullptr;
+  unique_ptr<std::atomic<int>[]> handle_priorities_ = nullptr;
+  map<string, int> message_handles_;
+  std::atomic<int> message_handle_count_{0};
+  //! the slots of the registered message ids by peer, then by message handle. guarded by
+  //! the mapbuffer_mtx_ of the peer's connection, see Connection::slot_of
+  vector<vector<shared_ptr<id_slot>>> handle_slots_;
 };
 
 /**
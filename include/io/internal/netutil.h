@@ -17,6 +17,9 @@
 // ==============================================================================
 #pragma once
 
+#include <string>
+#include <vector>
+
 namespace netutil {
 //! From dev-spdb, only support the following switch.
 
@@ -25,4 +28,28 @@ namespace netutil {
  */
 void enable_ssl_socket(bool _enable);
 bool is_enable_ssl_socket();
+
+/**
+ * Placement of the IO threads (reactor, send and receive threads).
+ */
+struct IOThreadAffinity {
+  std::vector<int> cpus; // cpus the IO threads may run on, empty means not pinned
+  bool numa_local = false; // keep the threads of one connection on a single NUMA node
+  bool thread_names = true; // name the IO threads, visible in top -H, perf, gdb
+};
+void set_io_thread_affinity(const IOThreadAffinity& affinity);
+IOThreadAffinity get_io_thread_affinity();
+
+/**
+ * Parses a cpu list like "0-3,8,10-11", the format of taskset -c and /sys cpulist files.
+ */
+bool parse_cpu_list(const std::string& str, std::vector<int>& cpus);
+
+/**
+ * Applies the IO thread affinity to the calling thread and names it `name`.
+ * 
+ * With numa_local, threads passing the same `group` (e.g. the peer node id) are
+ * pinned to the same NUMA node. An empty group uses all the configured cpus.
+ */
+void place_io_thread(const std::string& name, const std::string& group = "");
 } // namespace netutil
@@ -57,12 +57,16 @@ class TCPServer : public Socket {
   void setsid(const string& sid) { sid_ = sid; }
   void set_expected_cids(const vector<string>& expected_cids) { expected_cids_ = expected_cids; }
   void setwtimo(int64_t wait_timeout) { wait_timeout_ = wait_timeout; }
-  bool put_connection(const string& node_id);
+  /**
+   * wait at most timeout ms (forever if < 0) until client cid has connected, and take its
+   * connection for this task. false on timeout or if the server stops
+   */
+  bool wait_connection(const string& cid, int64_t timeout = -1);
   shared_ptr<Connection> get_connection(const string& node_id);
   static uint64_t get_unrecv_size();
 
  protected:
-  shared_ptr<Connection> find_connection(const string& cid);
+  bool all_connected();
 
  protected:
   bool init();
@@ -80,6 +84,7 @@ class TCPServer : public Socket {
   std::thread loop_thread_;
   static int epollfd_;
   static int listenfd_;
+  static int wakefd_; // eventfd written to get the reactor out of epoll_wait at once
   static bool is_inited_;
   static std::mutex init_mutex_;
   static int listen_count_;
@@ -94,6 +99,10 @@ class TCPServer : public Socket {
   static int task_count_;
   static std::mutex task_mtx_;
   static std::condition_variable task_cv_;
+  //! notified by handle_accept once a client is in connections_, with connections_mtx_
+  static std::condition_variable accept_cv_;
+  //! handle_accept ran during the last loop_once
+  bool accepted_ = false;
   char* main_buffer_ = nullptr;
   static int port_;
   int stop_ = 0;
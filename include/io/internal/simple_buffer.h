@@ -32,18 +32,45 @@ namespace io {
 class simple_buffer {
  public:
   simple_buffer(const string& id, const char* data, uint64_t length, const string& node_id) {
-    len_ = sizeof(uint64_t) + sizeof(uint8_t) + id.size() + length;
-    uint8_t id_len = sizeof(uint8_t) + id.size();
+    len_ = header_len(id) + length;
     buf_ = new char[len_];
-    memset(buf_, 0, len_);
-    memcpy(buf_, (const char*)&len_, sizeof(uint64_t));
-    memcpy(buf_ + sizeof(uint64_t), (const char*)&id_len, sizeof(uint8_t));
-    memcpy(buf_ + sizeof(uint64_t) + sizeof(uint8_t), (const char*)id.data(), id.size());
-    memcpy(buf_ + sizeof(uint64_t) + sizeof(uint8_t) + id.size(), data, length);
+    uint64_t hlen = pack_header(buf_, id, length);
+    payload_ = buf_ + hlen;
+    memcpy(payload_, data, length);
     string hex_string = get_hex_buffer(buf_, len_);
     log_audit << "all send data to " << node_id << ": " << hex_string;
   }
 
+  /**
+   * Reserve a message of length bytes real data, to be written at payload() by the caller
+   */
+  simple_buffer(const string& id, uint64_t length) {
+    len_ = header_len(id) + length;
+    buf_ = new char[len_];
+    payload_ = buf_ + pack_header(buf_, id, length);
+  }
+
+  /**
+   * The size of the total len and msg_id in front of the real data
+   */
+  static uint64_t header_len(const string& id) {
+    return sizeof(uint64_t) + sizeof(uint8_t) + id.size();
+  }
+
+  /**
+   * Write the total len and msg_id of a message with length bytes real data into header,
+   * which must have header_len(id) bytes. Returns the header size.
+   */
+  static uint64_t pack_header(char* header, const string& id, uint64_t length) {
+    uint64_t hlen = header_len(id);
+    uint64_t total_len = hlen + length;
+    uint8_t id_len = sizeof(uint8_t) + id.size();
+    memcpy(header, (const char*)&total_len, sizeof(uint64_t));
+    memcpy(header + sizeof(uint64_t), (const char*)&id_len, sizeof(uint8_t));
+    memcpy(header + sizeof(uint64_t) + sizeof(uint8_t), (const char*)id.data(), id.size());
+    return hlen;
+  }
+
   ~simple_buffer() {
     delete[] buf_;
   }
@@ -57,13 +84,29 @@ class simple_buffer {
     return buf_;
   }
   
-  uint64_t len() {
+  uint64_t len() const {
     return len_;
   }
 
+  //! the real data, after the header
+  char* payload() {
+    return payload_;
+  }
+
+  //! set by a connection that could not write the frame, e.g. E_UNCONNECTED. 0 otherwise
+  int64_t error() const {
+    return error_;
+  }
+
+  void set_error(int64_t error) {
+    error_ = error;
+  }
+
  private:
+  int64_t error_ = 0;
   uint64_t len_ = 0;
   char* buf_ = nullptr;
+  char* payload_ = nullptr;
 };
 
 } // namespace io
@@ -28,6 +28,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <string>
+#include <atomic>
 #include <sys/types.h>
 
 #include <sys/socket.h>
@@ -46,6 +47,7 @@ namespace io {
 #define E_ERROR -1
 #define E_TIMEOUT -3
 #define E_UNCONNECTED -4
+#define E_CANCELED -5
 #endif
 
 /**
@@ -82,6 +84,18 @@ class Socket {
   bool option_reuseaddr() const { return option_reuseaddr_; }
   bool option_reuseport() const { return option_reuseport_; }
 
+  //! Connection pool
+ public:
+  /**
+   * keep the connections to the peers, and the server listening, once the last task is over,
+   * so that the next tasks of the process take them over instead of connecting again
+   */
+  static void set_keep_connections(bool keep) { keep_connections_ = keep; }
+  static bool keep_connections() { return keep_connections_; }
+
+ protected:
+  static std::atomic<bool> keep_connections_;
+
  protected:
   int set_reuseaddr(int fd, int optval);
   int set_reuseport(int fd, int optval);
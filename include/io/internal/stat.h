@@ -32,6 +32,20 @@ struct NetStat_st {
   std::atomic<uint64_t> bytes_received{0};
   std::atomic<uint64_t> message_sent{0};
   std::atomic<uint64_t> message_received{0};
+  std::atomic<uint64_t> recv_wakeups{0};
+  std::atomic<uint64_t> recv_futile_wakeups{0};
+  std::atomic<uint64_t> inline_sends{0};
+  std::atomic<uint64_t> send_eagain_waits{0};
+  std::atomic<uint64_t> purged_bytes{0};
+  std::atomic<uint64_t> recv_timeouts{0};
+  std::atomic<uint64_t> coalesced_writes{0};
+  std::atomic<uint64_t> coalesced_frames{0};
+  std::atomic<uint64_t> coalesce_delay_us{0};
+  std::atomic<uint64_t> connect_attempts{0};
+  std::atomic<uint64_t> connect_us{0};
+  std::atomic<uint64_t> pool_hits{0};
+  std::atomic<uint64_t> pool_misses{0};
+  std::atomic<uint64_t> attach_us{0};
   void reset();
 };
 
@@ -54,13 +68,56 @@ class NetStat {
   uint64_t bytes_received() { return bytes_received_; }
   uint64_t message_sent() { return message_sent_; }
   uint64_t message_received() { return message_received_; }
+  uint64_t recv_wakeups() { return recv_wakeups_; }
+  uint64_t recv_futile_wakeups() { return recv_futile_wakeups_; }
+  uint64_t inline_sends() { return inline_sends_; }
+  uint64_t send_eagain_waits() { return send_eagain_waits_; }
+  uint64_t purged_bytes() { return purged_bytes_; }
+  uint64_t recv_timeouts() { return recv_timeouts_; }
+  uint64_t coalesced_writes() { return coalesced_writes_; }
+  uint64_t coalesced_frames() { return coalesced_frames_; }
+  uint64_t coalesce_delay_us() { return coalesce_delay_us_; }
+  uint64_t connect_attempts() { return connect_attempts_; }
+  uint64_t connect_us() { return connect_us_; }
+  uint64_t pool_hits() { return pool_hits_; }
+  uint64_t pool_misses() { return pool_misses_; }
+  uint64_t attach_us() { return attach_us_; }
 
  private:
   uint64_t bytes_sent_ = 0;
   uint64_t bytes_received_ = 0;
   uint64_t message_sent_ = 0;
   uint64_t message_received_ = 0;
+  uint64_t recv_wakeups_ = 0; // times a blocked receiver was woken up
+  uint64_t recv_futile_wakeups_ = 0; // wakeups that found nothing to read
+  uint64_t inline_sends_ = 0; // messages written completely by the sending thread
+  uint64_t send_eagain_waits_ = 0; // times a writer slept on a full socket instead of spinning
+  uint64_t purged_bytes_ = 0; // received bytes dropped by a cancel or a purge
+  uint64_t recv_timeouts_ = 0; // receives given up after their timeout
+  uint64_t coalesced_writes_ = 0; // writes of messages held for coalescing
+  uint64_t coalesced_frames_ = 0; // messages written by them
+  uint64_t coalesce_delay_us_ = 0; // time the coalesced writes were held, in total
+  uint64_t connect_attempts_ = 0; // connects tried to set the connection up, 0 on the accepting side
+  uint64_t connect_us_ = 0; // time it took until the connection was usable
+  uint64_t pool_hits_ = 0; // tasks that took the connection over from an earlier or another task
+  uint64_t pool_misses_ = 0; // tasks that set the connection up, one per connection
+  uint64_t attach_us_ = 0; // time the tasks took to attach to the connection, in total
 };
 
+/**
+ * Timing of one kind of event, e.g. a collective operation (Exchange, Gather, ...)
+ * or the time messages of one priority class spend in the send queue
+ */
+struct TimingStat {
+  uint64_t count = 0;
+  uint64_t total_us = 0;
+  uint64_t max_us = 0;
+  uint64_t last_us = 0;
+
+  void add(uint64_t us);
+  std::string fmt_string() const;
+};
+typedef TimingStat CollectiveStat;
+
 } // namespace io
 } // namespace rosetta
@@ -0,0 +1,118 @@
+// ==============================================================================
+// Copyright 2020 The LatticeX Foundation
+// This file is part of the Rosetta library.
+//
+// The Rosetta library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The Rosetta library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the Rosetta library. If not, see <http://www.gnu.org/licenses/>.
+// ==============================================================================
+#pragma once
+
+#include "io/channel.h"
+#include "io/internal/stat.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+namespace rosetta {
+namespace io {
+
+/**
+ * A channel multiplexed over the connections of its parent, see IChannel::Fork.
+ *
+ * Every message id is prefixed with the namespace of the sub-channel, so the sub-channels
+ * of a parent never see each other's messages and do not wait behind each other.
+ * The namespaces start with the bytes 0xff 0xfe and a hash of the task id, so the sub-channels
+ * of the other tasks on the same connections are apart too. The k-th Fork of n sub-channels
+ * gets the same namespaces on every node, so the nodes must fork in the same order.
+ * Ids starting with 0xff 0xfe are reserved for them, the parent rejects the ones outside
+ * the namespace of its task.
+ *
+ * A sub-channel must not outlive its parent. Destroying it drops what was received
+ * for its namespace and not read.
+ */
+class SubChannel : public IChannel {
+ public:
+  typedef std::function<void(const string& prefix)> Releaser;
+
+  /**
+   * @param prefix the namespace, a message id prefix encoded as message ids are
+   * @param release called with prefix on destruction
+   */
+  SubChannel(IChannel* parent, const string& prefix, Releaser release);
+  virtual ~SubChannel();
+
+  /**
+   * the namespace of the sub-channels of a task, the parent prefix of its top level Fork
+   */
+  static string task_prefix(const string& task_id);
+  /**
+   * the namespace of the j-th sub-channel of the k-th Fork
+   */
+  static string make_prefix(const string& parent_prefix, uint32_t k, uint32_t j);
+
+ public:
+  virtual void SetErrorCallback(error_callback error_cb) {}
+  virtual int64_t Recv(const char* node_id, const char* id, char* data, uint64_t length, int64_t timeout = -1);
+  virtual int64_t Send(const char* node_id, const char* id, const char* data, uint64_t length, int64_t timeout = -1);
+  virtual int ResolvePeer(const char* node_id) { return parent_->ResolvePeer(node_id); }
+  virtual int RegisterMessageId(const char* id) { return parent_->RegisterMessageId(with_prefix(id).c_str()); }
+  virtual int64_t Recv(int peer, int msg, char* data, uint64_t length, int64_t timeout = -1);
+  virtual int64_t Send(int peer, int msg, const char* data, uint64_t length);
+  virtual int64_t SendWithPriority(const char* node_id, const char* id, const char* data, uint64_t length, int priority);
+  virtual void SetMessagePriority(const char* id, int priority);
+  virtual int64_t RecvMessage(const char* node_id, const char* id, string& data, int64_t timeout = -1);
+  virtual int64_t Probe(const char* node_id, const char* id, int64_t timeout = -1);
+  virtual int Expect(const char* node_id, const char* id, uint64_t length, char* data = nullptr);
+  virtual int64_t Cancel(const char* node_id, const char* id);
+  virtual int64_t PurgeTask(const char* task_id);
+  virtual int OnMessage(const char* node_id, const char* id_prefix, MessageHandler handler);
+  virtual IORequestPtr RecvAsync(const char* node_id, const char* id, char* data, uint64_t length, IORequest::Callback callback = nullptr);
+  virtual vector<IORequestPtr> PostRecvs(MessageDesc* msgs, int count, IORequest::Callback callback = nullptr);
+  virtual IORequestPtr SendAsync(const char* node_id, const char* id, const char* data, uint64_t length, IORequest::Callback callback = nullptr);
+  virtual int64_t Broadcast(const NodeIDVec* node_ids, const char* id, const char* data, uint64_t length);
+  virtual int64_t RecvFirstK(const NodeIDVec* node_ids, const char* id, char* data, uint64_t length, int k, int* which);
+  virtual SendSpan AcquireSendBuffer(const char* node_id, const char* id, uint64_t length);
+  virtual int64_t CommitSend(SendSpan& span);
+  virtual int64_t SendV(MessageDesc* msgs, int count);
+  virtual int64_t RecvV(MessageDesc* msgs, int count);
+  virtual vector<shared_ptr<IChannel>> Fork(int n);
+  virtual void Flush() { parent_->Flush(); }
+  virtual void SetCorked(bool corked) { parent_->SetCorked(corked); }
+  virtual const NodeIDVec* GetDataNodeIDs() { return parent_->GetDataNodeIDs(); }
+  virtual const NodeIDMap* GetComputationNodeIDs() { return parent_->GetComputationNodeIDs(); }
+  virtual const NodeIDVec* GetResultNodeIDs() { return parent_->GetResultNodeIDs(); }
+  virtual const char* GetCurrentNodeID() { return parent_->GetCurrentNodeID(); }
+  virtual const NodeIDVec* GetConnectedNodeIDs() { return parent_->GetConnectedNodeIDs(); }
+
+  /**
+   * @brief network statistics of this sub-channel alone, all nodes together
+   */
+  NetStat GetNetStat() { return NetStat(*stat_); }
+
+ private:
+  string with_prefix(const char* id) const { return prefix_ + id; }
+
+ private:
+  IChannel* parent_ = nullptr;
+  string prefix_;
+  Releaser release_ = nullptr;
+  shared_ptr<NetStat_st> stat_; // shared with the callbacks of pending asynchronous operations
+  std::atomic<uint32_t> forks_{0};
+};
+
+} // namespace io
+} // namespace rosetta
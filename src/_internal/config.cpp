@@ -33,6 +33,7 @@ using namespace rapidjson;
 #include <vector>
 using namespace std;
 
+#include <sched.h>
 #include <unistd.h>
 
 namespace rosetta {
@@ -321,12 +322,93 @@ bool ChannelConfig::parse_connect_params(Document& doc) {
         connect_retries_ = retries;
       }
     }
+
+    // "IO_CPUS": "0-3,8" or [0, 1, 2, 3, 8]
+    if (connect_param.HasMember("IO_CPUS")) {
+      Value& io_cpus = connect_param["IO_CPUS"];
+      vector<int> cpus;
+      if (io_cpus.IsString()) {
+        if (!netutil::parse_cpu_list(io_cpus.GetString(), cpus)) {
+          log_error << "invalid IO_CPUS:" << io_cpus.GetString();
+          return false;
+        }
+      } else if (io_cpus.IsArray()) {
+        for (int i = 0; i < io_cpus.Size(); i++) {
+          if (!io_cpus[i].IsInt() || io_cpus[i].GetInt() < 0 || io_cpus[i].GetInt() >= CPU_SETSIZE) {
+            log_error << "invalid IO_CPUS item:" << i;
+            return false;
+          }
+          cpus.push_back(io_cpus[i].GetInt());
+        }
+        std::sort(cpus.begin(), cpus.end());
+        cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+      }
+      io_affinity_.cpus = cpus;
+    }
+
+    if (connect_param.HasMember("IO_NUMA_LOCAL") && connect_param["IO_NUMA_LOCAL"].IsBool()) {
+      io_affinity_.numa_local = connect_param["IO_NUMA_LOCAL"].GetBool();
+    }
+
+    if (connect_param.HasMember("IO_THREAD_NAMES") && connect_param["IO_THREAD_NAMES"].IsBool()) {
+      io_affinity_.thread_names = connect_param["IO_THREAD_NAMES"].GetBool();
+    }
+
+    // hold the messages sent in quick succession for up to COALESCE_US microseconds
+    if (connect_param.HasMember("COALESCE_US") && connect_param["COALESCE_US"].IsInt()) {
+      int coalesce_us = connect_param["COALESCE_US"].GetInt();
+      if (coalesce_us >= 0) {
+        coalesce_us_ = coalesce_us;
+      }
+    }
+
+    if (connect_param.HasMember("COALESCE_BYTES") && connect_param["COALESCE_BYTES"].IsInt()) {
+      int coalesce_bytes = connect_param["COALESCE_BYTES"].GetInt();
+      if (coalesce_bytes > 0) {
+        coalesce_bytes_ = coalesce_bytes;
+      }
+    }
+
+    // keep the connections open once the last task is over, for the next tasks to take over
+    if (connect_param.HasMember("KEEP_CONNECTIONS") && connect_param["KEEP_CONNECTIONS"].IsBool()) {
+      keep_connections_ = connect_param["KEEP_CONNECTIONS"].GetBool();
+    }
+
+    // connect to the peers on their first use, but the nodes of PREWARM_NODES to each other
+    if (connect_param.HasMember("LAZY_CONNECT") && connect_param["LAZY_CONNECT"].IsBool()) {
+      lazy_connect_ = connect_param["LAZY_CONNECT"].GetBool();
+    }
+
+    if (connect_param.HasMember("PREWARM_NODES") && connect_param["PREWARM_NODES"].IsArray()) {
+      Value& nodes = connect_param["PREWARM_NODES"];
+      for (int i = 0; i < nodes.Size(); i++) {
+        if (!nodes[i].IsString()) {
+          log_error << "invalid PREWARM_NODES item:" << i;
+          return false;
+        }
+        prewarm_nodes_.push_back(nodes[i].GetString());
+      }
+    }
   }
   log_debug << "connect timeout:" << connect_timeout_ << "ms, connect retries:" << connect_retries_;
+  log_debug << "io cpus:" << io_affinity_.cpus.size() << ", io numa local:" << io_affinity_.numa_local
+            << ", io thread names:" << io_affinity_.thread_names;
+  log_debug << "coalesce:" << coalesce_us_ << "us, " << coalesce_bytes_ << " bytes";
+  log_debug << "keep connections:" << keep_connections_ << ", lazy connect:" << lazy_connect_
+            << ", prewarm nodes:" << prewarm_nodes_.size();
 
   return true;
 }
 
+bool ChannelConfig::is_eager(const string& node_id, const string& peer) const {
+  if (!lazy_connect_) {
+    return true;
+  }
+  // both ends must agree, so both of them have to be prewarmed
+  return std::find(prewarm_nodes_.begin(), prewarm_nodes_.end(), node_id) != prewarm_nodes_.end()
+    && std::find(prewarm_nodes_.begin(), prewarm_nodes_.end(), peer) != prewarm_nodes_.end();
+}
+
 void ChannelConfig::process_node_type() {
   pure_data_nodes_ = data_nodes_;
   pure_result_nodes_ = result_nodes_;
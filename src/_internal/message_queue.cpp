@@ -0,0 +1,75 @@
+// ==============================================================================
+// Copyright 2020 The LatticeX Foundation
+// This file is part of the Rosetta library.
+//
+// The Rosetta library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The Rosetta library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the Rosetta library. If not, see <http://www.gnu.org/licenses/>.
+// ==============================================================================
+#include "io/internal/message_queue.h"
+
+#include <string.h>
+
+namespace rosetta {
+namespace io {
+
+void message_queue::push(string&& message) {
+  size_ += message.size();
+  messages_.push_back(entry());
+  messages_.back().length = message.size();
+  messages_.back().bytes = std::move(message);
+}
+
+void message_queue::push_placed(char* data, uint64_t length) {
+  size_ += length;
+  messages_.push_back(entry());
+  messages_.back().placed = data;
+  messages_.back().length = length;
+}
+
+int64_t message_queue::read(char* data, uint64_t length) {
+  uint64_t n = 0;
+  while (n < length && !messages_.empty()) {
+    const entry& head = messages_.front();
+    uint64_t len = head.length - offset_;
+    if (len > length - n) {
+      len = length - n;
+    }
+    if (head.data() + offset_ != data + n) {
+      // a placed message may be read, shifted, into the buffer it was placed in
+      memmove(data + n, head.data() + offset_, len);
+    }
+    n += len;
+    offset_ += len;
+    if (offset_ == head.length) {
+      messages_.pop_front();
+      offset_ = 0;
+    }
+  }
+  size_ -= n;
+  return n;
+}
+
+string message_queue::take() {
+  entry& head = messages_.front();
+  string message = head.placed != nullptr ? string(head.placed, head.length) : std::move(head.bytes);
+  messages_.pop_front();
+  if (offset_ > 0) {
+    message.erase(0, offset_);
+    offset_ = 0;
+  }
+  size_ -= message.size();
+  return message;
+}
+
+} // namespace io
+} // namespace rosetta
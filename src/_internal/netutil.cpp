@@ -16,9 +16,149 @@
 // along with the Rosetta library. If not, see <http://www.gnu.org/licenses/>.
 // ==============================================================================
 #include "io/internal/netutil.h"
+#include "io/internal/logger.h"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
 
 namespace netutil {
 bool enable_ssl_socket_ = false;
 void enable_ssl_socket(bool _enable) { enable_ssl_socket_ = _enable; }
 bool is_enable_ssl_socket(){return enable_ssl_socket_;}
+
+static std::mutex io_affinity_mtx_;
+static IOThreadAffinity io_affinity_;
+
+void set_io_thread_affinity(const IOThreadAffinity& affinity) {
+  std::unique_lock<std::mutex> lck(io_affinity_mtx_);
+  io_affinity_ = affinity;
+}
+
+IOThreadAffinity get_io_thread_affinity() {
+  std::unique_lock<std::mutex> lck(io_affinity_mtx_);
+  return io_affinity_;
+}
+
+bool parse_cpu_list(const std::string& str, std::vector<int>& cpus) {
+  std::vector<int> result;
+  size_t pos = 0;
+  while (pos < str.size()) {
+    size_t end = str.find(',', pos);
+    if (end == std::string::npos) {
+      end = str.size();
+    }
+    std::string range = str.substr(pos, end - pos);
+    pos = end + 1;
+    range.erase(std::remove_if(range.begin(), range.end(), ::isspace), range.end());
+    if (range.empty()) {
+      continue;
+    }
+    const char* begin = range.c_str();
+    char* end_ptr = nullptr;
+    long first = strtol(begin, &end_ptr, 10);
+    long last = first;
+    if (end_ptr == begin) {
+      return false;
+    }
+    if (*end_ptr == '-') {
+      begin = end_ptr + 1;
+      last = strtol(begin, &end_ptr, 10);
+      if (end_ptr == begin) {
+        return false;
+      }
+    }
+    if (*end_ptr != '\0') {
+      return false;
+    }
+    if (first < 0 || last < first || last >= CPU_SETSIZE) {
+      return false;
+    }
+    for (int cpu = (int)first; cpu <= (int)last; cpu++) {
+      result.push_back(cpu);
+    }
+  }
+  std::sort(result.begin(), result.end());
+  result.erase(std::unique(result.begin(), result.end()), result.end());
+  cpus.swap(result);
+  return true;
+}
+
+// cpus of each NUMA node, empty if the system does not expose them
+static std::vector<std::vector<int>> numa_node_cpus() {
+  std::vector<std::vector<int>> nodes;
+  DIR* dir = opendir("/sys/devices/system/node");
+  if (dir == nullptr) {
+    return nodes;
+  }
+  std::vector<int> node_ids;
+  struct dirent* entry = nullptr;
+  while ((entry = readdir(dir)) != nullptr) {
+    int node = -1;
+    char tail = 0;
+    if (sscanf(entry->d_name, "node%d%c", &node, &tail) == 1) {
+      node_ids.push_back(node);
+    }
+  }
+  closedir(dir);
+  std::sort(node_ids.begin(), node_ids.end());
+
+  for (int node : node_ids) {
+    std::ifstream ifs("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string line;
+    std::vector<int> cpus;
+    if (std::getline(ifs, line) && parse_cpu_list(line, cpus) && !cpus.empty()) {
+      nodes.push_back(cpus);
+    }
+  }
+  return nodes;
+}
+
+void place_io_thread(const std::string& name, const std::string& group) {
+  IOThreadAffinity affinity = get_io_thread_affinity();
+  if (affinity.thread_names) {
+    // the kernel limits thread names to 15 characters
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+  }
+
+  std::vector<int> cpus = affinity.cpus;
+  if (affinity.numa_local && !group.empty()) {
+    std::vector<std::vector<int>> candidates;
+    for (auto& node : numa_node_cpus()) {
+      std::vector<int> usable;
+      if (cpus.empty()) {
+        usable = node;
+      } else {
+        std::set_intersection(
+          node.begin(), node.end(), cpus.begin(), cpus.end(), std::back_inserter(usable));
+      }
+      if (!usable.empty()) {
+        candidates.push_back(usable);
+      }
+    }
+    if (!candidates.empty()) {
+      cpus = candidates[std::hash<std::string>()(group) % candidates.size()];
+    }
+  }
+  if (cpus.empty()) {
+    return;
+  }
+
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  for (int cpu : cpus) {
+    CPU_SET(cpu, &cpuset);
+  }
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+  if (ret != 0) {
+    log_warn << "pin io thread " << name << " failed, " << strerror(ret);
+  }
+}
 } // namespace netutil
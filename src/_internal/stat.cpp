@@ -28,6 +28,20 @@ void NetStat_st::reset() {
   bytes_received.store(0);
   message_sent.store(0);
   message_received.store(0);
+  recv_wakeups.store(0);
+  recv_futile_wakeups.store(0);
+  inline_sends.store(0);
+  send_eagain_waits.store(0);
+  purged_bytes.store(0);
+  recv_timeouts.store(0);
+  coalesced_writes.store(0);
+  coalesced_frames.store(0);
+  coalesce_delay_us.store(0);
+  connect_attempts.store(0);
+  connect_us.store(0);
+  pool_hits.store(0);
+  pool_misses.store(0);
+  attach_us.store(0);
 }
 
 NetStat::NetStat(const NetStat_st& ns_st) {
@@ -35,6 +49,20 @@ NetStat::NetStat(const NetStat_st& ns_st) {
   bytes_received_ = ns_st.bytes_received.load();
   message_sent_ = ns_st.message_sent.load();
   message_received_ = ns_st.message_received.load();
+  recv_wakeups_ = ns_st.recv_wakeups.load();
+  recv_futile_wakeups_ = ns_st.recv_futile_wakeups.load();
+  inline_sends_ = ns_st.inline_sends.load();
+  send_eagain_waits_ = ns_st.send_eagain_waits.load();
+  purged_bytes_ = ns_st.purged_bytes.load();
+  recv_timeouts_ = ns_st.recv_timeouts.load();
+  coalesced_writes_ = ns_st.coalesced_writes.load();
+  coalesced_frames_ = ns_st.coalesced_frames.load();
+  coalesce_delay_us_ = ns_st.coalesce_delay_us.load();
+  connect_attempts_ = ns_st.connect_attempts.load();
+  connect_us_ = ns_st.connect_us.load();
+  pool_hits_ = ns_st.pool_hits.load();
+  pool_misses_ = ns_st.pool_misses.load();
+  attach_us_ = ns_st.attach_us.load();
 }
 
 NetStat operator-(const NetStat& ns1, const NetStat& ns2) {
@@ -44,6 +72,20 @@ NetStat operator-(const NetStat& ns1, const NetStat& ns2) {
     ns.bytes_received_   = ns1.bytes_received_    - ns2.bytes_received_;
     ns.message_sent_     = ns1.message_sent_      - ns2.message_sent_;
     ns.message_received_ = ns1.message_received_  - ns2.message_received_;
+    ns.recv_wakeups_     = ns1.recv_wakeups_      - ns2.recv_wakeups_;
+    ns.recv_futile_wakeups_ = ns1.recv_futile_wakeups_ - ns2.recv_futile_wakeups_;
+    ns.inline_sends_     = ns1.inline_sends_      - ns2.inline_sends_;
+    ns.send_eagain_waits_ = ns1.send_eagain_waits_ - ns2.send_eagain_waits_;
+    ns.purged_bytes_ = ns1.purged_bytes_ - ns2.purged_bytes_;
+    ns.recv_timeouts_ = ns1.recv_timeouts_ - ns2.recv_timeouts_;
+    ns.coalesced_writes_ = ns1.coalesced_writes_ - ns2.coalesced_writes_;
+    ns.coalesced_frames_ = ns1.coalesced_frames_ - ns2.coalesced_frames_;
+    ns.coalesce_delay_us_ = ns1.coalesce_delay_us_ - ns2.coalesce_delay_us_;
+    ns.connect_attempts_ = ns1.connect_attempts_ - ns2.connect_attempts_;
+    ns.connect_us_ = ns1.connect_us_ - ns2.connect_us_;
+    ns.pool_hits_ = ns1.pool_hits_ - ns2.pool_hits_;
+    ns.pool_misses_ = ns1.pool_misses_ - ns2.pool_misses_;
+    ns.attach_us_ = ns1.attach_us_ - ns2.attach_us_;
   // clang-format on
   return ns;
 }
@@ -55,6 +97,20 @@ NetStat operator+(const NetStat& ns1, const NetStat& ns2) {
     ns.bytes_received_   = ns1.bytes_received_    + ns2.bytes_received_;
     ns.message_sent_     = ns1.message_sent_      + ns2.message_sent_;
     ns.message_received_ = ns1.message_received_  + ns2.message_received_;
+    ns.recv_wakeups_     = ns1.recv_wakeups_      + ns2.recv_wakeups_;
+    ns.recv_futile_wakeups_ = ns1.recv_futile_wakeups_ + ns2.recv_futile_wakeups_;
+    ns.inline_sends_     = ns1.inline_sends_      + ns2.inline_sends_;
+    ns.send_eagain_waits_ = ns1.send_eagain_waits_ + ns2.send_eagain_waits_;
+    ns.purged_bytes_ = ns1.purged_bytes_ + ns2.purged_bytes_;
+    ns.recv_timeouts_ = ns1.recv_timeouts_ + ns2.recv_timeouts_;
+    ns.coalesced_writes_ = ns1.coalesced_writes_ + ns2.coalesced_writes_;
+    ns.coalesced_frames_ = ns1.coalesced_frames_ + ns2.coalesced_frames_;
+    ns.coalesce_delay_us_ = ns1.coalesce_delay_us_ + ns2.coalesce_delay_us_;
+    ns.connect_attempts_ = ns1.connect_attempts_ + ns2.connect_attempts_;
+    ns.connect_us_ = ns1.connect_us_ + ns2.connect_us_;
+    ns.pool_hits_ = ns1.pool_hits_ + ns2.pool_hits_;
+    ns.pool_misses_ = ns1.pool_misses_ + ns2.pool_misses_;
+    ns.attach_us_ = ns1.attach_us_ + ns2.attach_us_;
   // clang-format on
   return ns;
 }
@@ -70,10 +126,42 @@ std::string NetStat::fmt_string() const {
   sss << " bytes recv:" << std::setw(15) << bytes_received_;
   sss << " msges sent:" << std::setw(06) << message_sent_;
   sss << " msges recv:" << std::setw(06) << message_received_;
+  sss << " recv wakeups:" << std::setw(06) << recv_wakeups_;
+  sss << " futile wakeups:" << std::setw(06) << recv_futile_wakeups_;
+  sss << " inline sends:" << std::setw(06) << inline_sends_;
+  sss << " eagain waits:" << std::setw(06) << send_eagain_waits_;
+  sss << " purged:" << std::setw(10) << purged_bytes_;
+  sss << " timeouts:" << std::setw(06) << recv_timeouts_;
+  sss << " coalesced writes:" << std::setw(06) << coalesced_writes_;
+  sss << " frames:" << std::setw(06) << coalesced_frames_;
+  sss << " delay us:" << std::setw(10) << coalesce_delay_us_;
+  sss << " connect attempts:" << std::setw(03) << connect_attempts_;
+  sss << " connect us:" << std::setw(10) << connect_us_;
+  sss << " pool hits:" << std::setw(6) << pool_hits_;
+  sss << " misses:" << std::setw(6) << pool_misses_;
+  sss << " attach us:" << std::setw(10) << attach_us_;
   return sss.str();
 }
 
 void NetStat::print(std::string str) const { std::cout << str << fmt_string() << std::endl; }
 
+void TimingStat::add(uint64_t us) {
+  count++;
+  total_us += us;
+  last_us = us;
+  if (us > max_us) {
+    max_us = us;
+  }
+}
+
+std::string TimingStat::fmt_string() const {
+  std::stringstream sss;
+  sss << " count:" << std::setw(06) << count;
+  sss << " avg us:" << std::setw(10) << (count > 0 ? total_us / count : 0);
+  sss << " max us:" << std::setw(10) << max_us;
+  sss << " last us:" << std::setw(10) << last_us;
+  return sss.str();
+}
+
 } // namespace io
 } // namespace rosetta
\ No newline at end of file
@@ -21,7 +21,9 @@
 #include "io/internal/net_io.h"
 #include "io/internal/io_channel_impl.h"
 #include "string.h"
+#include <list>
 #include <mutex>
+#include <unordered_map>
 #include "io/channel_encode.h"
 
 #if USE_EMP_IO
@@ -41,6 +43,7 @@ std::mutex g_result_node_mutex;
 std::mutex g_connected_node_mutex;
 
 static map<IChannel*, string> g_channel2task;
+static unordered_map<string, IChannel*> g_task2channel;
 static set<string> g_creating_task;
 static std::mutex g_channel2task_mtx;
 static std::condition_variable g_channel2task_cv;
@@ -55,11 +58,10 @@ static IChannel* CreateChannel(const string& task_id, const rosetta::io::NodeInf
       }
       return false;
     });
-    for (auto iter = g_channel2task.begin(); iter != g_channel2task.end(); iter++) {
-      if (iter->second == task_id) {
-        log_warn << "the channel with task id " << task_id << " has already been created";
-        return iter->first;
-      }
+    auto iter = g_task2channel.find(task_id);
+    if (iter != g_task2channel.end()) {
+      log_warn << "the channel with task id " << task_id << " has already been created";
+      return iter->second;
     }
     g_creating_task.insert(task_id);
   }
@@ -120,6 +122,7 @@ static IChannel* CreateChannel(const string& task_id, const rosetta::io::NodeInf
     {
       std::unique_lock<std::mutex> lck(g_channel2task_mtx);
       g_channel2task.insert(std::pair<IChannel*, string>(tcp_channel, task_id));
+      g_task2channel[task_id] = tcp_channel;
       auto iter = g_creating_task.find(task_id);
       g_creating_task.erase(iter);
       g_channel2task_cv.notify_all();
@@ -210,6 +213,7 @@ void DestroyInternalChannel(IChannel* channel) {
     }
     task_id = iter->second;
     g_channel2task.erase(iter);
+    g_task2channel.erase(task_id);
   }
   log_debug << "begin destroy channel with task id " << task_id;
   DestroyCurrentNode(channel);
@@ -221,8 +225,52 @@ void DestroyInternalChannel(IChannel* channel) {
   log_debug << "end destroy channel with task id " << task_id;
 }
 
-IChannel* CreateInternalChannel(const char* task_id, const char* node_id, const char* config_str, error_callback error_cb) {
+// the parsed configs by node id and config, most recently used first. the tasks of a process
+// share one config or a few, so 16 keep them all parsed while bounding what a process cycling
+// through many configs holds; the least recently used goes first
+static const size_t g_max_configs = 16;
+typedef pair<string, shared_ptr<rosetta::io::ChannelConfig>> config_entry;
+static list<config_entry> g_configs;
+static unordered_map<string, list<config_entry>::iterator> g_config_index;
+static std::mutex g_configs_mtx;
+
+//! the cached config of key, moved to the front, or nullptr. must hold g_configs_mtx
+static shared_ptr<rosetta::io::ChannelConfig> UseChannelConfig(const string& key) {
+  auto iter = g_config_index.find(key);
+  if (iter == g_config_index.end()) {
+    return nullptr;
+  }
+  g_configs.splice(g_configs.begin(), g_configs, iter->second);
+  return iter->second->second;
+}
+
+static shared_ptr<rosetta::io::ChannelConfig> GetChannelConfig(const char* node_id, const char* config_str) {
+  string key = string(node_id) + '\n' + config_str;
+  {
+    std::unique_lock<std::mutex> lck(g_configs_mtx);
+    shared_ptr<rosetta::io::ChannelConfig> config = UseChannelConfig(key);
+    if (config != nullptr) {
+      return config;
+    }
+  }
   shared_ptr<rosetta::io::ChannelConfig> config = make_shared<rosetta::io::ChannelConfig>(node_id, config_str);
+  std::unique_lock<std::mutex> lck(g_configs_mtx);
+  // another task may have parsed it meanwhile
+  shared_ptr<rosetta::io::ChannelConfig> cached = UseChannelConfig(key);
+  if (cached != nullptr) {
+    return cached;
+  }
+  g_configs.push_front(config_entry(key, config));
+  g_config_index[key] = g_configs.begin();
+  if (g_configs.size() > g_max_configs) {
+    g_config_index.erase(g_configs.back().first);
+    g_configs.pop_back();
+  }
+  return config;
+}
+
+IChannel* CreateInternalChannel(const char* task_id, const char* node_id, const char* config_str, error_callback error_cb) {
+  shared_ptr<rosetta::io::ChannelConfig> config = GetChannelConfig(node_id, config_str);
   rosetta::io::NodeInfo node_info;
   vector<rosetta::io::NodeInfo> clientInfos;
   vector<rosetta::io::NodeInfo> serverInfos;
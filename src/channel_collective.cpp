@@ -0,0 +1,97 @@
+// ==============================================================================
+// Copyright 2020 The LatticeX Foundation
+// This file is part of the Rosetta library.
+//
+// The Rosetta library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The Rosetta library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the Rosetta library. If not, see <http://www.gnu.org/licenses/>.
+// ==============================================================================
+#include "io/channel.h"
+
+#include <string.h>
+#include <vector>
+using namespace std;
+
+/**
+ * Default collectives, on top of SendV/RecvV: every send is issued, then every receive is
+ * posted at once, so a round costs the slowest peer rather than the sum of all peers.
+ */
+int64_t IChannel::Exchange(const NodeIDVec* node_ids, const char* id, const char* send_data, char* recv_data, uint64_t length) {
+  const char* self = GetCurrentNodeID();
+  vector<MessageDesc> sends;
+  vector<MessageDesc> recvs;
+  for (int i = 0; i < node_ids->node_count; i++) {
+    const char* node_id = node_ids->node_ids[i];
+    if (strcmp(node_id, self) == 0) {
+      memcpy(recv_data + i * length, send_data + i * length, length);
+      continue;
+    }
+    sends.push_back({node_id, id, (char*)send_data + i * length, length, -1});
+    recvs.push_back({node_id, id, recv_data + i * length, length, -1});
+  }
+  int64_t ret = 0;
+  if (!sends.empty() && SendV(sends.data(), sends.size()) < 0) {
+    ret = -1;
+  }
+  if (!recvs.empty() && RecvV(recvs.data(), recvs.size()) < 0) {
+    ret = -1;
+  }
+  return ret;
+}
+
+int64_t IChannel::Gather(const char* root, const NodeIDVec* node_ids, const char* id, const char* send_data, char* recv_data, uint64_t length) {
+  const char* self = GetCurrentNodeID();
+  if (strcmp(root, self) != 0) {
+    return Send(root, id, send_data, length) < 0 ? -1 : 0;
+  }
+
+  vector<MessageDesc> recvs;
+  for (int i = 0; i < node_ids->node_count; i++) {
+    const char* node_id = node_ids->node_ids[i];
+    if (strcmp(node_id, self) == 0) {
+      memcpy(recv_data + i * length, send_data, length);
+      continue;
+    }
+    recvs.push_back({node_id, id, recv_data + i * length, length, -1});
+  }
+  if (!recvs.empty() && RecvV(recvs.data(), recvs.size()) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+int64_t IChannel::Scatter(const char* root, const NodeIDVec* node_ids, const char* id, const char* send_data, char* recv_data, uint64_t length) {
+  const char* self = GetCurrentNodeID();
+  if (strcmp(root, self) != 0) {
+    return Recv(root, id, recv_data, length) < 0 ? -1 : 0;
+  }
+
+  vector<MessageDesc> sends;
+  for (int i = 0; i < node_ids->node_count; i++) {
+    const char* node_id = node_ids->node_ids[i];
+    if (strcmp(node_id, self) == 0) {
+      memcpy(recv_data, send_data + i * length, length);
+      continue;
+    }
+    sends.push_back({node_id, id, (char*)send_data + i * length, length, -1});
+  }
+  if (!sends.empty() && SendV(sends.data(), sends.size()) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+int64_t IChannel::Barrier(const NodeIDVec* node_ids, const char* id) {
+  vector<char> send_data(node_ids->node_count, 1);
+  vector<char> recv_data(node_ids->node_count, 0);
+  return Exchange(node_ids, id, send_data.data(), recv_data.data(), 1);
+}
@@ -16,7 +16,10 @@
 // along with the Rosetta library. If not, see <http://www.gnu.org/licenses/>.
 // ==============================================================================
 #include "io/internal/client.h"
+#include <sys/epoll.h>
+#include <algorithm>
 #include <chrono>
+#include <random>
 #include <thread>
 using namespace std::chrono;
 #define NEVER_TIMEOUT 1000 * 1000000
@@ -32,207 +35,317 @@ std::mutex TCPClient::task_mtx_;
 std::condition_variable TCPClient::task_cv_;
 
 bool TCPClient::connect(int64_t timeout, int64_t conn_retries) {
+  vector<TCPClient*> clients(1, this);
+  return connect_all(clients, timeout, conn_retries);
+}
+
+/**
+ * Resolve the server and take over the connection to it if another task has it already.
+ * Returns 1 if there is nothing more to do, 0 if a connection must be set up, -1 on error.
+ */
+int TCPClient::prepare_connect() {
   if (!init_ssl())
-    return false;
+    return -1;
 
   ip_ = Socket::gethostip(host_);
   if (ip_ == "") {
     log_error << "Can not get right IP by " << host_ ;
-    return false;
+    return -1;
   }
 
   log_debug << "client[" << cid_ << "] is ready to connect to server[" << ip_ << ":" << port_ << "]";
-  string node_address = ip_ + ":" + std::to_string(port_);
-  {
-    std::unique_lock<std::mutex> lck(task_mtx_);
-    if (task_count_ == 0) {
-      is_first_client_ = true;
-    }
-    task_count_++;
+  node_address_ = ip_ + ":" + std::to_string(port_);
+  std::unique_lock<std::mutex> lck(task_mtx_);
+  if (task_count_ == 0) {
+    is_first_client_ = true;
+  }
+  task_count_++;
 
-    auto iter = connections_.find(node_address);
-    if (iter != connections_.end()) {
-      if (iter->second->is_reuseable()) {
-        log_debug << "find connection " << node_address;
-        conn_ = iter->second;
-        conn_->start(task_id_);
-        connected_ = true;
-        return true;
-      } else {
-        recycle_connections_.push_back(iter->second);
-        connections_.erase(iter);
-      }
+  auto iter = connections_.find(node_address_);
+  if (iter != connections_.end()) {
+    // a pooled connection may have been closed by the server meanwhile
+    if (iter->second->is_reuseable() && iter->second->is_alive()) {
+      log_debug << "find connection " << node_address_;
+      conn_ = iter->second;
+      conn_->start(task_id_);
+      connected_ = true;
+      return 1;
+    } else {
+      recycle_connections_.push_back(iter->second);
+      connections_.erase(iter);
     }
-    auto iter2 = to_connect_set_.find(node_address);
-    if (iter2 != to_connect_set_.end()) {
-      task_cv_.wait(lck, [&](){
-        auto iter3 = connections_.find(node_address);
-        if (iter3 != connections_.end()) {
-          return true;
-        }
-        return false;
-      });
-      iter = connections_.find(node_address);
-      if (iter != connections_.end()) {
-        log_debug << "find connection " << node_address;
-        conn_ = iter->second;
-        conn_->start(task_id_);
-        connected_ = true;
+  }
+  auto iter2 = to_connect_set_.find(node_address_);
+  if (iter2 != to_connect_set_.end()) {
+    // until the other task is connected, or has given up
+    task_cv_.wait(lck, [&](){
+      auto iter3 = connections_.find(node_address_);
+      if (iter3 != connections_.end()) {
         return true;
       }
+      return to_connect_set_.find(node_address_) == to_connect_set_.end();
+    });
+    iter = connections_.find(node_address_);
+    if (iter != connections_.end()) {
+      log_debug << "find connection " << node_address_;
+      conn_ = iter->second;
+      conn_->start(task_id_);
+      connected_ = true;
+      return 1;
     }
-    to_connect_set_.insert(node_address);
   }
+  to_connect_set_.insert(node_address_);
+  return 0;
+}
 
-  ///////////////////////////////////////////
-  //! @todo retries 3 times default
-  if (conn_retries <= 0)
-    conn_retries = 1;
-  for (int k = 0; k < conn_retries; k++) {
-    struct sockaddr_in server;
+/**
+ * Start a non-blocking connect. Returns 1 if connected at once, 0 if in progress, -1 on failure.
+ */
+int TCPClient::start_connect() {
+  fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0) {
+    log_warn << "client create socket failed" ;
+    return -1;
+  }
+  struct sockaddr_in server;
+  memset(&server, 0, sizeof(server));
+  server.sin_family = AF_INET;
+  server.sin_addr.s_addr = inet_addr(ip_.c_str());
+  server.sin_port = htons(port_);
 
-    fd_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd_ < 0) {
-      log_warn << "client create socket failed" ;
-      continue;
-    }
+  set_sendbuf(fd_, default_buffer_size());
+  set_recvbuf(fd_, default_buffer_size());
+  set_nodelay(fd_, 1);
+  set_linger(fd_);
+  set_nonblocking(fd_, true);
 
-    memset(&server, 0, sizeof(server));
-    server.sin_family = AF_INET;
-    server.sin_addr.s_addr = inet_addr(ip_.c_str());
-    server.sin_port = htons(port_);
+  timing_.attempts++;
+  if (::connect(fd_, (struct sockaddr*)&server, sizeof(server)) == 0) {
+    return 1;
+  }
+  return errno == EINPROGRESS ? 0 : -1;
+}
 
-    int err = -1;
+/**
+ * The server acked the connection: send our id and set the connection up.
+ */
+bool TCPClient::finish_connect() {
+  string tmpcid;
+  uint64_t cid_len = sizeof(uint64_t) + cid_.size();
+  log_audit << "send node id:" << cid_ << " len:" << cid_len;
+  tmpcid.resize(cid_len);
+  memcpy(&tmpcid[0], &cid_len, sizeof(uint64_t));
+  memcpy((char*)&tmpcid[0] + sizeof(uint64_t), cid_.data(), cid_.size());
+  // a few bytes on a fresh socket, they fit in its buffer
+  ssize_t ret = ::write(fd_, (const char*)&tmpcid[0], cid_len);
+  if (ret != cid_len) {
+    log_error << "client send cid error. ret:" << ret << ", errno:" << errno << " , strerror:" << strerror(errno);
+    return false;
+  }
+
+  if (is_ssl_socket_)
+    conn_ = std::make_shared<SSLConnection>(fd_, 0, false, node_id_);
+  else
+    conn_ = std::make_shared<Connection>(fd_, 0, false, node_id_);
+  conn_->ctx_ = ctx_;
+  if (!conn_->handshake()) {
+    conn_ = nullptr;
+    return false;
+  }
+
+  connected_ = true;
+  {
+    std::unique_lock<std::mutex> lck(task_mtx_);
+    connections_.insert(std::pair<string, shared_ptr<Connection>>(node_address_, conn_));
+    auto iter = to_connect_set_.find(node_address_);
+    if (iter != to_connect_set_.end()) {
+      to_connect_set_.erase(iter);
+    }
+    task_cv_.notify_all();
+  }
+  is_first_connect_ = true;
+  conn_->start(task_id_);
+  log_debug << "client create connection ok " << node_address_;
+  return true;
+}
 
-    set_sendbuf(fd_, default_buffer_size());
-    set_recvbuf(fd_, default_buffer_size());
-    set_nodelay(fd_, 1);
-    set_linger(fd_);
+void TCPClient::give_up_connect() {
+  std::unique_lock<std::mutex> lck(task_mtx_);
+  to_connect_set_.erase(node_address_);
+  task_cv_.notify_all();
+}
 
-    if (timeout < 0)
-      timeout = NEVER_TIMEOUT; // 100w s
+namespace {
+//! delay before the next attempt after `failures` failed ones, doubling from 2ms up to 50ms.
+//! the jitter keeps the parties that start together from retrying in lockstep
+int64_t connect_backoff_us(int failures) {
+  static std::mutex mtx;
+  static std::mt19937 gen(std::random_device{}());
+  int64_t base = std::min<int64_t>(2000LL << std::min(failures - 1, 16), 50000);
+  std::unique_lock<std::mutex> lck(mtx);
+  return std::uniform_int_distribution<int64_t>(base / 2, base)(gen);
+}
+} // namespace
 
-    //! in vm, connect api is not in blocking, even under blocking mode!!!
-    int64_t elapsed = 0;
-    auto beg = system_clock::now();
-    bool connected = false;
-    while ((timeout < 0) || (elapsed <= timeout)) {
-      if (timeout > 0) {
-        int64_t tout = timeout - elapsed;
-        set_send_timeout(fd_, tout);
-        set_recv_timeout(fd_, tout);
-      } else {
-        break;
-      }
+/**
+ * Connect the clients together, all the sockets driven by one epoll. A refused or broken
+ * attempt is retried after a backoff, as long as conn_retries times timeout ms, the time
+ * the tries used to take at most. A server that accepts but then fails the ack or the
+ * handshake counts against conn_retries.
+ */
+bool TCPClient::connect_all(const vector<TCPClient*>& clients, int64_t timeout, int64_t conn_retries) {
+  enum Phase { Idle, Connecting, Acking, Done, Failed };
+  struct attempt {
+    Phase phase = Idle;
+    int failures = 0; // in a row, for the backoff
+    int rejects = 0; // after the server accepted
+    steady_clock::time_point retry_at;
+  };
+  if (conn_retries <= 0)
+    conn_retries = 1;
+  if (timeout < 0)
+    timeout = NEVER_TIMEOUT; // 100w s
+  int64_t deadline_us = timeout * conn_retries * 1000;
 
-      err = ::connect(fd_, (struct sockaddr*)&server, sizeof(server));
-      if (err == 0) {
-        log_debug << "client connect to server ok " << node_address;
-        connected = true;
-        break;
-      }
-      // #define	EISCONN		106	/* Transport endpoint is already connected */
-      if (errno == EISCONN) {
-        log_error << "already connected:" << errno << " " << strerror(errno);
-        connected = true;
-        break;
-      }
+  int efd = epoll_create1(EPOLL_CLOEXEC);
+  if (efd < 0) {
+    log_error << "epoll_create1 failed. errno:" << errno << " " << strerror(errno);
+    return false;
+  }
+  auto beg = steady_clock::now();
+  auto since = [&beg](steady_clock::time_point t) { return duration_cast<microseconds>(t - beg).count(); };
+  vector<attempt> attempts(clients.size());
+  int pending = 0;
+  for (int i = 0; i < clients.size(); i++) {
+    int ret = clients[i]->prepare_connect();
+    attempts[i].phase = ret == 0 ? Idle : ret > 0 ? Done : Failed;
+    attempts[i].retry_at = beg;
+    pending += ret == 0 ? 1 : 0;
+  }
 
-      // #define	ECONNREFUSED	111	/* Connection refused */
-      if (errno == ECONNREFUSED) {
-        //! continue;
-      }
-      std::this_thread::sleep_for(chrono::milliseconds(500));
-      auto end = system_clock::now();
-      elapsed = duration_cast<duration<int64_t, std::milli>>(end - beg).count();
+  auto watch = [&](int i, int op, uint32_t events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.u32 = i;
+    epoll_ctl(efd, op, clients[i]->fd_, &ev);
+  };
+  auto retry = [&](int i, bool rejected) {
+    TCPClient* client = clients[i];
+    ::close(client->fd_); // leaves the epoll too
+    client->fd_ = -1;
+    attempt& a = attempts[i];
+    a.failures++;
+    a.rejects += rejected ? 1 : 0;
+    if (a.rejects >= conn_retries) {
+      log_error << "client[" << client->cid_ << "] connect to server[" << client->ip_ << ":" << client->port_
+                << "] failed, retries:" << a.rejects;
+      a.phase = Failed;
+      pending--;
+      client->give_up_connect();
+      return;
     }
+    int64_t delay = connect_backoff_us(a.failures);
+    log_debug << "client[" << client->cid_ << "] will retry connect to server[" << client->ip_ << ":"
+              << client->port_ << "] in " << delay << "us, attempts:" << client->timing_.attempts;
+    a.phase = Idle;
+    a.retry_at = steady_clock::now() + microseconds(delay);
+  };
+  auto acked = [&](int i) {
+    TCPClient* client = clients[i];
+    epoll_ctl(efd, EPOLL_CTL_DEL, client->fd_, nullptr);
+    client->timing_.acked_us = since(steady_clock::now());
+    if (!client->finish_connect()) {
+      retry(i, true);
+      return;
+    }
+    client->timing_.ready_us = since(steady_clock::now());
+    attempts[i].phase = Done;
+    pending--;
+  };
 
-    if (!connected) {
-      if (elapsed > timeout) {
-        log_warn << "client[" << cid_ << "] connect to server[" << ip_ << ":" << port_
-                 << "] timeout." ;
-        ::close(fd_);
+  const int kMaxEvents = 16;
+  struct epoll_event events[kMaxEvents];
+  while (pending > 0) {
+    auto now = steady_clock::now();
+    int64_t wait_us = -1;
+    for (int i = 0; i < clients.size(); i++) {
+      attempt& a = attempts[i];
+      if (a.phase == Done || a.phase == Failed) {
         continue;
       }
-      log_error << "client[" << cid_ << "] connect to server[" << ip_ << ":" << port_ << "] failed."
-                ;
-      ::close(fd_);
-      continue;
-    }
-
-    // recv ack
-    auto beg_read = system_clock::now();
-    char connect_ack;
-    ssize_t ret = ::read(fd_, (char*)&connect_ack, sizeof(char));
-    if (ret != sizeof(char)) {
-      if (ret != 0) {
-        log_error << "client recv ack error. ret:" << ret << ", errno:" << errno << ", strerror:" <<  strerror(errno);
+      if (since(now) > deadline_us) {
+        log_warn << "client[" << clients[i]->cid_ << "] connect to server[" << clients[i]->ip_ << ":"
+                 << clients[i]->port_ << "] timeout." ;
+        if (clients[i]->fd_ >= 0) {
+          ::close(clients[i]->fd_);
+          clients[i]->fd_ = -1;
+        }
+        a.phase = Failed;
+        pending--;
+        clients[i]->give_up_connect();
+        continue;
       }
-      ::close(fd_);
-
-      auto end_read = system_clock::now();
-      auto read_elapsed = duration_cast<duration<int64_t, std::milli>>(end_read - beg_read).count();
-      auto sleep_time = k < conn_retries - 1 ? timeout - read_elapsed : 0;
-      log_error << "read ack from " << node_id_ << " failed, sleep " << (sleep_time > 0 ? sleep_time : 0) << "ms, retries:" << (k + 1);
-      if (sleep_time > 0) {
-        std::this_thread::sleep_for(chrono::milliseconds(sleep_time));
+      if (a.phase == Idle && a.retry_at <= now) {
+        int ret = clients[i]->start_connect();
+        if (ret > 0) {
+          watch(i, EPOLL_CTL_ADD, EPOLLIN);
+          clients[i]->timing_.connected_us = since(steady_clock::now());
+          a.phase = Acking;
+        } else if (ret == 0) {
+          watch(i, EPOLL_CTL_ADD, EPOLLOUT);
+          a.phase = Connecting;
+        } else {
+          retry(i, false);
+        }
+      }
+      if (a.phase == Idle) {
+        int64_t us = duration_cast<microseconds>(a.retry_at - now).count();
+        wait_us = wait_us < 0 ? us : std::min(wait_us, us);
       }
-      continue;
     }
-
-    string tmpcid;
-    uint64_t cid_len = sizeof(uint64_t) + cid_.size();
-    log_audit << "send node id:" << cid_ << " len:" << cid_len;
-    tmpcid.resize(cid_len);
-    memcpy(&tmpcid[0], &cid_len, sizeof(uint64_t));
-    memcpy((char*)&tmpcid[0] + sizeof(uint64_t), cid_.data(), cid_.size());
-    ret = ::write(fd_, (const char*)&tmpcid[0], cid_len);
-    if (ret != cid_len) {
-      log_error << "client send cid error. ret:" << ret << ", errno:" << errno << " , strerror:" << strerror(errno);
-      ::close(fd_);
-      continue;
+    if (pending == 0) {
+      break;
     }
-
-    set_send_timeout(fd_, NEVER_TIMEOUT);
-    set_recv_timeout(fd_, NEVER_TIMEOUT);
-
-    if (is_ssl_socket_)
-      conn_ = std::make_shared<SSLConnection>(fd_, 0, false, node_id_);
-    else
-      conn_ = std::make_shared<Connection>(fd_, 0, false, node_id_);
-    conn_->ctx_ = ctx_;
-    connected_ = true;
-
-    set_nonblocking(fd_, true);
-    if (conn_->handshake()) {
-      {
-        std::unique_lock<std::mutex> lck(task_mtx_);
-        connections_.insert(std::pair<string, shared_ptr<Connection>>(node_address, conn_));
-        auto iter = to_connect_set_.find(node_address);
-        if (iter != to_connect_set_.end()) {
-          to_connect_set_.erase(iter);
+    // wake up for the next retry, and at least once a second for the deadline
+    int waitms = wait_us < 0 ? 1000 : (int)std::min<int64_t>((wait_us + 999) / 1000, 1000);
+    int nfds = epoll_wait(efd, events, kMaxEvents, waitms);
+    for (int k = 0; k < nfds; k++) {
+      int i = events[k].data.u32;
+      TCPClient* client = clients[i];
+      if (attempts[i].phase == Connecting) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(client->fd_, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+          log_debug << "client[" << client->cid_ << "] connect to " << client->node_address_ << " failed: " << strerror(err);
+          retry(i, false);
+          continue;
+        }
+        client->timing_.connected_us = since(steady_clock::now());
+        attempts[i].phase = Acking;
+        watch(i, EPOLL_CTL_MOD, EPOLLIN);
+      } else if (attempts[i].phase == Acking) {
+        char connect_ack;
+        ssize_t ret = ::read(client->fd_, &connect_ack, sizeof(char));
+        if (ret == sizeof(char)) {
+          acked(i);
+        } else if (ret == 0 || (errno != EAGAIN && errno != EINTR)) {
+          // e.g. a server not listening any more, or not expecting us yet
+          log_warn << "read ack from " << client->node_id_ << " failed. ret:" << ret << ", errno:" << errno
+                   << ", retries:" << attempts[i].rejects + 1;
+          retry(i, true);
         }
-        task_cv_.notify_all();
       }
-      is_first_connect_ = true;
-      conn_->start(task_id_);
-      log_debug << "client create connection ok " << node_address;
-      return true;
     }
+  }
+  ::close(efd);
 
-    int64_t interval = 1000;
-    if (timeout > elapsed) {
-      interval += timeout - elapsed;
-    }
-    if (interval > 5000) {
-      interval = 5000;
-    }
-    log_warn << "client[" << cid_ << "] will retry connect to server[" << ip_ << ":" << port_
-             << "]. retries:" << k << ", at " << interval << "(ms) later." ;
-    std::this_thread::sleep_for(chrono::milliseconds(interval));
+  bool ok = true;
+  for (int i = 0; i < clients.size(); i++) {
+    ok = ok && attempts[i].phase == Done;
   }
-  ///////////////////////////////////////////
-  return false;
+  return ok;
 }
 
 uint64_t TCPClient::get_unrecv_size() {
@@ -259,7 +372,7 @@ void TCPClient::close() {
       // uses this connection. P2 will keep the connection as T2 still use the connection.
       // thirdly, P1 start task T2 and create a new connection C2 to P2 as there is no connection available.
       // now the problem comes in.P1 send/recv data on connection C2 while P2 send/recv data on connection C1.
-      if (task_count_ == 0 && get_unrecv_size() == 0) {
+      if (task_count_ == 0 && get_unrecv_size() == 0 && !keep_connections_) {
         for (auto iter = connections_.begin(); iter != connections_.end(); ) {
           iter->second->close(task_id_);
           connections_.erase(iter++);
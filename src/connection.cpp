@@ -17,7 +17,12 @@
 // ==============================================================================
 #include "io/internal/connection.h"
 #include "io/internal/simple_buffer.h"
+#include "io/internal/netutil.h"
 
+#include <sys/uio.h>
+#include <algorithm>
+#include <limits.h>
+#include <poll.h>
 #include <thread>
 #include <chrono>
 using namespace std::chrono;
@@ -25,6 +30,8 @@ using namespace std::chrono;
 namespace rosetta {
 namespace io {
 
+std::atomic<int> Connection::reactors_{0};
+
 Connection::Connection(int _fd, int _events, bool _is_server, const string& node_id) {
   fd_ = _fd;
   events_ = _events;
@@ -34,7 +41,15 @@ Connection::Connection(int _fd, int _events, bool _is_server, const string& node
   send_buffer_ = make_shared<cycle_buffer>(1024 * 1024 * 128);
 }
 
-Connection::~Connection() { }
+Connection::~Connection() {
+  // the frames never written, their senders may be waiting for them to go
+  for (int i = 0; i < shared_frames_.size(); i++) {
+    shared_frames_[i].frame->set_error(E_UNCONNECTED);
+  }
+  for (int i = 0; i < urgent_frames_.size(); i++) {
+    urgent_frames_[i].frame->set_error(E_UNCONNECTED);
+  }
+}
 
 void Connection::close(const string& task_id) {
   if (state_ != Connection::State::Closed) {
@@ -42,6 +57,7 @@ void Connection::close(const string& task_id) {
     flush_send_buffer();
     ::close(fd_);
     state_ = Connection::State::Closed;
+    fail_waiters();
     log_debug << task_id << " close connection ok " << node_id_ << " send buffer size:" << send_buffer_->size();
   }
 }
@@ -58,18 +74,228 @@ ssize_t Connection::send(const char* data, size_t len, int64_t timeout) {
   return n;
 }
 
-ssize_t Connection::put_into_send_buffer(const char* data, size_t len, int64_t timeout) {
+ssize_t Connection::put_into_send_buffer(const char* data, size_t len, int64_t timeout, bool corked) {
   std::unique_lock<std::mutex> lck(send_buffer_mtx_);
+  release_ = release_ || !corked;
   ssize_t ret = send_buffer_->write(data, len);
-  send_buffer_cv_.notify_all();
+  queued_bytes_ += len;
+  frame_mark mark;
+  mark.end = queued_bytes_;
+  mark.queued_at = chrono::steady_clock::now();
+  frame_marks_.push_back(mark);
+  notify_sender();
   return ret;
 }
 
-ssize_t Connection::send(const string& id, const char* data, uint64_t length, int64_t timeout) {
-  simple_buffer buffer(id, data, length, node_id_);
+ssize_t Connection::send(const string& id, const char* data, uint64_t length, int64_t timeout, int priority, bool corked) {
+  stat_.message_sent++;
+  stat_.bytes_sent += length;
+  if (can_send_inline()) {
+    ssize_t ret = send_inline(id, data, length, priority, corked);
+    if (ret >= 0) {
+      return ret;
+    }
+  }
+
+  if (priority == MSG_PRIORITY_URGENT) {
+    shared_ptr<simple_buffer> frame = make_shared<simple_buffer>(id, data, length, node_id_);
+    std::unique_lock<std::mutex> lck(send_buffer_mtx_);
+    queue_frame(frame, 0, priority, corked);
+    return length;
+  }
 
+  simple_buffer buffer(id, data, length, node_id_);
   //log_debug << node_id_ << " send buffer:" << id << " len:" << buffer.len();
-  return put_into_send_buffer((const char*)buffer.data(), buffer.len(), timeout);
+  // the length of the message, as for the ones written inline, not of the frame queued
+  put_into_send_buffer((const char*)buffer.data(), buffer.len(), timeout, corked);
+  return length;
+}
+
+/**
+ * Write the message directly on the caller thread if nothing is queued before it.
+ * The socket is written without blocking, only the unwritten remainder goes to send_buffer_.
+ * Returns -1 if the message must be queued as a whole.
+ */
+ssize_t Connection::send_inline(const string& id, const char* data, uint64_t length, int priority, bool corked) {
+  char header[sizeof(uint64_t) + sizeof(uint8_t) + 256];
+  uint64_t hlen = simple_buffer::header_len(id);
+  if (hlen > sizeof(header)) {
+    return -1;
+  }
+
+  std::unique_lock<std::mutex> lck(send_buffer_mtx_);
+  if (!can_write_now(priority, corked)) {
+    return -1;
+  }
+  simple_buffer::pack_header(header, id, length);
+  log_audit << "all send data to " << node_id_ << ": " << get_hex_buffer(header, hlen)
+            << get_hex_buffer(data, length);
+
+  struct iovec iov[2];
+  iov[0].iov_base = header;
+  iov[0].iov_len = hlen;
+  iov[1].iov_base = (void*)data;
+  iov[1].iov_len = length;
+  if (write_or_queue(iov, 2, true, priority, corked)) {
+    stat_.inline_sends++;
+  }
+  return length;
+}
+
+/**
+ * Write the buffers with one non-blocking sendmsg if try_write, and append what is left
+ * to send_buffer_. iov holds (header, payload) pairs, one per frame.
+ * Must hold send_buffer_mtx_. Returns true if everything was written.
+ */
+bool Connection::write_or_queue(struct iovec* iov, int iovcnt, bool try_write, int priority, bool corked) {
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    total += iov[i].iov_len;
+  }
+
+  ssize_t n = 0;
+  if (try_write) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    std::unique_lock<mutex> lck(mtx_send_);
+    do {
+      n = ::sendmsg(fd_, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+      // EAGAIN or an error, let loop_send deal with it
+      n = 0;
+    }
+  }
+  if (n == total) {
+    for (int i = 0; i < iovcnt; i += 2) {
+      queue_delay_[priority].add(0);
+    }
+    return true;
+  }
+
+  // queue the remainder, marking where each frame ends
+  release_ = release_ || !corked;
+  frame_mark mark;
+  mark.priority = priority;
+  mark.queued_at = chrono::steady_clock::now();
+  size_t pos = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    size_t begin = pos;
+    pos += iov[i].iov_len;
+    if (pos > n) {
+      size_t skip = n > begin ? n - begin : 0;
+      if (skip > 0 || (i % 2 == 1 && n > begin - iov[i - 1].iov_len)) {
+        partial_head_ = true;
+      }
+      send_buffer_->write((const char*)iov[i].iov_base + skip, iov[i].iov_len - skip);
+      queued_bytes_ += iov[i].iov_len - skip;
+    }
+    if (i % 2 == 1 && pos > n) {
+      mark.end = queued_bytes_;
+      frame_marks_.push_back(mark);
+    }
+  }
+  notify_sender();
+  return false;
+}
+
+/**
+ * Queue a frame by reference, (what is left of) it after offset bytes written inline.
+ * Must hold send_buffer_mtx_.
+ */
+void Connection::queue_frame(const shared_ptr<simple_buffer>& frame, uint64_t offset, int priority, bool corked) {
+  release_ = release_ || !corked;
+  shared_frame queued;
+  queued.mark = queued_bytes_;
+  queued.frame = frame;
+  queued.offset = offset;
+  queued.priority = priority;
+  queued.queued_at = chrono::steady_clock::now();
+  frame_bytes_ += frame->len() - offset;
+  if (offset > 0) {
+    // the rest must follow on the wire before anything else
+    partial_head_ = true;
+    shared_frames_.push_back(queued);
+  } else if (priority == MSG_PRIORITY_URGENT) {
+    urgent_frames_.push_back(queued);
+  } else {
+    shared_frames_.push_back(queued);
+  }
+  notify_sender();
+}
+
+/**
+ * Send a message already framed, e.g. once for several connections. The frame is written inline
+ * if nothing is queued, otherwise (what is left of) it is queued by reference, without copying.
+ */
+ssize_t Connection::send_frame(const shared_ptr<simple_buffer>& frame, uint64_t length, int priority, bool corked) {
+  if (state_ == State::Closing || state_ == State::Closed) {
+    return E_UNCONNECTED;
+  }
+  stat_.message_sent++;
+  stat_.bytes_sent += length;
+
+  std::unique_lock<std::mutex> lck(send_buffer_mtx_);
+  log_audit << "all send data to " << node_id_ << ": " << get_hex_buffer(frame->data(), frame->len());
+  ssize_t n = 0;
+  if (can_send_inline() && can_write_now(priority, corked)) {
+    std::unique_lock<mutex> lck2(mtx_send_);
+    do {
+      n = ::send(fd_, frame->data(), frame->len(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+      n = 0;
+    }
+  }
+  if (n == frame->len()) {
+    stat_.inline_sends++;
+    queue_delay_[priority].add(0);
+    return length;
+  }
+
+  queue_frame(frame, n, priority, corked);
+  return length;
+}
+
+/**
+ * Send a batch of messages under one send_buffer_ lock, with one write or one wakeup of loop_send.
+ */
+ssize_t Connection::sendv(vector<msg_desc>& msgs, bool corked) {
+  if (msgs.empty()) {
+    return 0;
+  }
+  size_t hlen = 0;
+  for (int i = 0; i < msgs.size(); i++) {
+    hlen += simple_buffer::header_len(msgs[i].id);
+  }
+  string headers(hlen, '\0');
+  vector<struct iovec> iov(msgs.size() * 2);
+  ssize_t total = 0;
+  hlen = 0;
+  for (int i = 0; i < msgs.size(); i++) {
+    iov[2 * i].iov_base = &headers[hlen];
+    iov[2 * i].iov_len = simple_buffer::pack_header(&headers[hlen], msgs[i].id, msgs[i].length);
+    iov[2 * i + 1].iov_base = msgs[i].data;
+    iov[2 * i + 1].iov_len = msgs[i].length;
+    hlen += iov[2 * i].iov_len;
+    msgs[i].result = msgs[i].length;
+    total += msgs[i].length;
+    stat_.message_sent++;
+    stat_.bytes_sent += msgs[i].length;
+  }
+
+  std::unique_lock<std::mutex> lck(send_buffer_mtx_);
+  for (int i = 0; i < msgs.size(); i++) {
+    log_audit << "all send data to " << node_id_ << ": " << get_hex_buffer(iov[2 * i].iov_base, iov[2 * i].iov_len)
+              << get_hex_buffer(msgs[i].data, msgs[i].length);
+  }
+  bool try_write = can_send_inline() && can_write_now(MSG_PRIORITY_BULK, corked) && iov.size() <= IOV_MAX;
+  if (write_or_queue(iov.data(), iov.size(), try_write, MSG_PRIORITY_BULK, corked)) {
+    stat_.inline_sends += msgs.size();
+  }
+  return total;
 }
 
 uint64_t Connection::get_unrecv_size() {
@@ -77,18 +303,181 @@ uint64_t Connection::get_unrecv_size() {
   {
     unique_lock<mutex> lck(mapbuffer_mtx_);
     for (auto iter = mapbuffer_.begin(); iter != mapbuffer_.end(); iter++) {
-      ret += iter->second->size();
+      ret += iter->second->messages.size();
     }
   }
   return ret;
 }
 
+static bool header_complete(const char* head, uint64_t size) {
+  return size > sizeof(uint64_t) && size >= sizeof(uint64_t) + *(uint8_t*)(head + sizeof(uint64_t));
+}
+
+/**
+ * Parse the frames as their bytes come in. The small ones go into buffer_ in runs, a large
+ * or expected one is copied once into storage of its exact size, known from its header,
+ * so that buffer_ never grows to hold it.
+ */
+void Connection::write(const char* data, size_t len) {
+  size_t pos = 0;
+  size_t run = 0; // start of the bytes going into buffer_
+  while (pos < len) {
+    if (receiving_) {
+      uint64_t n = std::min((uint64_t)(len - pos), incoming_.length - incoming_.filled);
+      std::unique_lock<std::mutex> lck(incoming_mtx_);
+      char* dest = incoming_.data != nullptr ? incoming_.data : &incoming_.payload[0];
+      memcpy(dest + incoming_.filled, data + pos, n);
+      incoming_.filled += n;
+      pos += n;
+      run = pos;
+      if (incoming_.filled == incoming_.length) {
+        std::unique_lock<std::mutex> lck2(buffer_mtx_);
+        incoming_frames_.push_back(std::move(incoming_));
+        receiving_ = false;
+      }
+      continue;
+    }
+    if (frame_left_ > 0) {
+      uint64_t n = std::min((uint64_t)(len - pos), frame_left_);
+      frame_left_ -= n;
+      pos += n;
+      continue;
+    }
+
+    // a frame starts at pos, with [uint64 length][uint8 id length + 1][id]
+    const char* head = data + pos;
+    bool gathered = false;
+    if (!recv_head_.empty() || !header_complete(head, len - pos)) {
+      if (pos > run) {
+        buffer_->write(data + run, pos - run);
+        buffered_bytes_ += pos - run;
+      }
+      while (pos < len && !header_complete(recv_head_.data(), recv_head_.size())) {
+        uint64_t need = recv_head_.size() <= sizeof(uint64_t) ? sizeof(uint64_t) + 1
+                          : sizeof(uint64_t) + (uint8_t)recv_head_[sizeof(uint64_t)];
+        uint64_t n = std::min((uint64_t)(len - pos), need - recv_head_.size());
+        recv_head_.append(data + pos, n);
+        pos += n;
+      }
+      run = pos;
+      if (!header_complete(recv_head_.data(), recv_head_.size())) {
+        break;
+      }
+      head = recv_head_.data();
+      gathered = true;
+    }
+    uint64_t frame_len = *(uint64_t*)head;
+    uint8_t len2 = *(uint8_t*)(head + sizeof(uint64_t));
+    uint64_t hlen = sizeof(uint64_t) + len2;
+    frames_parsed_++;
+    if (start_incoming(head + sizeof(uint64_t) + sizeof(uint8_t), len2 - sizeof(uint8_t), frame_len - hlen)) {
+      // what is before the frame goes into buffer_ first, loop_recv hands it out in that order
+      if (pos > run) {
+        buffer_->write(data + run, pos - run);
+        buffered_bytes_ += pos - run;
+      }
+      incoming_.mark = buffered_bytes_;
+      if (!gathered) {
+        pos += hlen;
+      }
+      run = pos;
+      if (incoming_.length == 0) {
+        std::unique_lock<std::mutex> lck(incoming_mtx_);
+        std::unique_lock<std::mutex> lck2(buffer_mtx_);
+        incoming_frames_.push_back(std::move(incoming_));
+        receiving_ = false;
+      }
+    } else if (gathered) {
+      buffer_->write(recv_head_.data(), recv_head_.size());
+      buffered_bytes_ += recv_head_.size();
+      frame_left_ = frame_len - recv_head_.size();
+    } else {
+      frame_left_ = frame_len;
+    }
+    recv_head_.clear();
+  }
+  if (pos > run) {
+    buffer_->write(data + run, pos - run);
+    buffered_bytes_ += pos - run;
+  }
+  log_debug << "recv data from " << node_id_ << " size:" << len;
+  std::unique_lock<std::mutex> lck(buffer_mtx_);
+  buffer_cv_.notify_all();
+}
+
+/**
+ * Receive the frame starting now into its own storage if it is expected or large.
+ */
+bool Connection::start_incoming(const char* id, size_t id_len, uint64_t length) {
+  expected_message expected;
+  shared_ptr<placement> placed;
+  bool found = false;
+  unique_lock<mutex> lck(mapbuffer_mtx_, std::defer_lock);
+  if (expected_count_ > 0) {
+    lck.lock();
+    auto iter = mapbuffer_.find(string(id, id_len));
+    if (iter != mapbuffer_.end() && !iter->second->expected.empty()) {
+      expected = std::move(iter->second->expected.front());
+      iter->second->expected.pop_front();
+      expected_count_--;
+      found = true;
+      if (expected.length != length) {
+        log_warn << "expected " << expected.length << " bytes for a message from " << node_id_ << ", got " << length;
+        // the next ones would be placed out of step, they are copied by the receivers instead
+        expected_count_ -= iter->second->expected.size();
+        iter->second->expected.clear();
+        found = false;
+      } else if (expected.data != nullptr) {
+        placed = make_shared<placement>();
+        iter->second->placed.push_back(placed);
+      }
+    }
+  }
+  if (!found && length < recv_direct_bytes_) {
+    return false;
+  }
+
+  // still under mapbuffer_mtx_ if found, so that a cancel sees the placement here or in the slot
+  unique_lock<mutex> lck2(incoming_mtx_);
+  incoming_ = incoming_frame();
+  incoming_.id.assign(id, id_len);
+  incoming_.length = length;
+  if (found) {
+    incoming_.data = expected.data;
+    incoming_.placed = placed;
+    incoming_.payload = std::move(expected.storage);
+  }
+  if (incoming_.data == nullptr) {
+    incoming_.payload.resize(length);
+  }
+  receiving_ = true;
+  return true;
+}
+
+void Connection::expect(const string& id, uint64_t length, char* data) {
+  expected_message expected;
+  expected.length = length;
+  expected.data = data;
+  if (data == nullptr) {
+    // allocated and touched here rather than on the reactor
+    expected.storage.resize(length);
+  }
+  unique_lock<mutex> lck(mapbuffer_mtx_);
+  get_slot(id)->expected.push_back(std::move(expected));
+  expected_count_++;
+}
+
+//! the head of incoming_frames_ comes next. must hold buffer_mtx_
+bool Connection::incoming_ready() {
+  return !incoming_frames_.empty() && incoming_frames_.front().mark <= unbuffered_bytes_;
+}
+
 void Connection::loop_recv(string task_id) {
   log_debug << task_id << " begin loop recv data from " << node_id_;
+  netutil::place_io_thread("io-recv-" + node_id_, node_id_);
   while (true) {
     
-    string tmp_id;
-    string tmp_data;
+    vector<incoming_frame> messages;
     {
       bool stop_recv = false;
       std::unique_lock<std::mutex> lck(buffer_mtx_);
@@ -99,7 +488,7 @@ void Connection::loop_recv(string task_id) {
           stop_recv = true;
           return true;
         }
-        if (buffer_->can_read()) {
+        if (buffer_->can_read() || incoming_ready()) {
           return true;
         }
         return false;
@@ -107,84 +496,391 @@ void Connection::loop_recv(string task_id) {
       if (stop_recv) {
         break;
       }
-      buffer_->read(tmp_id, tmp_data, node_id_);
+      // take every complete message in wire order, so that the waiters are woken up once per batch
+      while (true) {
+        if (incoming_ready()) {
+          messages.push_back(std::move(incoming_frames_.front()));
+          incoming_frames_.pop_front();
+          continue;
+        }
+        if (!buffer_->can_read()) {
+          break;
+        }
+        messages.push_back(incoming_frame());
+        unbuffered_bytes_ += buffer_->read(messages.back().id, messages.back().payload, node_id_);
+        messages.back().length = messages.back().payload.size();
+      }
     }
 
+    vector<shared_ptr<recv_waiter>> waiters;
+    vector<pair<int, message_handler>> handled;
     {
       std::unique_lock<std::mutex> lck(mapbuffer_mtx_);
-      if (mapbuffer_.find(tmp_id) == mapbuffer_.end()) {
-        mapbuffer_[tmp_id] = make_shared<cycle_buffer>(1024 * 8);
+      frames_dispatched_ += messages.size();
+      for (int i = 0; i < messages.size(); i++) {
+        const string& tmp_id = messages[i].id;
+        if (messages[i].placed != nullptr && !unplace(tmp_id, messages[i].placed)) {
+          stat_.purged_bytes += messages[i].length;
+          continue;
+        }
+        if (!purged_prefixes_.empty() && is_purged(tmp_id)) {
+          stat_.purged_bytes += messages[i].length;
+          continue;
+        }
+        // a message placed into a receiver's buffer belongs to that receiver
+        message_handler* handler = handlers_.empty() || messages[i].data != nullptr ? nullptr : handler_of(tmp_id);
+        if (handler != nullptr) {
+          handled.push_back(make_pair(i, *handler));
+          stat_.message_received++;
+          stat_.bytes_received += messages[i].length;
+          continue;
+        }
+        // write the real data
+        shared_ptr<id_slot> slot = get_slot(tmp_id);
+        if (messages[i].data != nullptr) {
+          slot->messages.push_placed(messages[i].data, messages[i].length);
+        } else {
+          slot->messages.push(std::move(messages[i].payload));
+        }
+        dispatch_waiters(*slot, waiters);
+      }
+      if (!recv_ended_ && frames_dispatched_ >= frames_at_close_) {
+        end_recv_locked(waiters);
       }
-      // write the real data
-      mapbuffer_[tmp_id]->write(tmp_data.data(), tmp_data.size());
-      //log_debug << node_id_ << " write to mapbuffer, id:" << tmp_id << " size:" << tmp_data.size();
-      mapbuffer_cv_.notify_all();
+    }
+    wake_waiters(waiters);
+    // out of the lock, a handler may send or receive other ids
+    for (int i = 0; i < handled.size(); i++) {
+      incoming_frame& message = messages[handled[i].first];
+      handled[i].second(node_id_, message.id, message.payload.data(), message.length);
     }
   }
   log_debug << task_id << " end loop recv data from " << node_id_;
 }
 
 void Connection::flush_send_buffer() {
-  uint64_t remain_size = send_buffer_->size();
-  if (remain_size > 0) {
-    char* buffer = new char[remain_size];
-    send_buffer_->read(buffer, remain_size);
-    ssize_t ret = send(buffer, remain_size);
-    if (ret != remain_size) {
-      log_error << "send data to " << node_id_ << " error, " << errno << ", error msg:" << strerror(errno);
+  while (true) {
+    send_chunk chunk;
+    {
+      std::unique_lock<std::mutex> lck(send_buffer_mtx_);
+      if (send_queue_empty()) {
+        break;
+      }
+      take_send_queue(chunk);
+    }
+    write_send_chunk(chunk);
+  }
+}
+
+bool Connection::send_queue_empty() {
+  return send_buffer_->size() == 0 && shared_frames_.empty() && urgent_frames_.empty();
+}
+
+/**
+ * Called once per message (or batch) sent. Nothing is queued nor being written, the task sending
+ * is not corked and the message is not held for coalescing, so it may go on the wire from the
+ * caller thread. Must hold send_buffer_mtx_.
+ */
+bool Connection::can_write_now(int priority, bool corked) {
+  if (corked) {
+    return false;
+  }
+  if (coalesce_us_ > 0 && priority != MSG_PRIORITY_URGENT && coalesce_now()) {
+    return false;
+  }
+  return !sending_ && send_queue_empty() && state_ != State::Closing && state_ != State::Closed;
+}
+
+/**
+ * Track the time between two sends, and hold the messages while they come fast enough
+ * that coalesce_min_frames_ of them are expected within coalesce_us_. A message sent after
+ * a pause goes out at once. Starts a hold if needed, must hold send_buffer_mtx_.
+ */
+bool Connection::coalesce_now() {
+  auto now = chrono::steady_clock::now();
+  double gap = chrono::duration<double, micro>(now - last_send_at_).count();
+  last_send_at_ = now;
+  gap = std::min(gap, 2.0 * coalesce_us_);
+  send_gap_us_ = 0.75 * send_gap_us_ + 0.25 * gap;
+  if (send_gap_us_ * coalesce_min_frames_ >= coalesce_us_) {
+    return false;
+  }
+  if (!holding_) {
+    // loop_send may be sleeping without a deadline
+    holding_ = true;
+    hold_since_ = now;
+    send_buffer_cv_.notify_all();
+  }
+  return true;
+}
+
+/**
+ * loop_send has something to write: the queue is not empty, has grown past cork_limit_ if only
+ * corked tasks queued into it, and past coalesce_bytes_ or held for coalesce_us_ if coalescing.
+ * Must hold send_buffer_mtx_.
+ */
+bool Connection::send_queue_ready() {
+  if (sending_ || send_queue_empty()) {
+    return false;
+  }
+  uint64_t queued = send_buffer_->size() + frame_bytes_;
+  if (!release_) {
+    return queued >= cork_limit_;
+  }
+  if (holding_ && urgent_frames_.empty() && queued < coalesce_bytes_) {
+    return chrono::steady_clock::now() >= hold_since_ + chrono::microseconds(coalesce_us_);
+  }
+  return true;
+}
+
+//! wake loop_send up only if it has something to write. must hold send_buffer_mtx_
+void Connection::notify_sender() {
+  if (send_queue_ready()) {
+    send_buffer_cv_.notify_all();
+  }
+}
+
+void Connection::set_coalescing(const string& task_id, uint64_t max_delay_us, uint64_t max_bytes) {
+  std::unique_lock<std::mutex> lck(task_mtx_);
+  std::unique_lock<std::mutex> lck2(send_buffer_mtx_);
+  if (!coalescing_task_.empty() && coalescing_task_ != task_id) {
+    if (max_delay_us != coalesce_us_ || max_bytes != coalesce_bytes_) {
+      log_warn << task_id << " keeps the coalescing of " << coalescing_task_ << " to " << node_id_
+               << ", " << coalesce_us_ << " us and " << coalesce_bytes_ << " B instead of "
+               << max_delay_us << " us and " << max_bytes << " B";
+    }
+    return;
+  }
+  coalescing_task_ = task_id;
+  coalesce_us_ = max_delay_us;
+  coalesce_bytes_ = max_bytes;
+  send_gap_us_ = 2.0 * coalesce_us_;
+  send_buffer_cv_.notify_all();
+}
+
+void Connection::uncork() {
+  std::unique_lock<std::mutex> lck(send_buffer_mtx_);
+  if (!send_queue_empty()) {
+    release_ = true;
+    notify_sender();
+  }
+}
+
+/**
+ * Write everything queued now, from the caller thread, after what loop_send is writing.
+ */
+void Connection::flush() {
+  while (true) {
+    send_chunk chunk;
+    {
+      std::unique_lock<std::mutex> lck(send_buffer_mtx_);
+      send_buffer_cv_.wait(lck, [&]() { return !sending_; });
+      if (send_queue_empty()) {
+        break;
+      }
+      take_send_queue(chunk);
+      sending_ = true;
+    }
+    write_send_chunk(chunk);
+    {
+      std::unique_lock<std::mutex> lck(send_buffer_mtx_);
+      sending_ = false;
+      send_buffer_cv_.notify_all();
     }
-    log_debug << "send data to " << node_id_ << " size:" << ret;
-    delete []buffer;
   }
 }
 
+static uint64_t elapsed_us(chrono::steady_clock::time_point from, chrono::steady_clock::time_point to) {
+  return chrono::duration_cast<chrono::microseconds>(to - from).count();
+}
+
+/**
+ * Take the next frames to write, in wire order, cutting only between two frames:
+ * the rest of a frame partly written, then up to a quantum of urgent frames,
+ * then up to a quantum of bulk ones. Must hold send_buffer_mtx_.
+ */
+void Connection::take_send_queue(send_chunk& chunk) {
+  auto now = chrono::steady_clock::now();
+  vector<shared_frame> plan; // a null frame stands for mark bytes of send_buffer_
+  uint64_t bytes = 0;
+  size_t marks = frame_marks_.size();
+  if (partial_head_) {
+    take_bulk(plan, bytes, 1, now);
+    partial_head_ = false;
+  }
+  uint64_t taken = 0;
+  while (!urgent_frames_.empty() && taken < send_quantum_) {
+    shared_frame& urgent = urgent_frames_.front();
+    queue_delay_[urgent.priority].add(elapsed_us(urgent.queued_at, now));
+    taken += urgent.frame->len();
+    frame_bytes_ -= urgent.frame->len();
+    plan.push_back(urgent);
+    urgent_frames_.pop_front();
+  }
+  take_bulk(plan, bytes, send_quantum_, now);
+
+  if (bytes > 0) {
+    chunk.bytes = new char[bytes];
+    send_buffer_->read(chunk.bytes, bytes);
+    drained_bytes_ += bytes;
+  }
+  uint64_t pos = 0;
+  for (int i = 0; i < plan.size(); i++) {
+    if (plan[i].frame == nullptr) {
+      chunk.segments.push_back(make_pair((const char*)chunk.bytes + pos, plan[i].mark));
+      pos += plan[i].mark;
+    } else {
+      chunk.segments.push_back(make_pair((const char*)plan[i].frame->data() + plan[i].offset, plan[i].frame->len() - plan[i].offset));
+      chunk.frames.push_back(plan[i].frame);
+    }
+  }
+  if (holding_) {
+    stat_.coalesced_writes++;
+    stat_.coalesced_frames += marks - frame_marks_.size() + chunk.frames.size();
+    stat_.coalesce_delay_us += elapsed_us(hold_since_, now);
+    holding_ = false;
+  }
+  if (send_queue_empty()) {
+    release_ = false;
+  }
+}
+
+/**
+ * Plan the bulk frames to write next, at least one and up to quantum bytes:
+ * the bytes of send_buffer_ up to a frame end interleaved with the shared frames at their marks.
+ * bytes counts what is planned out of send_buffer_.
+ */
+void Connection::take_bulk(vector<shared_frame>& plan, uint64_t& bytes, uint64_t quantum, chrono::steady_clock::time_point now) {
+  uint64_t taken = 0;
+  while (taken < quantum) {
+    if (!shared_frames_.empty() && shared_frames_.front().mark <= drained_bytes_ + bytes) {
+      shared_frame& queued = shared_frames_.front();
+      queue_delay_[queued.priority].add(elapsed_us(queued.queued_at, now));
+      taken += queued.frame->len() - queued.offset;
+      frame_bytes_ -= queued.frame->len() - queued.offset;
+      plan.push_back(queued);
+      shared_frames_.pop_front();
+      continue;
+    }
+    if (frame_marks_.empty()) {
+      break;
+    }
+    frame_mark& mark = frame_marks_.front();
+    uint64_t n = mark.end - drained_bytes_ - bytes;
+    queue_delay_[mark.priority].add(elapsed_us(mark.queued_at, now));
+    if (!plan.empty() && plan.back().frame == nullptr) {
+      plan.back().mark += n;
+    } else {
+      shared_frame segment;
+      segment.mark = n;
+      plan.push_back(segment);
+    }
+    bytes += n;
+    taken += n;
+    frame_marks_.pop_front();
+  }
+}
+
+TimingStat Connection::get_queue_delay(int priority) {
+  std::unique_lock<std::mutex> lck(send_buffer_mtx_);
+  if (priority < 0 || priority >= MSG_PRIORITY_CLASSES) {
+    return TimingStat();
+  }
+  return queue_delay_[priority];
+}
+
+/**
+ * Write a chunk taken out of the send queue. If a write fails, the frames queued by reference
+ * in the chunk are marked with E_UNCONNECTED, for their senders to see once they are let go.
+ */
+void Connection::write_send_chunk(send_chunk& chunk) {
+  bool failed = false;
+  if (can_send_inline()) {
+    // the whole chunk in one writev, e.g. a round of small messages flushed at once
+    vector<struct iovec> iov(chunk.segments.size());
+    for (int i = 0; i < chunk.segments.size(); i++) {
+      iov[i].iov_base = (void*)chunk.segments[i].first;
+      iov[i].iov_len = chunk.segments[i].second;
+    }
+    for (size_t i = 0; i < iov.size() && !failed; i += IOV_MAX) {
+      int cnt = std::min(iov.size() - i, (size_t)IOV_MAX);
+      ssize_t expected = 0;
+      for (int j = 0; j < cnt; j++) {
+        expected += iov[i + j].iov_len;
+      }
+      // writev_all moves on through iov, count before
+      ssize_t ret = writev_all(&iov[i], cnt);
+      if (ret != expected) {
+        log_error << "send data to " << node_id_ << " error, " << errno << ", error msg:" << strerror(errno);
+        failed = true;
+      }
+      log_debug << "send data to " << node_id_ << " size:" << ret;
+    }
+  } else {
+    for (int i = 0; i < chunk.segments.size() && !failed; i++) {
+      ssize_t ret = send(chunk.segments[i].first, chunk.segments[i].second);
+      if (ret != chunk.segments[i].second) {
+        log_error << "send data to " << node_id_ << " error, " << errno << ", error msg:" << strerror(errno);
+        failed = true;
+      }
+      log_debug << "send data to " << node_id_ << " size:" << ret;
+    }
+  }
+  if (failed) {
+    for (int i = 0; i < chunk.frames.size(); i++) {
+      chunk.frames[i]->set_error(E_UNCONNECTED);
+    }
+  }
+  delete []chunk.bytes;
+  chunk.bytes = nullptr;
+}
+
 void Connection::loop_send(string task_id) {
   log_debug << task_id << " begin loop send data to " << node_id_;
+  netutil::place_io_thread("io-send-" + node_id_, node_id_);
   while (true) {
     
-    char *buffer = nullptr;
-    uint64_t n = 0;
+    send_chunk chunk;
     {
       bool stop_send = false;
       std::unique_lock<std::mutex> lck(send_buffer_mtx_);
-      send_buffer_cv_.wait(lck, [&](){
+      auto ready = [&](){
         std::unique_lock<std::mutex> lck2(stop_work_mtx_);
         auto iter = stop_works_.find(task_id);
         if (iter != stop_works_.end() && iter->second) {
           stop_send = true;
           return true;
         }
-        if (send_buffer_->size() > 0) {
+        if (send_queue_ready()) {
           return true;
         }
         return false;
-      });
+      };
+      while (!ready()) {
+        // a held queue goes at the end of its window, if nothing else makes it ready before
+        if (holding_ && release_) {
+          send_buffer_cv_.wait_until(lck, hold_since_ + chrono::microseconds(coalesce_us_));
+        } else {
+          send_buffer_cv_.wait(lck);
+        }
+      }
       if (stop_send) {
         break;
       }
-      n = send_buffer_->size();
-      buffer = new char[n];
-      send_buffer_->read(buffer, n);
+      take_send_queue(chunk);
+      sending_ = true;
     }
+    write_send_chunk(chunk);
     {
-      ssize_t ret = send(buffer, n);
-      if (ret != n) {
-        log_error << "send data to " << node_id_ << " error, " << errno << ", error msg:" << strerror(errno);
-      }
-      log_debug << "send data to " << node_id_ << " size:" << ret;
-      delete []buffer;
-      //if (stop_send)return;
+      std::unique_lock<std::mutex> lck(send_buffer_mtx_);
+      sending_ = false;
+      send_buffer_cv_.notify_all();
     }
   }
   log_debug << task_id << " end loop send data to " << node_id_;
 }
 
 void Connection::do_start(const string& task_id) {
-  {
-    std::unique_lock<std::mutex> lck(stop_work_mtx_);
-    stop_works_.insert(std::pair<string, bool>(task_id, false));
-    stop_work_cv_.notify_all();
-  }
   bool stop_work = false;
   {
     std::unique_lock<std::mutex> lck(work_mtx_);
@@ -263,36 +959,75 @@ void Connection::do_stop(const string& task_id) {
 }
 
 void Connection::start(const string& task_id) {
+  auto beg = steady_clock::now();
   {
     std::unique_lock<std::mutex> lck(task_mtx_);
     task_count_++;
+    if (tasks_started_++ > 0) {
+      stat_.pool_hits++;
+    } else {
+      stat_.pool_misses++;
+    }
     string id = "lock:" + task_id;
     string msg = "1";
     send(id, msg.data(), msg.size(), -1);
   }
+  {
+    // a task id used again, what it purged before is for this task to receive
+    unique_lock<mutex> lck(mapbuffer_mtx_);
+    for (auto iter = purged_prefixes_.begin(); iter != purged_prefixes_.end();) {
+      if (iter->first == task_id) {
+        iter = purged_prefixes_.erase(iter);
+      } else {
+        iter++;
+      }
+    }
+  }
+  // registered before do_start runs, so that stop finds the task without waiting for the thread
+  {
+    std::unique_lock<std::mutex> lck(stop_work_mtx_);
+    stop_works_.insert(std::pair<string, bool>(task_id, false));
+  }
   std::thread *start_thread = new std::thread();
   *start_thread = thread(&Connection::do_start, this, task_id);
   {
     std::unique_lock<std::mutex> lck(thread_mtx_);
     threads_.insert(std::pair<string, std::thread*>(task_id, start_thread));
   }
-  {
-    std::unique_lock<std::mutex> lck(stop_work_mtx_);
-    stop_work_cv_.wait(lck, [&](){
-      auto iter = stop_works_.find(task_id);
-      if (iter != stop_works_.end() && !iter->second) {
-        return true;
-      }
-      return false;
-    });
+  stat_.attach_us += duration_cast<microseconds>(steady_clock::now() - beg).count();
+}
+
+bool Connection::is_alive() {
+  if (state_ == State::Closing || state_ == State::Closed || fd_ < 0) {
+    return false;
+  }
+  char c;
+  ssize_t ret = ::recv(fd_, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (ret > 0) {
+    return true;
   }
+  return ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
 }
 
 void Connection::stop(const string& task_id) {
   log_debug << task_id << " begin stop connection with " << node_id_;
+  {
+    // the handlers of the task go with it, the connection may stay pooled for others
+    unique_lock<mutex> lck(mapbuffer_mtx_);
+    for (auto iter = handlers_.begin(); iter != handlers_.end();) {
+      if (iter->task_id == task_id) {
+        iter = handlers_.erase(iter);
+      } else {
+        iter++;
+      }
+    }
+  }
   {
     std::unique_lock<std::mutex> lck(task_mtx_);
     task_count_--;
+    if (coalescing_task_ == task_id) {
+      coalescing_task_.clear();
+    }
 
     string id = "lock:" + task_id;
     string msg = "1";
@@ -302,46 +1037,584 @@ void Connection::stop(const string& task_id) {
   log_debug << task_id << " end stop connection with " << node_id_;
 }
 
-ssize_t Connection::recv(const string& id, char* data, uint64_t length, int64_t timeout) {
-  if (timeout < 0)
-    timeout = 1000 * 1000000;
+shared_ptr<id_slot> Connection::get_slot(const string& id) {
+  auto iter = mapbuffer_.find(id);
+  if (iter != mapbuffer_.end()) {
+    return iter->second;
+  }
+  shared_ptr<id_slot> slot = make_shared<id_slot>();
+  mapbuffer_.insert(std::pair<string, shared_ptr<id_slot>>(id, slot));
+  return slot;
+}
+
+/**
+ * The slot of a registered message id in the cache of a task, looked up by id only the first time.
+ * The handles are numbered per task, so each task on the connection has a cache of its own.
+ * Must hold mapbuffer_mtx_.
+ */
+id_slot& Connection::slot_of(vector<shared_ptr<id_slot>>& slots, int handle, const string& id) {
+  if (handle >= slots.size()) {
+    slots.resize(handle + 1);
+  }
+  shared_ptr<id_slot>& slot = slots[handle];
+  if (slot == nullptr) {
+    slot = get_slot(id);
+    slot->registered++;
+  }
+  return *slot;
+}
+
+void Connection::release_slots(vector<shared_ptr<id_slot>>& slots) {
+  unique_lock<mutex> lck(mapbuffer_mtx_);
+  for (auto iter = slots.begin(); iter != slots.end(); iter++) {
+    if (*iter != nullptr) {
+      (*iter)->registered--;
+    }
+  }
+  slots.clear();
+}
+
+shared_ptr<recv_waiter> Connection::ready_waiter(id_slot& slot) {
+  if (slot.waiters.empty()) {
+    return nullptr;
+  }
+  // only the head may read, the others keep sleeping until it is their turn
+  shared_ptr<recv_waiter> waiter = slot.waiters.front();
+  bool readable = waiter->whole_message ? !slot.messages.empty() : slot.messages.can_read(waiter->length);
+  if (!waiter->ready && readable) {
+    waiter->ready = true;
+    return waiter;
+  }
+  return nullptr;
+}
+
+/**
+ * Hand the messages of a slot over to the waiters that can be served now.
+ * Asynchronous waiters are filled here and removed from the queue, a blocked receiver
+ * reads by itself and hands over to the next one. Call wake_waiters after unlocking.
+ */
+void Connection::dispatch_waiters(id_slot& slot, vector<shared_ptr<recv_waiter>>& ready) {
+  while (true) {
+    shared_ptr<recv_waiter> waiter = ready_waiter(slot);
+    if (waiter == nullptr) {
+      // nothing more will arrive for the others
+      if (recv_ended_) {
+        fail_locked(slot, ready);
+      }
+      return;
+    }
+    if (waiter->done == nullptr) {
+      ready.push_back(waiter);
+      return;
+    }
 
-  int64_t elapsed = 0;
-  auto beg = system_clock::now();
-  ssize_t ret = 0;
-  bool retry = false;
-  State tmpstate = state_;
-  do {
-    auto end = system_clock::now();
-    elapsed = duration_cast<duration<int64_t, std::milli>>(end - beg).count();
-    if ((tmpstate == State::Connected) && (state_ != State::Connected)) {
-      return E_UNCONNECTED; // un connected
+    if (waiter->claim != nullptr) {
+      waiter->data = waiter->claim();
     }
-    if (elapsed > timeout) {
-      return E_TIMEOUT; // timeout
+    if (waiter->claim == nullptr || waiter->data != nullptr) {
+      waiter->result = slot.messages.read(waiter->data, waiter->length);
+      stat_.message_received++;
+      stat_.bytes_received += waiter->result;
+      ready.push_back(waiter);
     }
-    
-    shared_ptr<cycle_buffer> buffer = nullptr;
+    slot.waiters.pop_front();
+    if (slot.waiters.empty()) {
+      return;
+    }
+  }
+}
+
+void Connection::wake_waiters(const vector<shared_ptr<recv_waiter>>& ready) {
+  for (int i = 0; i < ready.size(); i++) {
+    if (ready[i]->done != nullptr) {
+      ready[i]->done(ready[i]->result);
+    } else {
+      ready[i]->cv.notify_one();
+    }
+  }
+}
+
+void Connection::recv_async(const string& id, char* data, uint64_t length, std::function<void(ssize_t)> done) {
+  unique_lock<mutex> lck(mapbuffer_mtx_);
+  shared_ptr<id_slot> slot = get_slot(id);
+  if (slot->waiters.empty() && slot->messages.can_read(length)) {
+    ssize_t ret = slot->messages.read(data, length);
+    stat_.message_received++;
+    stat_.bytes_received += ret;
+    lck.unlock();
+    done(ret);
+    return;
+  }
+
+  shared_ptr<recv_waiter> waiter = make_shared<recv_waiter>();
+  waiter->length = length;
+  waiter->data = data;
+  waiter->done = done;
+  slot->waiters.push_back(waiter);
+  vector<shared_ptr<recv_waiter>> ready;
+  dispatch_waiters(*slot, ready);
+  lck.unlock();
+  wake_waiters(ready);
+}
+
+/**
+ * Like recv_async, and if the receive is sure to take the next frame of id as a whole,
+ * the reactor writes the frame right into data as it arrives.
+ */
+void Connection::post_recv(const string& id, char* data, uint64_t length, std::function<void(ssize_t)> done) {
+  unique_lock<mutex> lck(mapbuffer_mtx_);
+  shared_ptr<id_slot> slot = get_slot(id);
+  if (slot->waiters.empty() && slot->messages.can_read(length)) {
+    ssize_t ret = slot->messages.read(data, length);
+    stat_.message_received++;
+    stat_.bytes_received += ret;
+    lck.unlock();
+    done(ret);
+    return;
+  }
+
+  place_next(*slot, data, length);
+  shared_ptr<recv_waiter> waiter = make_shared<recv_waiter>();
+  waiter->length = length;
+  waiter->data = data;
+  waiter->done = done;
+  slot->waiters.push_back(waiter);
+  vector<shared_ptr<recv_waiter>> ready;
+  dispatch_waiters(*slot, ready);
+  lck.unlock();
+  wake_waiters(ready);
+}
+
+/**
+ * Have the next frame of a slot not parsed yet written into data, if it is the one
+ * the receiver about to be queued will read: nothing is queued and every waiter ahead
+ * has its own frame placed. Must hold mapbuffer_mtx_.
+ */
+bool Connection::place_next(id_slot& slot, char* data, uint64_t length) {
+  if (!slot.messages.empty() || slot.waiters.size() != slot.expected.size()) {
+    return false;
+  }
+  expected_message expected;
+  expected.length = length;
+  expected.data = data;
+  slot.expected.push_back(std::move(expected));
+  expected_count_++;
+  // the reactor counts a frame before it looks at expected_count_, we do the other way round:
+  // either it sees this placement, or we see its frame in flight, maybe one of this id
+  if (slot.expected.size() == 1 && frames_parsed_ != frames_dispatched_) {
+    slot.expected.pop_back();
+    expected_count_--;
+    return false;
+  }
+  return true;
+}
+
+void Connection::post_waiter(const string& id, const shared_ptr<recv_waiter>& waiter) {
+  vector<shared_ptr<recv_waiter>> ready;
+  {
     unique_lock<mutex> lck(mapbuffer_mtx_);
-    mapbuffer_cv_.wait(lck, [&](){
-      auto iter = mapbuffer_.find(id);
-      if (iter != mapbuffer_.end()) { // got id
-        buffer = iter->second;
-        if (buffer->can_read(length)) { // got data
-          return true;
+    shared_ptr<id_slot> slot = get_slot(id);
+    slot->waiters.push_back(waiter);
+    dispatch_waiters(*slot, ready);
+  }
+  wake_waiters(ready);
+}
+
+void Connection::cancel_waiter(const string& id, const shared_ptr<recv_waiter>& waiter) {
+  vector<shared_ptr<recv_waiter>> ready;
+  {
+    unique_lock<mutex> lck(mapbuffer_mtx_);
+    auto iter = mapbuffer_.find(id);
+    if (iter == mapbuffer_.end()) {
+      return;
+    }
+    deque<shared_ptr<recv_waiter>>& waiters = iter->second->waiters;
+    auto pos = std::find(waiters.begin(), waiters.end(), waiter);
+    if (pos == waiters.end()) {
+      return;
+    }
+    bool head = (pos == waiters.begin());
+    waiters.erase(pos);
+    if (head && !waiters.empty()) {
+      dispatch_waiters(*iter->second, ready);
+    }
+  }
+  wake_waiters(ready);
+}
+
+/**
+ * Post a batch of receives under one mapbuffer_ lock. Each message is filled in as it arrives,
+ * and done is called once, by the thread completing the last one.
+ */
+void Connection::recvv(vector<msg_desc>& msgs, std::function<void()> done) {
+  shared_ptr<std::atomic<int>> pending = make_shared<std::atomic<int>>(msgs.size() + 1);
+  vector<shared_ptr<recv_waiter>> ready;
+  {
+    unique_lock<mutex> lck(mapbuffer_mtx_);
+    for (int i = 0; i < msgs.size(); i++) {
+      msg_desc& msg = msgs[i];
+      shared_ptr<id_slot> slot = get_slot(msg.id);
+      if (slot->waiters.empty() && slot->messages.can_read(msg.length)) {
+        msg.result = slot->messages.read(msg.data, msg.length);
+        stat_.message_received++;
+        stat_.bytes_received += msg.result;
+        (*pending)--;
+        continue;
+      }
+
+      shared_ptr<recv_waiter> waiter = make_shared<recv_waiter>();
+      waiter->length = msg.length;
+      waiter->data = msg.data;
+      waiter->done = [&msg, pending, done](ssize_t ret) {
+        msg.result = ret;
+        if (--(*pending) == 0) {
+          done();
         }
+      };
+      slot->waiters.push_back(waiter);
+      dispatch_waiters(*slot, ready);
+    }
+  }
+  wake_waiters(ready);
+  if (--(*pending) == 0) {
+    done();
+  }
+}
+
+/**
+ * Drop the messages of id and take its waiters out, marked canceled. The slot goes
+ * away with them unless it is registered. 
+ * Must hold mapbuffer_mtx_, call wake_waiters with canceled after unlocking.
+ */
+uint64_t Connection::cancel_locked(const string& id, vector<shared_ptr<recv_waiter>>& canceled) {
+  auto iter = mapbuffer_.find(id);
+  if (iter == mapbuffer_.end()) {
+    return 0;
+  }
+  id_slot& slot = *iter->second;
+  uint64_t dropped = slot.messages.size();
+  for (auto waiter = slot.waiters.begin(); waiter != slot.waiters.end(); waiter++) {
+    (*waiter)->canceled = true;
+    (*waiter)->ready = true;
+    (*waiter)->result = E_CANCELED;
+    canceled.push_back(*waiter);
+  }
+  slot.waiters.clear();
+  expected_count_ -= slot.expected.size();
+  slot.expected.clear();
+  revoke_locked(slot);
+  if (slot.registered > 0) {
+    slot.messages = message_queue();
+  } else {
+    mapbuffer_.erase(iter);
+  }
+  stat_.purged_bytes += dropped;
+  return dropped;
+}
+
+//! nothing more is received, fail the waiters of every slot. must hold mapbuffer_mtx_
+void Connection::end_recv_locked(vector<shared_ptr<recv_waiter>>& failed) {
+  recv_ended_ = true;
+  for (auto iter = mapbuffer_.begin(); iter != mapbuffer_.end(); iter++) {
+    fail_locked(*iter->second, failed);
+  }
+}
+
+/**
+ * Take the waiters of a slot out which are not served yet, marked canceled with E_UNCONNECTED.
+ * A blocked receiver already made ready keeps its turn, it reads what is there.
+ * Must hold mapbuffer_mtx_, call wake_waiters with failed after unlocking.
+ */
+void Connection::fail_locked(id_slot& slot, vector<shared_ptr<recv_waiter>>& failed) {
+  deque<shared_ptr<recv_waiter>> served;
+  for (auto waiter = slot.waiters.begin(); waiter != slot.waiters.end(); waiter++) {
+    if ((*waiter)->ready) {
+      served.push_back(*waiter);
+      continue;
+    }
+    (*waiter)->canceled = true;
+    (*waiter)->ready = true;
+    (*waiter)->result = E_UNCONNECTED;
+    failed.push_back(*waiter);
+  }
+  slot.waiters.swap(served);
+  expected_count_ -= slot.expected.size();
+  slot.expected.clear();
+  revoke_locked(slot);
+}
+
+/**
+ * Revoke the frames started into the buffers of the receivers of a slot, which are about
+ * to be completed. The one the reactor is filling goes on into payload, so the buffer is
+ * left alone once this returns. Must hold mapbuffer_mtx_.
+ */
+void Connection::revoke_locked(id_slot& slot) {
+  if (slot.placed.empty()) {
+    return;
+  }
+  for (auto iter = slot.placed.begin(); iter != slot.placed.end(); iter++) {
+    (*iter)->revoked = true;
+  }
+  slot.placed.clear();
+  unique_lock<mutex> lck(incoming_mtx_);
+  if (incoming_.placed != nullptr && incoming_.placed->revoked) {
+    incoming_.payload.resize(incoming_.length);
+    incoming_.data = nullptr;
+  }
+}
+
+/**
+ * A placed frame is dispatched, it is no longer the slot's to revoke. False if it was revoked,
+ * the buffer it went into is the caller's again. Must hold mapbuffer_mtx_.
+ */
+bool Connection::unplace(const string& id, const shared_ptr<placement>& placed) {
+  if (placed->revoked) {
+    return false;
+  }
+  // not revoked, so its slot is still there
+  deque<shared_ptr<placement>>& slot_placed = mapbuffer_[id]->placed;
+  slot_placed.erase(std::find(slot_placed.begin(), slot_placed.end(), placed));
+  return true;
+}
+
+void Connection::fail_waiters() {
+  // a frame cut by the close never comes whole
+  uint64_t whole = frames_parsed_ - (receiving_ || frame_left_ > 0 ? 1 : 0);
+  vector<shared_ptr<recv_waiter>> failed;
+  {
+    unique_lock<mutex> lck(mapbuffer_mtx_);
+    frames_at_close_ = whole;
+    if (frames_dispatched_ < frames_at_close_) {
+      // loop_recv has the last frames still, it fails the waiters left after them
+      return;
+    }
+    end_recv_locked(failed);
+  }
+  wake_waiters(failed);
+  if (!failed.empty()) {
+    log_warn << "connection with " << node_id_ << " closed, fail " << failed.size() << " receivers";
+  }
+}
+
+bool Connection::is_purged(const string& id) {
+  for (int i = 0; i < purged_prefixes_.size(); i++) {
+    const string& prefix = purged_prefixes_[i].second;
+    if (id.compare(0, prefix.size(), prefix) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+//! the handler of the longest prefix of id, if any. must hold mapbuffer_mtx_
+message_handler* Connection::handler_of(const string& id) {
+  message_handler* handler = nullptr;
+  size_t matched = 0;
+  for (int i = 0; i < handlers_.size(); i++) {
+    const string& prefix = handlers_[i].prefix;
+    if ((handler == nullptr || prefix.size() > matched) && id.compare(0, prefix.size(), prefix) == 0) {
+      handler = &handlers_[i].handler;
+      matched = prefix.size();
+    }
+  }
+  return handler;
+}
+
+bool Connection::on_message(const string& task_id, const string& prefix, message_handler handler) {
+  unique_lock<mutex> lck(mapbuffer_mtx_);
+  for (auto iter = handlers_.begin(); iter != handlers_.end(); iter++) {
+    if (iter->prefix == prefix) {
+      if (iter->task_id != task_id) {
+        log_error << task_id << " can not handle messages from " << node_id_ << ", task " << iter->task_id
+                  << " handles the prefix";
+        return false;
       }
-      //log_debug << node_id_ << " not find mapbuffer, begin wait "<< id;
-      return false;
-    });
-    ret = buffer->read(data, length);
-    mapbuffer_cv_.notify_all();
-    //log_debug << node_id_ << " read mapbuffer, notify all " << id;
-    return ret;
-  } while (true);
+      handlers_.erase(iter);
+      break;
+    }
+  }
+  if (handler != nullptr) {
+    prefix_handler entry;
+    entry.task_id = task_id;
+    entry.prefix = prefix;
+    entry.handler = handler;
+    handlers_.push_back(entry);
+  }
+  log_debug << task_id << (handler != nullptr ? " handle" : " stop handling") << " messages from " << node_id_;
+  return true;
+}
+
+uint64_t Connection::cancel(const string& id) {
+  vector<shared_ptr<recv_waiter>> canceled;
+  uint64_t dropped = 0;
+  {
+    unique_lock<mutex> lck(mapbuffer_mtx_);
+    dropped = cancel_locked(id, canceled);
+  }
+  wake_waiters(canceled);
+  log_debug << "cancel " << canceled.size() << " receivers of id, drop " << dropped << " bytes from " << node_id_;
+  return dropped;
+}
+
+uint64_t Connection::purge(const string& task_id, const string& prefix, bool drop_later) {
+  vector<shared_ptr<recv_waiter>> canceled;
+  uint64_t dropped = 0;
+  {
+    unique_lock<mutex> lck(mapbuffer_mtx_);
+    if (drop_later && !is_purged(prefix)) {
+      if (purged_prefixes_.size() == max_purged_prefixes_) {
+        log_warn << "too many purged id prefixes from " << node_id_ << ", the messages of the oldest one, of task "
+                 << purged_prefixes_.front().first << ", are kept again";
+        purged_prefixes_.pop_front();
+      }
+      purged_prefixes_.push_back(make_pair(task_id, prefix));
+    }
+    for (auto iter = handlers_.begin(); iter != handlers_.end();) {
+      if (iter->task_id == task_id && iter->prefix.compare(0, prefix.size(), prefix) == 0) {
+        iter = handlers_.erase(iter);
+      } else {
+        iter++;
+      }
+    }
+    // the ids with the prefix are contiguous in the map
+    vector<string> ids;
+    for (auto iter = mapbuffer_.lower_bound(prefix); iter != mapbuffer_.end(); iter++) {
+      if (iter->first.compare(0, prefix.size(), prefix) != 0)
+        break;
+      ids.push_back(iter->first);
+    }
+    for (int i = 0; i < ids.size(); i++) {
+      dropped += cancel_locked(ids[i], canceled);
+    }
+  }
+  wake_waiters(canceled);
+  log_debug << "purge " << canceled.size() << " receivers, drop " << dropped << " bytes from " << node_id_;
+  return dropped;
+}
+
+/**
+ * Queue a blocked receiver on a slot and sleep until it is at the head and its data is there,
+ * or until timeout milliseconds have passed, a very long time if timeout < 0.
+ * If the connection closes meanwhile, the waiter fails with E_UNCONNECTED once what was
+ * received before is dispatched, see fail_waiters.
+ * Returns at once, without queueing, if nobody is ahead and the data is already there.
+ * Returns the waiter to pass to end_turn, or null if it was not queued.
+ * A canceled or timed out waiter is returned out of the queue with its result set,
+ * the caller must not read nor end_turn.
+ */
+shared_ptr<recv_waiter> Connection::wait_turn(unique_lock<mutex>& lck, id_slot& slot, uint64_t length, bool whole_message, int64_t timeout) {
+  if (slot.waiters.empty()) {
+    if (whole_message ? !slot.messages.empty() : slot.messages.can_read(length)) {
+      return nullptr;
+    }
+  }
+
+  shared_ptr<recv_waiter> waiter = make_shared<recv_waiter>();
+  waiter->length = length;
+  waiter->whole_message = whole_message;
+  if (recv_ended_) {
+    waiter->canceled = true;
+    waiter->ready = true;
+    waiter->result = E_UNCONNECTED;
+    return waiter;
+  }
+  slot.waiters.push_back(waiter);
+  ready_waiter(slot);
+  if (timeout < 0)
+    timeout = 1000 * 1000000;
+  auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout);
+  while (!waiter->ready) {
+    if (waiter->cv.wait_until(lck, deadline) == cv_status::timeout && !waiter->ready) {
+      break;
+    }
+    stat_.recv_wakeups++;
+    if (!waiter->ready) {
+      stat_.recv_futile_wakeups++;
+    }
+  }
+  if (!waiter->ready) {
+    // timed out, leave the queue and let the next receiver have its turn
+    vector<shared_ptr<recv_waiter>> next;
+    auto pos = std::find(slot.waiters.begin(), slot.waiters.end(), waiter);
+    bool head = (pos == slot.waiters.begin());
+    slot.waiters.erase(pos);
+    if (head && !slot.waiters.empty()) {
+      dispatch_waiters(slot, next);
+    }
+    waiter->ready = true;
+    waiter->canceled = true;
+    waiter->result = E_TIMEOUT;
+    stat_.recv_timeouts++;
+    lck.unlock();
+    wake_waiters(next);
+    log_warn << "recv timeout after " << timeout << "ms, " << length << " bytes from " << node_id_;
+  }
+  return waiter;
+}
 
-  log_error << "in fact, never enter here" ;
-  return E_ERROR;
+/**
+ * Leave the head of the waiters of a slot and hand over to the next receivers.
+ * Unlocks lck.
+ */
+void Connection::end_turn(unique_lock<mutex>& lck, id_slot& slot, const shared_ptr<recv_waiter>& waiter) {
+  vector<shared_ptr<recv_waiter>> next;
+  if (waiter != nullptr) {
+    slot.waiters.pop_front();
+    if (!slot.waiters.empty()) {
+      dispatch_waiters(slot, next);
+    }
+  }
+  lck.unlock();
+  wake_waiters(next);
+}
+
+ssize_t Connection::recv(const string& id, char* data, uint64_t length, int64_t timeout) {
+  unique_lock<mutex> lck(mapbuffer_mtx_);
+  shared_ptr<id_slot> slot = get_slot(id);
+  return recv_from(lck, *slot, data, length, timeout);
+}
+
+ssize_t Connection::recv(vector<shared_ptr<id_slot>>& slots, int handle, const string& id, char* data, uint64_t length, int64_t timeout) {
+  unique_lock<mutex> lck(mapbuffer_mtx_);
+  return recv_from(lck, slot_of(slots, handle, id), data, length, timeout);
+}
+
+ssize_t Connection::recv_from(unique_lock<mutex>& lck, id_slot& slot, char* data, uint64_t length, int64_t timeout) {
+  shared_ptr<recv_waiter> waiter = wait_turn(lck, slot, length, false, timeout);
+  if (waiter != nullptr && waiter->canceled) {
+    return waiter->result;
+  }
+  ssize_t ret = slot.messages.read(data, length);
+  stat_.message_received++;
+  stat_.bytes_received += ret;
+  end_turn(lck, slot, waiter);
+  return ret;
+}
+
+ssize_t Connection::recv_message(const string& id, string& data, int64_t timeout) {
+  unique_lock<mutex> lck(mapbuffer_mtx_);
+  shared_ptr<id_slot> slot = get_slot(id);
+  shared_ptr<recv_waiter> waiter = wait_turn(lck, *slot, 0, true, timeout);
+  if (waiter != nullptr && waiter->canceled) {
+    return waiter->result;
+  }
+  data = slot->messages.take();
+  stat_.message_received++;
+  stat_.bytes_received += data.size();
+  end_turn(lck, *slot, waiter);
+  return data.size();
+}
+
+ssize_t Connection::probe(const string& id, int64_t timeout) {
+  unique_lock<mutex> lck(mapbuffer_mtx_);
+  shared_ptr<id_slot> slot = get_slot(id);
+  shared_ptr<recv_waiter> waiter = wait_turn(lck, *slot, 0, true, timeout);
+  if (waiter != nullptr && waiter->canceled) {
+    return waiter->result;
+  }
+  ssize_t ret = slot->messages.front_size();
+  end_turn(lck, *slot, waiter);
+  return ret;
 }
 
 ssize_t Connection::peek(int sockfd, void* buf, size_t len) {
@@ -367,15 +1640,13 @@ ssize_t Connection::readn(int connfd, char* vptr, size_t n) {
         nread = 0;
       } else {
         if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+          wait_readable();
           continue;
         }
         log_error << __FUNCTION__ << " errno:" << errno << " " << strerror(errno) ;
         return -1;
       }
     } else if (nread == 0) {
-      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
-        continue;
-      }
       break;
     }
     nleft -= nread;
@@ -398,14 +1669,16 @@ ssize_t Connection::writen(int connfd, const char* vptr, size_t n) {
       if (errno == EINTR) {
         nwritten = 0;
       } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        // the socket buffer is full, sleep until it drains and go on from ptr
+        if (!wait_writable()) {
+          return n - nleft;
+        }
         continue;
+      } else {
+        log_error << __FUNCTION__ << " errno:" << errno << " " << strerror(errno) ;
+        return -1;
       }
-      log_error << __FUNCTION__ << " errno:" << errno << " " << strerror(errno) ;
-      return -1;
     } else if (nwritten == 0) {
-      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
-        continue;
-      }
       break;
     }
     nleft -= nwritten;
@@ -415,6 +1688,101 @@ ssize_t Connection::writen(int connfd, const char* vptr, size_t n) {
   return n - nleft;
 }
 
+/**
+ * Write all of iov, sleeping while the socket buffer is full. Returns the bytes written, -1 on error.
+ */
+ssize_t Connection::writev_all(struct iovec* iov, int iovcnt) {
+  std::unique_lock<mutex> lck(mtx_send_);
+  ssize_t total = 0;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iovcnt;
+  while (msg.msg_iovlen > 0) {
+    ssize_t n = ::sendmsg(fd_, &msg, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        if (!wait_writable()) {
+          return total;
+        }
+        continue;
+      }
+      log_error << __FUNCTION__ << " errno:" << errno << " " << strerror(errno) ;
+      return -1;
+    }
+    total += n;
+    // skip what has been written, iov is the caller's and may be changed
+    while (msg.msg_iovlen > 0 && n >= msg.msg_iov->iov_len) {
+      n -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (n > 0) {
+      msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + n;
+      msg.msg_iov->iov_len -= n;
+    }
+  }
+  return total;
+}
+
+/**
+ * Wait until the socket can be written again.
+ * If a reactor is running, EPOLLOUT is armed on this connection and the reactor wakes us up,
+ * otherwise (e.g. flushing while closing) wait on the socket directly.
+ */
+bool Connection::wait_writable() {
+  if (state_ == State::Closed) {
+    return false;
+  }
+  stat_.send_eagain_waits++;
+
+  if (epollfd_ >= 0 && reactors_ > 0) {
+    std::unique_lock<std::mutex> lck(writable_mtx_);
+    writable_ = false;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events_ | EPOLLOUT;
+    ev.data.ptr = this;
+    if (epoll_ctl(epollfd_, EPOLL_CTL_MOD, fd_, &ev) == 0) {
+      if (writable_cv_.wait_for(lck, std::chrono::milliseconds(1000), [&]() { return writable_; })) {
+        return true;
+      }
+    }
+  }
+
+  struct pollfd pfd;
+  pfd.fd = fd_;
+  pfd.events = POLLOUT;
+  pfd.revents = 0;
+  int ret = ::poll(&pfd, 1, 1000);
+  return (ret >= 0 || errno == EINTR);
+}
+
+bool Connection::wait_readable() {
+  struct pollfd pfd;
+  pfd.fd = fd_;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  int ret = ::poll(&pfd, 1, 1000);
+  return (ret >= 0 || errno == EINTR);
+}
+
+void Connection::on_writable() {
+  std::unique_lock<std::mutex> lck(writable_mtx_);
+  if (!writable_) {
+    // disarm EPOLLOUT, it is armed again on the next EAGAIN
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events_;
+    ev.data.ptr = this;
+    epoll_ctl(epollfd_, EPOLL_CTL_MOD, fd_, &ev);
+    writable_ = true;
+    writable_cv_.notify_all();
+  }
+}
+
 void SSLConnection::close() {
   state_ = Connection::State::Closing;
   if (ssl_ != nullptr) {
@@ -424,6 +1792,7 @@ void SSLConnection::close() {
   }
   ::close(fd_);
   state_ = Connection::State::Closed;
+  fail_waiters();
 }
 
 bool SSLConnection::handshake() {
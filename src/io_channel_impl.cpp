@@ -18,6 +18,9 @@
 #include "io/internal/io_channel_impl.h"
 #include "io/internal/net_io.h"
 #include "io/internal/config.h"
+#include "io/internal/simple_timer.h"
+#include "io/internal/sub_channel.h"
+#include "io/internal/logger.h"
 #include "io/channel.h"
 #include "io/internal_channel.h"
 #include <set>
@@ -56,6 +59,21 @@ static string get_string(const char* s) {
 #endif
 }
 
+//! the message id as the caller writes it, reverse of get_string
+static string get_id_string(const string& s) {
+#if DEBUG_MSG_ID
+  return s;
+#else
+  string ret;
+  ret.reserve(s.size() * 2);
+  for (int i = 0; i < s.size(); i++) {
+    ret.push_back(get_hex_char((unsigned char)s[i] >> 4));
+    ret.push_back(get_hex_char(s[i] & 0x0F));
+  }
+  return ret;
+#endif
+}
+
 
 namespace rosetta {
 
@@ -144,13 +162,386 @@ ssize_t TCPChannel::Send(const char* node_id, const char* id, const char* data,
   }
   return length;
 #else
-  return _net_io->send(node_id, data, length, get_string(id), timeout);
+  string msg_id = get_string(id);
+  if (is_reserved(msg_id))
+    return -1;
+  return _net_io->send(node_id, data, length, msg_id, timeout);
 #endif
 }
 
-void TCPChannel::Flush() {
+int64_t TCPChannel::RecvMessage(const char* node_id, const char* id, string& data, int64_t timeout) {
+#if USE_EMP_IO
+  return IChannel::RecvMessage(node_id, id, data, timeout);
+#else
+  return _net_io->recv_message(node_id, data, get_string(id), timeout);
+#endif
+}
+
+int64_t TCPChannel::Probe(const char* node_id, const char* id, int64_t timeout) {
+#if USE_EMP_IO
+  return IChannel::Probe(node_id, id, timeout);
+#else
+  return _net_io->probe(node_id, get_string(id), timeout);
+#endif
+}
+
+int TCPChannel::Expect(const char* node_id, const char* id, uint64_t length, char* data) {
+#if USE_EMP_IO
+  return IChannel::Expect(node_id, id, length, data);
+#else
+  return _net_io->expect(node_id, get_string(id), length, data);
+#endif
+}
+
+int64_t TCPChannel::Cancel(const char* node_id, const char* id) {
+#if USE_EMP_IO
+  return IChannel::Cancel(node_id, id);
+#else
+  return _net_io->cancel(node_id, get_string(id));
+#endif
+}
+
+int64_t TCPChannel::PurgeTask(const char* task_id) {
+#if USE_EMP_IO
+  return IChannel::PurgeTask(task_id);
+#else
+  return _net_io->purge(get_string(task_id));
+#endif
+}
+
+int TCPChannel::OnMessage(const char* node_id, const char* id_prefix, MessageHandler handler) {
+#if USE_EMP_IO
+  return IChannel::OnMessage(node_id, id_prefix, handler);
+#else
+  // whole bytes, and not empty: the connections use ids of their own
+  size_t digits = strlen(id_prefix);
+  if (digits == 0 || (!DEBUG_MSG_ID && digits % 2 != 0)) {
+    log_error << "invalid message id prefix: " << id_prefix;
+    return -1;
+  }
+  io::message_handler wrapped = nullptr;
+  if (handler != nullptr) {
+    wrapped = [handler](const string& node_id, const string& id, const char* data, uint64_t length) {
+      handler(node_id.c_str(), get_id_string(id).c_str(), data, length);
+    };
+  }
+  return _net_io->on_message(node_id != nullptr ? node_id : "", get_string(id_prefix), wrapped);
+#endif
+}
+
+vector<shared_ptr<IChannel>> TCPChannel::Fork(int n) {
+  uint32_t k = forks_++;
+  SubChannel::Releaser release = nullptr;
+#if !USE_EMP_IO
+  shared_ptr<io::BasicIO> net_io = _net_io;
+  release = [net_io](const string& prefix) { net_io->purge(get_string(prefix.c_str()), false); };
+#endif
+  // the namespaces of the sub-channels of the other tasks on the same connections differ by the task
+  string prefix = SubChannel::task_prefix(task_id_);
+  vector<shared_ptr<IChannel>> subs;
+  for (int j = 0; j < n; j++) {
+    subs.push_back(make_shared<SubChannel>(this, SubChannel::make_prefix(prefix, k, j), release));
+  }
+  return subs;
+}
+
+string TCPChannel::fork_namespace(const string& task_id) {
+  return get_string(SubChannel::task_prefix(task_id).c_str());
+}
+
+bool TCPChannel::is_reserved(const string& msg_id) {
+  static const string reserved = get_string("fffe");
+  if (msg_id.compare(0, reserved.size(), reserved) != 0 || msg_id.compare(0, fork_namespace_.size(), fork_namespace_) == 0) {
+    return false;
+  }
+  log_error << "message id " << get_id_string(msg_id) << " is reserved for the sub-channels";
+  return true;
+}
+
+IORequestPtr TCPChannel::RecvAsync(const char* node_id, const char* id, char* data, uint64_t length, IORequest::Callback callback) {
+#if USE_EMP_IO
+  return IChannel::RecvAsync(node_id, id, data, length, callback);
+#else
+  IORequestPtr request = make_shared<IORequest>(callback);
+  _net_io->recv_async(node_id, data, length, get_string(id), [request](ssize_t ret) {
+    request->Complete(ret);
+  });
+  return request;
+#endif
+}
+
+IORequestPtr TCPChannel::SendAsync(const char* node_id, const char* id, const char* data, uint64_t length, IORequest::Callback callback) {
+#if USE_EMP_IO
+  return IChannel::SendAsync(node_id, id, data, length, callback);
+#else
+  // the message is framed once, and the request completes as the connection lets the frame go,
+  // right away if it is written inline, or once loop_send has written it or failed to
+  IORequestPtr request = make_shared<IORequest>(callback);
+  string msg_id = get_string(id);
+  if (is_reserved(msg_id)) {
+    request->Complete(-1);
+    return request;
+  }
+  shared_ptr<simple_buffer> frame(new simple_buffer(msg_id, length), [request, length](simple_buffer* frame) {
+    int64_t result = frame->error() < 0 ? frame->error() : (int64_t)length;
+    delete frame;
+    request->Complete(result);
+  });
+  memcpy(frame->payload(), data, length);
+  ssize_t ret = _net_io->send_frame(node_id, frame, length, msg_id);
+  if (ret < 0) {
+    frame->set_error(ret);
+  }
+  return request;
+#endif
+}
+
+vector<IORequestPtr> TCPChannel::PostRecvs(MessageDesc* msgs, int count, IORequest::Callback callback) {
+#if USE_EMP_IO
+  return IChannel::PostRecvs(msgs, count, callback);
+#else
+  vector<IORequestPtr> requests;
+  for (int i = 0; i < count; i++) {
+    IORequestPtr request = make_shared<IORequest>(callback);
+    _net_io->post_recv(msgs[i].node_id, msgs[i].data, msgs[i].length, get_string(msgs[i].id), [request](ssize_t ret) {
+      request->Complete(ret);
+    });
+    requests.push_back(request);
+  }
+  return requests;
+#endif
+}
+
+#if !USE_EMP_IO
+/**
+ * Group the descriptors by node, keeping their order, and decode the message ids.
+ * index[node][i] is the position in msgs of batches[node][i].
+ */
+static void group_by_node(MessageDesc* msgs, int count, map<string, vector<msg_desc>>& batches, map<string, vector<int>>& index) {
+  for (int i = 0; i < count; i++) {
+    vector<msg_desc>& batch = batches[msgs[i].node_id];
+    batch.push_back(msg_desc());
+    batch.back().id = get_string(msgs[i].id);
+    batch.back().data = msgs[i].data;
+    batch.back().length = msgs[i].length;
+    index[msgs[i].node_id].push_back(i);
+  }
+}
+
+static int64_t gather_results(MessageDesc* msgs, map<string, vector<msg_desc>>& batches, map<string, vector<int>>& index) {
+  int64_t total = 0;
+  for (auto iter = batches.begin(); iter != batches.end(); iter++) {
+    vector<int>& pos = index[iter->first];
+    for (int i = 0; i < iter->second.size(); i++) {
+      msgs[pos[i]].result = iter->second[i].result;
+      total = (total < 0 || iter->second[i].result < 0) ? -1 : total + iter->second[i].result;
+    }
+  }
+  return total;
+}
+#endif
+
+int64_t TCPChannel::Broadcast(const NodeIDVec* node_ids, const char* id, const char* data, uint64_t length) {
+#if USE_EMP_IO
+  return IChannel::Broadcast(node_ids, id, data, length);
+#else
+  string msg_id = get_string(id);
+  if (is_reserved(msg_id))
+    return -1;
+  vector<string> nodes(node_ids->node_ids, node_ids->node_ids + node_ids->node_count);
+  return _net_io->broadcast(nodes, data, length, msg_id);
+#endif
+}
+
+int64_t TCPChannel::RecvFirstK(const NodeIDVec* node_ids, const char* id, char* data, uint64_t length, int k, int* which) {
+#if USE_EMP_IO
+  return IChannel::RecvFirstK(node_ids, id, data, length, k, which);
+#else
+  vector<string> nodes(node_ids->node_ids, node_ids->node_ids + node_ids->node_count);
+  return _net_io->recv_first_k(nodes, data, length, get_string(id), k, which);
+#endif
+}
+
+int TCPChannel::ResolvePeer(const char* node_id) {
+#if USE_EMP_IO
+  return IChannel::ResolvePeer(node_id);
+#else
+  return _net_io->resolve_peer(node_id);
+#endif
+}
+
+int TCPChannel::RegisterMessageId(const char* id) {
+#if USE_EMP_IO
+  return IChannel::RegisterMessageId(id);
+#else
+  string msg_id = get_string(id);
+  if (is_reserved(msg_id))
+    return -1;
+  return _net_io->register_id(msg_id);
+#endif
+}
+
+int64_t TCPChannel::Send(int peer, int msg, const char* data, uint64_t length) {
+#if USE_EMP_IO
+  return IChannel::Send(peer, msg, data, length);
+#else
+  return _net_io->send(peer, msg, data, length);
+#endif
+}
+
+int64_t TCPChannel::Recv(int peer, int msg, char* data, uint64_t length, int64_t timeout) {
+#if USE_EMP_IO
+  return IChannel::Recv(peer, msg, data, length, timeout);
+#else
+  return _net_io->recv(peer, msg, data, length, timeout);
+#endif
+}
+
+int64_t TCPChannel::SendWithPriority(const char* node_id, const char* id, const char* data, uint64_t length, int priority) {
+#if USE_EMP_IO
+  return IChannel::SendWithPriority(node_id, id, data, length, priority);
+#else
+  // the class sticks to the id, a message must not overtake the earlier ones of its id
+  string msg_id = get_string(id);
+  if (is_reserved(msg_id))
+    return -1;
+  _net_io->set_priority(msg_id, priority);
+  return _net_io->send(node_id, data, length, msg_id, -1L);
+#endif
+}
+
+void TCPChannel::SetMessagePriority(const char* id, int priority) {
+#if USE_EMP_IO
+  IChannel::SetMessagePriority(id, priority);
+#else
+  _net_io->set_priority(get_string(id), priority);
+#endif
+}
+
+SendSpan TCPChannel::AcquireSendBuffer(const char* node_id, const char* id, uint64_t length) {
+#if USE_EMP_IO
+  return IChannel::AcquireSendBuffer(node_id, id, length);
+#else
+  // the header is reserved in front, so the message is framed as the caller writes it
+  string msg_id = get_string(id);
+  if (is_reserved(msg_id))
+    return SendSpan();
+  shared_ptr<simple_buffer> frame = make_shared<simple_buffer>(msg_id, length);
+  SendSpan span;
+  span.data = frame->payload();
+  span.length = length;
+  span.node_id = node_id;
+  span.id = id;
+  span.owner = frame;
+  return span;
+#endif
+}
+
+int64_t TCPChannel::CommitSend(SendSpan& span) {
+#if USE_EMP_IO
+  return IChannel::CommitSend(span);
+#else
+  ssize_t ret = _net_io->send_frame(span.node_id, static_pointer_cast<simple_buffer>(span.owner), span.length, get_string(span.id.c_str()));
+  span = SendSpan();
+  return ret;
+#endif
+}
+
+int64_t TCPChannel::SendV(MessageDesc* msgs, int count) {
+#if USE_EMP_IO
+  return IChannel::SendV(msgs, count);
+#else
+  map<string, vector<msg_desc>> batches;
+  map<string, vector<int>> index;
+  group_by_node(msgs, count, batches, index);
+  for (auto iter = batches.begin(); iter != batches.end(); iter++) {
+    for (int i = 0; i < iter->second.size(); i++) {
+      if (is_reserved(iter->second[i].id)) {
+        for (int j = 0; j < count; j++)
+          msgs[j].result = -1;
+        return -1;
+      }
+    }
+  }
+  _net_io->sendv(batches);
+  return gather_results(msgs, batches, index);
+#endif
+}
+
+int64_t TCPChannel::RecvV(MessageDesc* msgs, int count) {
+#if USE_EMP_IO
+  return IChannel::RecvV(msgs, count);
+#else
+  map<string, vector<msg_desc>> batches;
+  map<string, vector<int>> index;
+  group_by_node(msgs, count, batches, index);
+  _net_io->recvv(batches);
+  return gather_results(msgs, batches, index);
+#endif
+}
+
+int64_t TCPChannel::Exchange(const NodeIDVec* node_ids, const char* id, const char* send_data, char* recv_data, uint64_t length) {
+  SimpleTimer timer;
+  int64_t ret = IChannel::Exchange(node_ids, id, send_data, recv_data, length);
+  addCollectiveTime("Exchange", timer.us_elapse());
+  return ret;
+}
+
+int64_t TCPChannel::Gather(const char* root, const NodeIDVec* node_ids, const char* id, const char* send_data, char* recv_data, uint64_t length) {
+  SimpleTimer timer;
+  int64_t ret = IChannel::Gather(root, node_ids, id, send_data, recv_data, length);
+  addCollectiveTime("Gather", timer.us_elapse());
+  return ret;
+}
+
+int64_t TCPChannel::Scatter(const char* root, const NodeIDVec* node_ids, const char* id, const char* send_data, char* recv_data, uint64_t length) {
+  SimpleTimer timer;
+  int64_t ret = IChannel::Scatter(root, node_ids, id, send_data, recv_data, length);
+  addCollectiveTime("Scatter", timer.us_elapse());
+  return ret;
+}
+
+int64_t TCPChannel::Barrier(const NodeIDVec* node_ids, const char* id) {
+  SimpleTimer timer;
+  int64_t ret = IChannel::Barrier(node_ids, id);
+  addCollectiveTime("Barrier", timer.us_elapse());
+  return ret;
+}
+
+void TCPChannel::addCollectiveTime(const string& name, int64_t us) {
+  log_debug << task_id_ << " " << name << " takes " << us << "us";
+  std::unique_lock<std::mutex> lck(collective_stat_mtx_);
+  collective_stat_[name].add(us);
+}
+
+map<string, CollectiveStat> TCPChannel::GetCollectiveStat() {
+  std::unique_lock<std::mutex> lck(collective_stat_mtx_);
+  return collective_stat_;
+}
+
+TimingStat TCPChannel::GetQueueDelayStat(const char* node_id, int priority) {
 #if USE_EMP_IO
+  return TimingStat();
+#else
+  return _net_io->get_queue_delay(node_id, priority);
+#endif
+}
+
+NetStat TCPChannel::GetNetStat(const char* node_id) {
+#if USE_EMP_IO
+  return NetStat();
+#else
+  return _net_io->get_stat(node_id);
+#endif
+}
+
+void TCPChannel::Flush() {
   _net_io->flush();
+}
+
+void TCPChannel::SetCorked(bool corked) {
+#if !USE_EMP_IO
+  _net_io->set_corked(corked);
 #endif
 }
 
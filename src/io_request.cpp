@@ -0,0 +1,114 @@
+// ==============================================================================
+// Copyright 2020 The LatticeX Foundation
+// This file is part of the Rosetta library.
+//
+// The Rosetta library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The Rosetta library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the Rosetta library. If not, see <http://www.gnu.org/licenses/>.
+// ==============================================================================
+#include "io/channel.h"
+
+#include <algorithm>
+#include <chrono>
+using namespace std;
+
+bool IORequest::Test() {
+  unique_lock<mutex> lck(mtx_);
+  return done_;
+}
+
+bool IORequest::Wait(int64_t timeout) {
+  unique_lock<mutex> lck(mtx_);
+  if (timeout < 0) {
+    cv_.wait(lck, [&]() { return done_; });
+    return true;
+  }
+  return cv_.wait_for(lck, chrono::milliseconds(timeout), [&]() { return done_; });
+}
+
+int64_t IORequest::Result() {
+  unique_lock<mutex> lck(mtx_);
+  return result_;
+}
+
+void IORequest::Complete(int64_t result) {
+  if (callback_ != nullptr) {
+    callback_(result);
+  }
+
+  vector<shared_ptr<Waiter>> waiters;
+  {
+    unique_lock<mutex> lck(mtx_);
+    done_ = true;
+    result_ = result;
+    waiters.swap(waiters_);
+    cv_.notify_all();
+  }
+  for (auto& waiter : waiters) {
+    unique_lock<mutex> lck(waiter->mtx);
+    waiter->fired = true;
+    waiter->cv.notify_all();
+  }
+}
+
+bool IChannel::WaitAll(const vector<IORequestPtr>& requests, int64_t timeout) {
+  auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout < 0 ? 0 : timeout);
+  for (auto& request : requests) {
+    if (timeout < 0) {
+      request->Wait();
+      continue;
+    }
+    int64_t left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+    if (!request->Wait(left < 0 ? 0 : left)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int IChannel::WaitAny(const vector<IORequestPtr>& requests, int64_t timeout) {
+  if (requests.empty()) {
+    return -1;
+  }
+
+  // watch every request, a completion fires the shared waiter
+  shared_ptr<IORequest::Waiter> waiter = make_shared<IORequest::Waiter>();
+  int index = -1;
+  int watched = 0;
+  for (; watched < requests.size(); watched++) {
+    unique_lock<mutex> lck(requests[watched]->mtx_);
+    if (requests[watched]->done_) {
+      index = watched;
+      break;
+    }
+    requests[watched]->waiters_.push_back(waiter);
+  }
+
+  if (index < 0) {
+    unique_lock<mutex> lck(waiter->mtx);
+    if (timeout < 0) {
+      waiter->cv.wait(lck, [&]() { return waiter->fired; });
+    } else {
+      waiter->cv.wait_for(lck, chrono::milliseconds(timeout), [&]() { return waiter->fired; });
+    }
+  }
+
+  for (int i = 0; i < watched; i++) {
+    unique_lock<mutex> lck(requests[i]->mtx_);
+    auto& waiters = requests[i]->waiters_;
+    waiters.erase(std::remove(waiters.begin(), waiters.end(), waiter), waiters.end());
+    if (index < 0 && requests[i]->done_) {
+      index = i;
+    }
+  }
+  return index;
+}
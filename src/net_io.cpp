@@ -17,11 +17,36 @@
 // ==============================================================================
 #include "io/internal/net_io.h"
 #include <set>
+#include <algorithm>
 
 namespace rosetta {
 namespace io {
 
 void BasicIO::close() {
+  // the handles are numbered per task, the tasks after this one have caches of their own
+  for (int i = 0; i < handle_slots_.size(); i++) {
+    if (!handle_slots_[i].empty())
+      peers_[i]->get()->release_slots(handle_slots_[i]);
+  }
+  // a pooled connection outlives the task, do not leave what it queued corked there
+  if (corked_)
+    set_corked(false);
+
+  // in lazy mode a client may have connected, and be waiting for the lock message of this task
+  // to close, without this node ever using it. take its connection for the lock message
+  for (int i = 0; i < lazy_peers_.size(); i++) {
+    lazy_peer& lazy = *lazy_peers_[i];
+    // a connector waiting for the peer takes it itself, or gives up on server->stop below
+    std::unique_lock<std::mutex> lck(lazy.mtx, std::try_to_lock);
+    if (lck.owns_lock() && !lazy.ready && lazy.server_index < 0 && server != nullptr) {
+      shared_ptr<Connection> conn = accepted_connection(lazy.node_id, 0);
+      if (conn != nullptr) {
+        add_connection(lazy.node_id, conn);
+        lazy.ready = true;
+      }
+    }
+  }
+
   vector<thread> client_threads(clients.size());
   auto client_f = [&](shared_ptr<TCPClient> client) -> void {
     client->close();
@@ -39,6 +64,10 @@ void BasicIO::close() {
 
   if (server != nullptr)
     server->stop();
+  for (int i = 0; i < lazy_peers_.size(); i++) {
+    if (lazy_peers_[i]->connector.joinable())
+      lazy_peers_[i]->connector.join();
+  }
 }
 
 BasicIO::~BasicIO() {
@@ -49,23 +78,30 @@ BasicIO::BasicIO(const string& task_id, const NodeInfo &node_id, const vector<No
   : task_id_(task_id), node_info_(node_id), client_infos_(client_infos), server_infos_(server_infos), handler(error_callback), channel_config_(channel_config) {}
 
 bool BasicIO::init() {
+  // the timeouts, the connect mode and the send tuning all come from it
+  if (channel_config_ == nullptr) {
+    log_error << "task " << task_id_ << " has no channel config";
+    return false;
+  }
 
   init_inner();
 
+  // applies to the reactor, send and receive threads started from now on
+  netutil::set_io_thread_affinity(channel_config_->io_affinity_);
+  Socket::set_keep_connections(channel_config_->keep_connections_);
+
   vector<string> expected_cids;
   for (int i = 0; i < client_infos_.size(); i++)
   {
     log_debug << node_info_.id << " expected cids:" << client_infos_[i].id ;
     expected_cids.push_back(client_infos_[i].id);
   }
-  std::set<string> cid_set(expected_cids.begin(), expected_cids.end());
 
   vector<string> expected_sids;
   for (int i = 0; i < server_infos_.size(); i++) {
     log_debug << node_info_.id << " expected sids:" << server_infos_[i].id ;
     expected_sids.push_back(server_infos_[i].id);
   }
-  std::set<string> sid_set(expected_sids.begin(), expected_sids.end());
   std::vector<string> expected_ids(expected_sids.begin(), expected_sids.end());
   expected_ids.insert(expected_ids.end(), expected_cids.begin(), expected_cids.end());
 
@@ -84,91 +120,661 @@ bool BasicIO::init() {
   if (!server->start(task_id_, node_info_.port, handler))
     return false;
 
-  // init clients, each have parties's clients. one which i==node_id is not use
+  // connect to the servers all at once, then take the connections of the clients,
+  // which the reactor has accepted meanwhile. in lazy mode only to the prewarmed peers,
+  // to the others on first use
   /////////////////////////////////////////////////////
-  vector<thread> client_threads(server_infos_.size() + client_infos_.size());
+  auto beg = chrono::steady_clock::now();
+  for (int i = 0; i < expected_ids.size(); i++) {
+    connection_map.insert(std::pair<string, shared_ptr<Connection>>(expected_ids[i], nullptr));
+  }
+  auto eager = [&](const string& peer) {
+    return channel_config_->is_eager(node_info_.id, peer);
+  };
 
   bool init_client_ok = true;
-  auto conn_f = [&](const string &i, int j) -> bool {
-    if (sid_set.find(i) != sid_set.end()) {
-      log_debug << node_info_.id <<" start to connect to " << i ;
-      shared_ptr<TCPClient> client = nullptr;
-      if (is_ssl_io_)
-        client = make_shared<SSLClient>(task_id_, i, server_infos_[j].address, server_infos_[j].port);
-      else
-        client = make_shared<TCPClient>(task_id_, i, server_infos_[j].address, server_infos_[j].port);
-
-      client->setcid(node_info_.id);
-      client->setsid(i);
-      client->setsslid(node_info_.id);
-      {
-        unique_lock<mutex> lck(clients_mtx_);
-        clients.insert(std::pair<string, shared_ptr<TCPClient>>(i, client));
-      }
-      if (!client->connect(channel_config_->connect_timeout_, channel_config_->connect_retries_)) {
-        init_client_ok = false;
-        return false;
-      }
 
-      // and connection to connection map
-      {
-        shared_ptr<Connection> conn = clients[i]->get_connection() ;
-        connection_map[i] = conn;
-        if (clients[i]->is_first_connect()) {
-          server->add_connection_to_epoll(connection_map[i]);
-        }
-        if (conn == nullptr) {
-          log_error << "client get null connection " << i ;
-        }
-      }
+  vector<TCPClient*> to_connect;
+  vector<string> to_connect_sids;
+  for (int j = 0; j < expected_sids.size(); j++) {
+    if (!eager(expected_sids[j]))
+      continue;
+    log_debug << node_info_.id <<" start to connect to " << expected_sids[j] ;
+    to_connect.push_back(new_client(j).get());
+    to_connect_sids.push_back(expected_sids[j]);
+  }
+  if (!TCPClient::connect_all(to_connect, channel_config_->connect_timeout_, channel_config_->connect_retries_)) {
+    init_client_ok = false;
+  }
+  for (int j = 0; j < to_connect.size(); j++) {
+    shared_ptr<Connection> conn = client_connection(to_connect_sids[j], to_connect[j]);
+    if (conn != nullptr)
+      add_connection(to_connect_sids[j], conn);
+  }
+
+  for (int j = 0; j < expected_cids.size(); j++) {
+    const string& i = expected_cids[j];
+    if (!eager(i))
+      continue;
+    // as long as the clients keep trying. even if init failed, take the clients already accepted,
+    // as they wait for the lock message of this task when closing
+    int64_t timeout = (int64_t)channel_config_->connect_timeout_ * channel_config_->connect_retries_;
+    timeout -= chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - beg).count();
+    if (!init_client_ok)
+      timeout = 0;
+    shared_ptr<Connection> conn = accepted_connection(i, std::max<int64_t>(timeout, 0));
+    if (conn == nullptr) {
+      init_client_ok = false;
+      continue;
     }
-    else if (cid_set.find(i) != cid_set.end()){
-      while (server->put_connection(i) == false) {
-        usleep(2000);
-      }
-      log_debug << node_info_.id << " waited to be connected by " << i ;
-      
-      // and connection to connection map
-      {
-        shared_ptr<Connection> conn = server->get_connection(i);
-        if (conn == nullptr) {
-          log_error << "server get null connection " << i ;
-        }
-        connection_map[i] = conn;
+    add_connection(i, conn);
+  }
+
+  if (!init_client_ok)
+    return false;
+
+  for (auto iter = connection_map.begin(); iter != connection_map.end(); iter++) {
+    peer_handles_[iter->first] = peers_.size();
+    peers_.push_back(&iter->second);
+  }
+  handle_slots_.resize(peers_.size());
+  if (channel_config_->lazy_connect_) {
+    for (auto iter = connection_map.begin(); iter != connection_map.end(); iter++) {
+      lazy_peers_.push_back(unique_ptr<lazy_peer>(new lazy_peer()));
+      lazy_peer& peer = *lazy_peers_.back();
+      peer.node_id = iter->first;
+      for (int j = 0; j < expected_sids.size(); j++) {
+        if (expected_sids[j] == iter->first)
+          peer.server_index = j;
       }
+      peer.ready = iter->second != nullptr;
     }
-    return true;
-  };
-   
-  for (int i = 0; i < expected_ids.size(); i++) {
-     connection_map.insert(std::pair<string, shared_ptr<Connection>>(expected_ids[i], nullptr));
-   }
-  for (int i = 0; i < expected_ids.size(); i++) {
-    client_threads[i] = thread(conn_f, expected_ids[i], i);
   }
+  return true;
+}
 
-  for (int i = 0; i < expected_ids.size(); i++) {
-    client_threads[i].join();
+shared_ptr<TCPClient> BasicIO::new_client(int server_index) {
+  const NodeInfo& info = server_infos_[server_index];
+  shared_ptr<TCPClient> client = nullptr;
+  if (is_ssl_io_)
+    client = make_shared<SSLClient>(task_id_, info.id, info.address, info.port);
+  else
+    client = make_shared<TCPClient>(task_id_, info.id, info.address, info.port);
+
+  client->setcid(node_info_.id);
+  client->setsid(info.id);
+  client->setsslid(node_info_.id);
+  {
+    unique_lock<mutex> lck(clients_mtx_);
+    clients.insert(std::pair<string, shared_ptr<TCPClient>>(info.id, client));
   }
+  return client;
+}
 
-  if (!init_client_ok)
+shared_ptr<Connection> BasicIO::client_connection(const string& sid, TCPClient* client) {
+  shared_ptr<Connection> conn = client->get_connection();
+  if (conn == nullptr) {
+    log_error << "client get null connection " << sid ;
+    return nullptr;
+  }
+  if (client->is_first_connect()) {
+    server->add_connection_to_epoll(conn);
+    const connect_timing& timing = client->timing();
+    conn->stat_.connect_attempts += timing.attempts;
+    conn->stat_.connect_us += timing.ready_us;
+    log_debug << node_info_.id << " connected to " << sid << " in " << timing.attempts << " attempts, tcp "
+             << timing.connected_us << "us, ack " << timing.acked_us << "us, ready " << timing.ready_us << "us";
+  }
+  return conn;
+}
+
+shared_ptr<Connection> BasicIO::accepted_connection(const string& cid, int64_t timeout) {
+  if (!server->wait_connection(cid, timeout))
+    return nullptr;
+  log_debug << node_info_.id << " waited to be connected by " << cid ;
+
+  shared_ptr<Connection> conn = server->get_connection(cid);
+  if (conn == nullptr) {
+    log_error << "server get null connection " << cid ;
+  }
+  return conn;
+}
+
+void BasicIO::add_connection(const string& node_id, const shared_ptr<Connection>& conn) {
+  std::unique_lock<std::mutex> lck(connection_map_mtx_);
+  conn->set_coalescing(task_id_, channel_config_->coalesce_us_, channel_config_->coalesce_bytes_);
+  for (auto iter = handlers_.begin(); iter != handlers_.end(); iter++) {
+    conn->on_message(task_id_, iter->first, iter->second);
+  }
+  for (int i = 0; i < purged_prefixes_.size(); i++) {
+    conn->purge(task_id_, purged_prefixes_[i], true);
+  }
+  connection_map[node_id] = conn;
+}
+
+bool BasicIO::connect_peer(int peer) {
+  lazy_peer& lazy = *lazy_peers_[peer];
+  std::unique_lock<std::mutex> lck(lazy.mtx);
+  if (lazy.ready)
+    return true;
+  auto beg = chrono::steady_clock::now();
+  shared_ptr<Connection> conn = nullptr;
+  if (lazy.server_index >= 0) {
+    shared_ptr<TCPClient> client = new_client(lazy.server_index);
+    if (client->connect(channel_config_->connect_timeout_, channel_config_->connect_retries_))
+      conn = client_connection(lazy.node_id, client.get());
+  } else {
+    // until the peer uses this node too
+    conn = accepted_connection(lazy.node_id, (int64_t)channel_config_->connect_timeout_ * channel_config_->connect_retries_);
+  }
+  if (conn == nullptr) {
+    std::unique_lock<std::mutex> deferred_lck(lazy.deferred_mtx);
+    log_error << task_id_ << " " << node_info_.id << " can not connect with " << lazy.node_id << ", dropped "
+              << lazy.deferred.size() << " deferred messages";
+    for (int i = 0; i < lazy.deferred.size(); i++)
+      lazy.deferred[i].frame->set_error(E_UNCONNECTED);
+    lazy.deferred.clear();
     return false;
-  
+  }
+  add_connection(lazy.node_id, conn);
+  {
+    // the deferred messages go first, before the callers seeing ready send directly
+    std::unique_lock<std::mutex> deferred_lck(lazy.deferred_mtx);
+    for (int i = 0; i < lazy.deferred.size(); i++)
+      conn->send_frame(lazy.deferred[i].frame, lazy.deferred[i].length, lazy.deferred[i].priority, corked_);
+    lazy.deferred.clear();
+    lazy.ready = true;
+  }
+  log_debug << task_id_ << " " << node_info_.id << " connected with " << lazy.node_id << " on first use in "
+            << chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - beg).count() << "us";
   return true;
 }
 
+bool BasicIO::defer(int peer, const shared_ptr<simple_buffer>& frame, const string& id, const char* data, uint64_t length, int priority) {
+  if (lazy_peers_.empty() || peer < 0 || peer >= peers_.size())
+    return false;
+  lazy_peer& lazy = *lazy_peers_[peer];
+  if (lazy.ready || lazy.server_index >= 0)
+    return false;
+  std::unique_lock<std::mutex> lck(lazy.deferred_mtx);
+  if (lazy.ready)
+    return false;
+  shared_ptr<simple_buffer> deferred = frame;
+  if (deferred == nullptr) {
+    deferred = make_shared<simple_buffer>(id, length);
+    memcpy(deferred->payload(), data, length);
+  }
+  lazy.deferred.push_back(lazy_peer::deferred_frame{deferred, length, priority});
+  if (!lazy.connecting) {
+    // a connector of an earlier failed wait is done but for returning
+    if (lazy.connector.joinable())
+      lazy.connector.join();
+    lazy.connecting = true;
+    lazy.connector = thread([this, peer]() {
+      connect_peer(peer);
+      lazy_peer& lazy = *lazy_peers_[peer];
+      std::unique_lock<std::mutex> lck(lazy.deferred_mtx);
+      lazy.connecting = false;
+    });
+  }
+  return true;
+}
+
+Connection* BasicIO::connection(int peer, bool connect) {
+  if (peer < 0 || peer >= peers_.size())
+    return nullptr;
+  if (!lazy_peers_.empty() && !lazy_peers_[peer]->ready) {
+    if (!connect || !connect_peer(peer))
+      return nullptr;
+  }
+  return peers_[peer]->get();
+}
+
+Connection* BasicIO::connection(const string& node_id, bool connect) {
+  return connection(resolve_peer(node_id), connect);
+}
+
 ssize_t BasicIO::recv(const string& node_id, char* data, uint64_t length, const string& id, int64_t timeout) {
   if (server->stoped())
     throw socket_exp("m server->stoped()");
-  ssize_t ret = connection_map[node_id]->recv(id, data, length, timeout);
+  Connection* conn = connection(node_id);
+  if (conn == nullptr)
+    return E_UNCONNECTED;
+  ssize_t ret = conn->recv(id, data, length, timeout);
   return ret;
 }
 
 ssize_t BasicIO::send(const string& node_id, const char* data, uint64_t length, const string& id, int64_t timeout) {
-  ssize_t ret = connection_map[node_id]->send(id, data, length, timeout);
+  return send(node_id, data, length, id, timeout, get_priority(id));
+}
+
+ssize_t BasicIO::send(const string& node_id, const char* data, uint64_t length, const string& id, int64_t timeout, int priority) {
+  int peer = resolve_peer(node_id);
+  if (defer(peer, nullptr, id, data, length, priority))
+    return length;
+  Connection* conn = connection(peer);
+  if (conn == nullptr)
+    return E_UNCONNECTED;
+  ssize_t ret = conn->send(id, data, length, timeout, priority, corked_);
+  return ret;
+}
+
+void BasicIO::set_priority(const string& id, int priority) {
+  {
+    std::unique_lock<std::mutex> lck(priorities_mtx_);
+    auto old = priorities_.find(id);
+    if ((old == priorities_.end() ? MSG_PRIORITY_BULK : old->second) == priority) {
+      return;
+    }
+    if (priority == MSG_PRIORITY_BULK) {
+      priorities_.erase(id);
+    } else {
+      priorities_[id] = priority;
+    }
+    auto iter = message_handles_.find(id);
+    if (iter != message_handles_.end()) {
+      handle_priorities_[iter->second] = priority;
+    }
+  }
+  // the messages of id queued in the old class must go out before the later ones
+  flush();
+}
+
+const int BasicIO::max_message_handles_;
+
+int BasicIO::resolve_peer(const string& node_id) {
+  auto iter = peer_handles_.find(node_id);
+  return iter == peer_handles_.end() ? -1 : iter->second;
+}
+
+int BasicIO::register_id(const string& id) {
+  std::unique_lock<std::mutex> lck(priorities_mtx_);
+  auto iter = message_handles_.find(id);
+  if (iter != message_handles_.end()) {
+    return iter->second;
+  }
+  int handle = message_handle_count_;
+  if (handle == max_message_handles_) {
+    log_error << task_id_ << " can not register more than " << max_message_handles_ << " message ids";
+    return -1;
+  }
+  if (handle_ids_ == nullptr) {
+    handle_ids_.reset(new string[max_message_handles_]);
+    handle_priorities_.reset(new std::atomic<int>[max_message_handles_]);
+  }
+  handle_ids_[handle] = id;
+  auto priority = priorities_.find(id);
+  handle_priorities_[handle] = priority == priorities_.end() ? MSG_PRIORITY_BULK : priority->second;
+  message_handles_[id] = handle;
+  message_handle_count_ = handle + 1;
+  return handle;
+}
+
+ssize_t BasicIO::send(int peer, int msg, const char* data, uint64_t length) {
+  if (peer < 0 || peer >= peers_.size() || msg < 0 || msg >= message_handle_count_)
+    return -1;
+  if (defer(peer, nullptr, handle_ids_[msg], data, length, handle_priorities_[msg]))
+    return length;
+  Connection* conn = connection(peer);
+  if (conn == nullptr)
+    return E_UNCONNECTED;
+  return conn->send(handle_ids_[msg], data, length, -1L, handle_priorities_[msg], corked_);
+}
+
+ssize_t BasicIO::recv(int peer, int msg, char* data, uint64_t length, int64_t timeout) {
+  if (server->stoped())
+    throw socket_exp("m server->stoped()");
+  if (peer < 0 || peer >= peers_.size() || msg < 0 || msg >= message_handle_count_)
+    return -1;
+  Connection* conn = connection(peer);
+  if (conn == nullptr)
+    return E_UNCONNECTED;
+  return conn->recv(handle_slots_[peer], msg, handle_ids_[msg], data, length, timeout);
+}
+
+int BasicIO::get_priority(const string& id) {
+  std::unique_lock<std::mutex> lck(priorities_mtx_);
+  auto iter = priorities_.find(id);
+  return iter == priorities_.end() ? MSG_PRIORITY_BULK : iter->second;
+}
+
+ssize_t BasicIO::recv_message(const string& node_id, string& data, const string& id, int64_t timeout) {
+  if (server->stoped())
+    throw socket_exp("m server->stoped()");
+  Connection* conn = connection(node_id);
+  if (conn == nullptr)
+    return E_UNCONNECTED;
+  return conn->recv_message(id, data, timeout);
+}
+
+ssize_t BasicIO::probe(const string& node_id, const string& id, int64_t timeout) {
+  if (server->stoped())
+    throw socket_exp("m server->stoped()");
+  Connection* conn = connection(node_id);
+  if (conn == nullptr)
+    return E_UNCONNECTED;
+  return conn->probe(id, timeout);
+}
+
+void BasicIO::recv_async(const string& node_id, char* data, uint64_t length, const string& id, std::function<void(ssize_t)> done) {
+  if (server->stoped())
+    throw socket_exp("m server->stoped()");
+  Connection* conn = connection(node_id);
+  if (conn == nullptr) {
+    done(E_UNCONNECTED);
+    return;
+  }
+  conn->recv_async(id, data, length, done);
+}
+
+void BasicIO::post_recv(const string& node_id, char* data, uint64_t length, const string& id, std::function<void(ssize_t)> done) {
+  if (server->stoped())
+    throw socket_exp("m server->stoped()");
+  Connection* conn = connection(node_id);
+  if (conn == nullptr) {
+    done(E_UNCONNECTED);
+    return;
+  }
+  conn->post_recv(id, data, length, done);
+}
+
+ssize_t BasicIO::broadcast(const vector<string>& node_ids, const char* data, uint64_t length, const string& id) {
+  shared_ptr<simple_buffer> frame = make_shared<simple_buffer>(id, length);
+  memcpy(frame->payload(), data, length);
+
+  int priority = get_priority(id);
+  ssize_t ret = length;
+  for (int i = 0; i < node_ids.size(); i++) {
+    int peer = resolve_peer(node_ids[i]);
+    if (defer(peer, frame, id, data, length, priority))
+      continue;
+    Connection* conn = connection(peer);
+    if (conn == nullptr || conn->send_frame(frame, length, priority, corked_) < 0) {
+      ret = -1;
+    }
+  }
   return ret;
 }
 
+ssize_t BasicIO::recv_first_k(const vector<string>& node_ids, char* data, uint64_t length, const string& id, int k, int* which) {
+  if (server->stoped())
+    throw socket_exp("m server->stoped()");
+  if (k <= 0 || k > node_ids.size())
+    return -1;
+
+  struct race {
+    std::mutex mtx;
+    std::condition_variable cv;
+    int claimed = 0;
+    int completed = 0;
+    int failed = 0;
+    ssize_t error = 0;
+    bool canceled = false;
+  };
+  int n = node_ids.size();
+  vector<Connection*> conns(node_ids.size());
+  for (int i = 0; i < node_ids.size(); i++) {
+    conns[i] = connection(node_ids[i]);
+    if (conns[i] == nullptr)
+      return E_UNCONNECTED;
+  }
+
+  shared_ptr<race> state = make_shared<race>();
+  vector<shared_ptr<recv_waiter>> waiters(node_ids.size());
+  for (int i = 0; i < node_ids.size(); i++) {
+    waiters[i] = make_shared<recv_waiter>();
+    waiters[i]->length = length;
+    // called under the lock of the connection which has the message,
+    // the first k get a block of data, the others leave the message in place
+    waiters[i]->claim = [state, data, length, k, which, i]() -> char* {
+      std::unique_lock<std::mutex> lck(state->mtx);
+      if (state->claimed == k) {
+        return nullptr;
+      }
+      which[state->claimed] = i;
+      return data + (state->claimed++) * length;
+    };
+    waiters[i]->done = [state](ssize_t ret) {
+      std::unique_lock<std::mutex> lck(state->mtx);
+      if (ret == E_CANCELED) {
+        state->canceled = true;
+      } else if (ret < 0) {
+        // the peer went away, the others may still make k
+        state->failed++;
+        state->error = ret;
+      } else {
+        state->completed++;
+      }
+      state->cv.notify_one();
+    };
+  }
+
+  for (int i = 0; i < node_ids.size(); i++) {
+    conns[i]->post_waiter(id, waiters[i]);
+  }
+  {
+    std::unique_lock<std::mutex> lck(state->mtx);
+    state->cv.wait(lck, [&]() { return state->completed == k || state->canceled || state->failed > n - k; });
+  }
+  for (int i = 0; i < node_ids.size(); i++) {
+    conns[i]->cancel_waiter(id, waiters[i]);
+  }
+  std::unique_lock<std::mutex> lck(state->mtx);
+  if (state->completed == k)
+    return k * length;
+  return state->canceled ? E_CANCELED : state->error;
+}
+
+ssize_t BasicIO::send_frame(const string& node_id, const shared_ptr<simple_buffer>& frame, uint64_t length, const string& id) {
+  int peer = resolve_peer(node_id);
+  int priority = get_priority(id);
+  if (defer(peer, frame, id, nullptr, length, priority))
+    return length;
+  Connection* conn = connection(peer);
+  if (conn == nullptr)
+    return E_UNCONNECTED;
+  return conn->send_frame(frame, length, priority, corked_);
+}
+
+void BasicIO::sendv(map<string, vector<msg_desc>>& msgs) {
+  for (auto iter = msgs.begin(); iter != msgs.end(); iter++) {
+    int peer = resolve_peer(iter->first);
+    int deferred = 0;
+    for (; deferred < iter->second.size(); deferred++) {
+      msg_desc& msg = iter->second[deferred];
+      if (!defer(peer, nullptr, msg.id, msg.data, msg.length, get_priority(msg.id)))
+        break;
+      msg.result = msg.length;
+    }
+    if (deferred > 0) {
+      // the connection got ready in between, the rest goes directly in order
+      for (int i = deferred; i < iter->second.size(); i++) {
+        msg_desc& msg = iter->second[i];
+        Connection* conn = connection(peer);
+        msg.result = conn == nullptr ? E_UNCONNECTED : conn->send(msg.id, msg.data, msg.length, -1L, get_priority(msg.id), corked_);
+      }
+      continue;
+    }
+    Connection* conn = connection(peer);
+    if (conn == nullptr) {
+      for (int i = 0; i < iter->second.size(); i++)
+        iter->second[i].result = E_UNCONNECTED;
+      continue;
+    }
+    // urgent messages go one by one, ahead of the bulk batch
+    vector<msg_desc> bulk;
+    vector<int> bulk_index;
+    for (int i = 0; i < iter->second.size(); i++) {
+      msg_desc& msg = iter->second[i];
+      int priority = get_priority(msg.id);
+      if (priority == MSG_PRIORITY_BULK) {
+        bulk.push_back(msg);
+        bulk_index.push_back(i);
+      } else {
+        msg.result = conn->send(msg.id, msg.data, msg.length, -1L, priority, corked_);
+      }
+    }
+    if (bulk.size() == iter->second.size()) {
+      conn->sendv(iter->second, corked_);
+      continue;
+    }
+    conn->sendv(bulk, corked_);
+    for (int j = 0; j < bulk.size(); j++) {
+      iter->second[bulk_index[j]].result = bulk[j].result;
+    }
+  }
+}
+
+void BasicIO::recvv(map<string, vector<msg_desc>>& msgs) {
+  if (server->stoped())
+    throw socket_exp("m server->stoped()");
+
+  // one wakeup per connection, the caller sleeps until the last one
+  std::mutex mtx;
+  std::condition_variable cv;
+  int pending = msgs.size();
+  for (auto iter = msgs.begin(); iter != msgs.end(); iter++) {
+    // in lazy mode this waits at most the connect timeout for the peer
+    Connection* conn = connection(iter->first);
+    if (conn == nullptr) {
+      for (int i = 0; i < iter->second.size(); i++)
+        iter->second[i].result = E_UNCONNECTED;
+      std::unique_lock<std::mutex> lck(mtx);
+      pending--;
+      continue;
+    }
+    conn->recvv(iter->second, [&]() {
+      std::unique_lock<std::mutex> lck(mtx);
+      if (--pending == 0) {
+        cv.notify_one();
+      }
+    });
+  }
+  std::unique_lock<std::mutex> lck(mtx);
+  cv.wait(lck, [&]() { return pending == 0; });
+}
+
+NetStat BasicIO::get_stat(const string& node_id) {
+  Connection* conn = connection(node_id, false);
+  if (conn == nullptr) {
+    return NetStat();
+  }
+  return NetStat(conn->stat_);
+}
+
+int BasicIO::expect(const string& node_id, const string& id, uint64_t length, char* data) {
+  Connection* conn = connection(node_id);
+  if (conn == nullptr) {
+    return -1;
+  }
+  conn->expect(id, length, data);
+  return 0;
+}
+
+ssize_t BasicIO::cancel(const string& node_id, const string& id) {
+  if (resolve_peer(node_id) < 0) {
+    return -1;
+  }
+  // nothing to drop if not connected yet
+  Connection* conn = connection(node_id, false);
+  return conn == nullptr ? 0 : conn->cancel(id);
+}
+
+vector<Connection*> BasicIO::connected() {
+  vector<Connection*> conns;
+  for (auto iter = connection_map.begin(); iter != connection_map.end(); iter++) {
+    if (iter->second != nullptr) {
+      conns.push_back(iter->second.get());
+    }
+  }
+  return conns;
+}
+
+ssize_t BasicIO::purge(const string& prefix, bool drop_later) {
+  vector<Connection*> conns;
+  {
+    std::unique_lock<std::mutex> lck(connection_map_mtx_);
+    if (drop_later && std::find(purged_prefixes_.begin(), purged_prefixes_.end(), prefix) == purged_prefixes_.end()) {
+      purged_prefixes_.push_back(prefix);
+    }
+    conns = connected();
+  }
+  ssize_t dropped = 0;
+  for (int i = 0; i < conns.size(); i++) {
+    dropped += conns[i]->purge(task_id_, prefix, drop_later);
+  }
+  log_debug << task_id_ << " purge drops " << dropped << " bytes";
+  return dropped;
+}
+
+int BasicIO::on_message(const string& node_id, const string& prefix, message_handler handler) {
+  if (node_id.empty()) {
+    vector<Connection*> conns;
+    {
+      std::unique_lock<std::mutex> lck(connection_map_mtx_);
+      if (handler == nullptr) {
+        handlers_.erase(prefix);
+      } else {
+        handlers_[prefix] = handler;
+      }
+      conns = connected();
+    }
+    bool ok = true;
+    for (int i = 0; i < conns.size(); i++) {
+      ok = conns[i]->on_message(task_id_, prefix, handler) && ok;
+    }
+    return ok ? 0 : -1;
+  }
+  Connection* conn = connection(node_id);
+  if (conn == nullptr) {
+    return -1;
+  }
+  return conn->on_message(task_id_, prefix, handler) ? 0 : -1;
+}
+
+void BasicIO::set_corked(bool corked) {
+  vector<Connection*> conns;
+  {
+    std::unique_lock<std::mutex> lck(connection_map_mtx_);
+    corked_ = corked;
+    conns = connected();
+  }
+  // the sends of this task read corked_, only what it queued so far is let go here
+  if (!corked) {
+    for (int i = 0; i < conns.size(); i++) {
+      conns[i]->uncork();
+    }
+  }
+}
+
+void BasicIO::flush() {
+  // the connections do not change after init unless lazy
+  if (lazy_peers_.empty()) {
+    for (auto iter = connection_map.begin(); iter != connection_map.end(); iter++) {
+      if (iter->second != nullptr) {
+        iter->second->flush();
+      }
+    }
+    return;
+  }
+  vector<Connection*> conns;
+  {
+    std::unique_lock<std::mutex> lck(connection_map_mtx_);
+    conns = connected();
+  }
+  for (int i = 0; i < conns.size(); i++) {
+    conns[i]->flush();
+  }
+}
+
+TimingStat BasicIO::get_queue_delay(const string& node_id, int priority) {
+  Connection* conn = connection(node_id, false);
+  if (conn == nullptr) {
+    return TimingStat();
+  }
+  return conn->get_queue_delay(priority);
+}
+
 
 } // namespace io
 } // namespace rosetta
@@ -16,9 +16,11 @@
 // along with the Rosetta library. If not, see <http://www.gnu.org/licenses/>.
 // ==============================================================================
 #include "io/internal/server.h"
+#include "io/internal/netutil.h"
 #include <chrono>
 #include <iostream>
 #include <errno.h>
+#include <sys/eventfd.h>
 #include <algorithm>
 using namespace std;
 using namespace std::chrono;
@@ -32,10 +34,12 @@ std::vector<shared_ptr<Connection>> TCPServer::recycle_connections_;
 int TCPServer::task_count_ = 0;
 std::mutex TCPServer::task_mtx_;
 std::condition_variable TCPServer::task_cv_;
+std::condition_variable TCPServer::accept_cv_;
 bool TCPServer::stoped_ = true;
 Connection* TCPServer::listen_conn_ = nullptr;
 int TCPServer::epollfd_ = -1;
 int TCPServer::listenfd_ = -1;
+int TCPServer::wakefd_ = -1;
 int TCPServer::port_ = -1;
 bool TCPServer::is_inited_ = false;
 std::mutex TCPServer::init_mutex_;
@@ -52,25 +56,48 @@ shared_ptr<Connection> TCPServer::get_connection(const string& node_id) {
   return nullptr;
 }
 
-bool TCPServer::put_connection(const string& node_id) {
-  shared_ptr<Connection> conn = find_connection(node_id);
-  if (conn != nullptr) {
-    if (conn->is_reuseable()) {
-      std::unique_lock<std::mutex> lck(server_connection_mtx_);
-      server_connections_.insert(std::pair<string, shared_ptr<Connection>>(node_id, conn));
-      return true;
+/**
+ * Sleep until handle_accept registers the connection of client cid, and take it for this task.
+ */
+bool TCPServer::wait_connection(const string& cid, int64_t timeout) {
+  shared_ptr<Connection> conn = nullptr;
+  {
+    unique_lock<mutex> lck(connections_mtx_);
+    auto arrived = [&]() {
+      auto iter = connections_.find(cid);
+      if (iter != connections_.end() && iter->second->is_reuseable() && iter->second->is_alive()) {
+        conn = iter->second;
+        return true;
+      }
+      return stop_ != 0;
+    };
+    if (timeout < 0) {
+      accept_cv_.wait(lck, arrived);
+    } else if (!accept_cv_.wait_for(lck, chrono::milliseconds(timeout), arrived)) {
+      if (timeout > 0) {
+        log_error << task_id_ << " client " << cid << " did not connect in " << timeout << "ms";
+      }
+      return false;
+    }
+    if (conn == nullptr) {
+      return false;
     }
+    conn->start(task_id_);
   }
-  return false;
+  std::unique_lock<std::mutex> lck(server_connection_mtx_);
+  server_connections_.insert(std::pair<string, shared_ptr<Connection>>(cid, conn));
+  return true;
 }
-shared_ptr<Connection> TCPServer::find_connection(const string& cid) {
+
+//! every expected client has a connection
+bool TCPServer::all_connected() {
   unique_lock<mutex> lck(connections_mtx_);
-  auto iter = connections_.find(cid);
-  if (iter == connections_.end() || !iter->second->is_reuseable()) {
-    return nullptr;
+  for (int i = 0; i < expected_cids_.size(); i++) {
+    if (connections_.find(expected_cids_[i]) == connections_.end()) {
+      return false;
+    }
   }
-  iter->second->start(task_id_);
-  return iter->second;
+  return true;
 }
 uint64_t TCPServer::get_unrecv_size() {
   unique_lock<mutex> lck(connections_mtx_);
@@ -220,6 +247,7 @@ void TCPServer::handle_accept(Connection* conn) {
     tc = new Connection(cfd, EPOLL_EVENTS, true, cid);
 
   tc->ctx_ = ctx_;
+  tc->epollfd_ = epollfd_;
 
   set_nonblocking(cfd, true);
   {
@@ -232,7 +260,9 @@ void TCPServer::handle_accept(Connection* conn) {
     }
     connections_.insert(std::pair<string, shared_ptr<Connection>>(cid, shared_ptr<Connection>(tc)));
     log_debug << "server create connection ok " << cid;
+    accept_cv_.notify_all();
   }
+  accepted_ = true;
   epoll_add(epollfd_, tc);
   epoll_mod(epollfd_, listen_conn_);
 }
@@ -241,6 +271,7 @@ void TCPServer::add_connection_to_epoll(shared_ptr<Connection> conn) {
   conn->ctx_ = ctx_;
   set_nonblocking(conn->fd_, true);
   conn->events_ = EPOLL_EVENTS;
+  conn->epollfd_ = epollfd_;
   epoll_add(epollfd_, conn.get());
 }
 
@@ -273,7 +304,7 @@ void TCPServer::handle_error(Connection* conn) {
   }
 }
 
-void TCPServer::handle_write(Connection* conn) { cout << __FUNCTION__ << endl; }
+void TCPServer::handle_write(Connection* conn) { conn->on_writable(); }
 
 void TCPServer::handle_read(Connection* conn) {
   if (conn->fd_ == listenfd_) {
@@ -330,15 +361,25 @@ void TCPServer::loop_once(int efd, int waitms) {
 
   timeout_counter = 0;
   for (int i = 0; i < nfds; i++) {
+    if (activeEvs[i].data.ptr == &wakefd_) {
+      // a task is stopping, the loop checks stop_ again
+      uint64_t count = 0;
+      ssize_t ret = ::read(wakefd_, &count, sizeof(count));
+      (void)ret;
+      continue;
+    }
     Connection* conn = (Connection*)activeEvs[i].data.ptr;
     int events = activeEvs[i].events;
 
     if (events & EPOLLERR) {
       handle_error(conn);
-    } else if (events & EPOLLIN) {
-      handle_read(conn);
-    } else if (events & EPOLLOUT) {
-      handle_write(conn);
+    } else if (events & (EPOLLIN | EPOLLOUT)) {
+      if (events & EPOLLOUT) {
+        handle_write(conn);
+      }
+      if (events & EPOLLIN) {
+        handle_read(conn);
+      }
     } else {
       log_error << "unknown events " << events ;
     }
@@ -350,6 +391,7 @@ void TCPServer::loop() {
 }
 
 void TCPServer::loop_main() {
+  netutil::place_io_thread("io-reactor");
   // wait until no thread of other  tasks handles epoll events or this task finishes.
   {
     std::unique_lock<std::mutex> lck(listen_mutex_);
@@ -364,6 +406,7 @@ void TCPServer::loop_main() {
     }
     listen_count_++;
   }
+  Connection::reactors_++;
   log_debug << task_id_ << " begin loop epoll";
   int64_t timeout = -1;
   if (timeout < 0)
@@ -377,25 +420,18 @@ void TCPServer::loop_main() {
    * if timeout, break
    * if all has connected, break
    */
-  bool all_has_connected_to_server = true;
-  while (!stop_ && (elapsed <= timeout)) {
-    all_has_connected_to_server = true;
+  bool all_has_connected_to_server = all_connected();
+  while (!stop_ && !all_has_connected_to_server && (elapsed <= timeout)) {
+    // the clients are checked again only once one has been accepted
+    accepted_ = false;
     loop_once(epollfd_, 1000);
-    {
-      unique_lock<mutex> lck(connections_mtx_);
-      for (int i = 0; i < expected_cids_.size(); i++) {
-        auto iter = connections_.find(expected_cids_[i]);
-        if (iter == connections_.end()) {
-          all_has_connected_to_server = false;
-          break;
-        }
-      }
+    if (accepted_) {
+      all_has_connected_to_server = all_connected();
     }
-    if (all_has_connected_to_server)
-      break;
     auto end = system_clock::now();
     elapsed = duration_cast<duration<int64_t, std::milli>>(end - beg).count();
-    all_has_connected_to_server = false;
+  }
+  if (!all_has_connected_to_server) {
     log_debug << "server .... timeout:" << timeout << " elapsed:" << elapsed ;
   }
 
@@ -407,6 +443,7 @@ void TCPServer::loop_main() {
     log_debug << "client(s) connect to this server timeout, wait for closing..." ;
   }
 
+  Connection::reactors_--;
   // notify the listen thread of other tasks to handler epoll events
   {
     std::unique_lock<std::mutex> lck(listen_mutex_);
@@ -440,11 +477,26 @@ bool TCPServer::init() {
   // 4
   epoll_add(epollfd_, listen_conn_);
 
+  // 5
+  if ((wakefd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+    log_error << "eventfd failed. errno:" << errno << " " << strerror(errno) ;
+    return false;
+  }
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLL_EVENTS;
+  ev.data.ptr = &wakefd_;
+  if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, wakefd_, &ev) != 0) {
+    log_error << "epoll_ctl add wakefd failed. errno:" << errno << " " << strerror(errno) ;
+    return false;
+  }
+
   return true;
 }
 
 bool TCPServer::start(const string& task_id, int port, error_callback handler_, int64_t timeout) {
   task_id_ = task_id;
+  handler = handler_;
   std::unique_lock<std::mutex> lck(task_mtx_);
   task_count_++;
 
@@ -452,7 +504,6 @@ bool TCPServer::start(const string& task_id, int port, error_callback handler_,
     std::unique_lock<std::mutex> lck(init_mutex_);
     if (!is_inited_) {
       port_ = port;
-      handler = handler_;
       if (!init_ssl())
         return false;
     
@@ -478,6 +529,14 @@ bool TCPServer::stop() {
     std::unique_lock<std::mutex> lck(listen_mutex_);
     listen_cv_.notify_all();
   }
+  {
+    std::unique_lock<std::mutex> lck(connections_mtx_);
+    accept_cv_.notify_all();
+  }
+  // out of epoll_wait, instead of waiting for its timeout
+  uint64_t one = 1;
+  ssize_t ret = ::write(wakefd_, &one, sizeof(one));
+  (void)ret;
   loop_thread_.join();
 
   log_debug << task_id_ << "set stop true";
@@ -491,7 +550,7 @@ bool TCPServer::stop() {
   {
     std::unique_lock<std::mutex> lck(task_mtx_);
     task_count_--;
-    if (task_count_ == 0 && get_unrecv_size() == 0) {
+    if (task_count_ == 0 && get_unrecv_size() == 0 && !keep_connections_) {
       std::unique_lock<std::mutex> lck(connections_mtx_);
       for (auto& c : connections_) {
         if (c.second != nullptr) {
@@ -509,6 +568,8 @@ bool TCPServer::stop() {
       delete listen_conn_;
       listen_conn_ = nullptr;
       ::close(listenfd_);
+      ::close(wakefd_);
+      wakefd_ = -1;
 
       ::close(epollfd_);
       is_inited_ = false;
@@ -23,6 +23,8 @@
 namespace rosetta {
 namespace io {
 
+std::atomic<bool> Socket::keep_connections_{false};
+
 Socket::Socket() { default_buffer_size_ = 1024 * 1024 * 10; }
 
 std::string Socket::gethostip(std::string hostname) {
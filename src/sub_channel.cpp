@@ -0,0 +1,241 @@
+// ==============================================================================
+// Copyright 2020 The LatticeX Foundation
+// This file is part of the Rosetta library.
+//
+// The Rosetta library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The Rosetta library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the Rosetta library. If not, see <http://www.gnu.org/licenses/>.
+// ==============================================================================
+#include "io/internal/sub_channel.h"
+
+#include <stdio.h>
+using namespace std;
+
+namespace rosetta {
+namespace io {
+
+static void count_sent(NetStat_st& stat, int64_t length) {
+  if (length >= 0) {
+    stat.message_sent++;
+    stat.bytes_sent += length;
+  }
+}
+
+static void count_received(NetStat_st& stat, int64_t length) {
+  if (length >= 0) {
+    stat.message_received++;
+    stat.bytes_received += length;
+  }
+}
+
+SubChannel::SubChannel(IChannel* parent, const string& prefix, Releaser release)
+  : parent_(parent), prefix_(prefix), release_(release), stat_(make_shared<NetStat_st>()) {}
+
+SubChannel::~SubChannel() {
+  if (release_ != nullptr) {
+    release_(prefix_);
+  }
+}
+
+string SubChannel::task_prefix(const string& task_id) {
+  // FNV-1a, the same on every node, and short whatever the length of the task id
+  uint64_t hash = 14695981039346656037ULL;
+  for (int i = 0; i < task_id.size(); i++) {
+    hash ^= (unsigned char)task_id[i];
+    hash *= 1099511628211ULL;
+  }
+  // hex digits, so that it decodes like any message id
+  char buf[32];
+  snprintf(buf, sizeof(buf), "fffe%016llx", (unsigned long long)hash);
+  return buf;
+}
+
+string SubChannel::make_prefix(const string& parent_prefix, uint32_t k, uint32_t j) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "fffe%08x%08x", k, j);
+  return parent_prefix + buf;
+}
+
+int64_t SubChannel::Recv(const char* node_id, const char* id, char* data, uint64_t length, int64_t timeout) {
+  int64_t ret = parent_->Recv(node_id, with_prefix(id).c_str(), data, length, timeout);
+  count_received(*stat_, ret);
+  return ret;
+}
+
+int64_t SubChannel::Send(const char* node_id, const char* id, const char* data, uint64_t length, int64_t timeout) {
+  int64_t ret = parent_->Send(node_id, with_prefix(id).c_str(), data, length, timeout);
+  count_sent(*stat_, ret);
+  return ret;
+}
+
+int64_t SubChannel::Recv(int peer, int msg, char* data, uint64_t length, int64_t timeout) {
+  // the handle stands for the prefixed id already
+  int64_t ret = parent_->Recv(peer, msg, data, length, timeout);
+  count_received(*stat_, ret);
+  return ret;
+}
+
+int64_t SubChannel::Send(int peer, int msg, const char* data, uint64_t length) {
+  int64_t ret = parent_->Send(peer, msg, data, length);
+  count_sent(*stat_, ret);
+  return ret;
+}
+
+int64_t SubChannel::SendWithPriority(const char* node_id, const char* id, const char* data, uint64_t length, int priority) {
+  int64_t ret = parent_->SendWithPriority(node_id, with_prefix(id).c_str(), data, length, priority);
+  count_sent(*stat_, ret);
+  return ret;
+}
+
+void SubChannel::SetMessagePriority(const char* id, int priority) {
+  parent_->SetMessagePriority(with_prefix(id).c_str(), priority);
+}
+
+int64_t SubChannel::RecvMessage(const char* node_id, const char* id, string& data, int64_t timeout) {
+  int64_t ret = parent_->RecvMessage(node_id, with_prefix(id).c_str(), data, timeout);
+  count_received(*stat_, ret);
+  return ret;
+}
+
+int64_t SubChannel::Probe(const char* node_id, const char* id, int64_t timeout) {
+  return parent_->Probe(node_id, with_prefix(id).c_str(), timeout);
+}
+
+int SubChannel::Expect(const char* node_id, const char* id, uint64_t length, char* data) {
+  return parent_->Expect(node_id, with_prefix(id).c_str(), length, data);
+}
+
+int64_t SubChannel::Cancel(const char* node_id, const char* id) {
+  return parent_->Cancel(node_id, with_prefix(id).c_str());
+}
+
+int64_t SubChannel::PurgeTask(const char* task_id) {
+  return parent_->PurgeTask(with_prefix(task_id).c_str());
+}
+
+int SubChannel::OnMessage(const char* node_id, const char* id_prefix, MessageHandler handler) {
+  MessageHandler wrapped = nullptr;
+  if (handler != nullptr) {
+    shared_ptr<NetStat_st> stat = stat_;
+    size_t skip = prefix_.size();
+    wrapped = [stat, skip, handler](const char* node_id, const char* id, const char* data, uint64_t length) {
+      count_received(*stat, length);
+      handler(node_id, id + skip, data, length);
+    };
+  }
+  return parent_->OnMessage(node_id, with_prefix(id_prefix).c_str(), wrapped);
+}
+
+IORequestPtr SubChannel::RecvAsync(const char* node_id, const char* id, char* data, uint64_t length, IORequest::Callback callback) {
+  shared_ptr<NetStat_st> stat = stat_;
+  return parent_->RecvAsync(node_id, with_prefix(id).c_str(), data, length, [stat, callback](int64_t result) {
+    count_received(*stat, result);
+    if (callback != nullptr) {
+      callback(result);
+    }
+  });
+}
+
+vector<IORequestPtr> SubChannel::PostRecvs(MessageDesc* msgs, int count, IORequest::Callback callback) {
+  vector<string> ids(count);
+  vector<MessageDesc> prefixed(msgs, msgs + count);
+  for (int i = 0; i < count; i++) {
+    ids[i] = with_prefix(msgs[i].id);
+    prefixed[i].id = ids[i].c_str();
+  }
+  shared_ptr<NetStat_st> stat = stat_;
+  return parent_->PostRecvs(prefixed.data(), count, [stat, callback](int64_t result) {
+    count_received(*stat, result);
+    if (callback != nullptr) {
+      callback(result);
+    }
+  });
+}
+
+IORequestPtr SubChannel::SendAsync(const char* node_id, const char* id, const char* data, uint64_t length, IORequest::Callback callback) {
+  shared_ptr<NetStat_st> stat = stat_;
+  return parent_->SendAsync(node_id, with_prefix(id).c_str(), data, length, [stat, callback](int64_t result) {
+    count_sent(*stat, result);
+    if (callback != nullptr) {
+      callback(result);
+    }
+  });
+}
+
+int64_t SubChannel::Broadcast(const NodeIDVec* node_ids, const char* id, const char* data, uint64_t length) {
+  int64_t ret = parent_->Broadcast(node_ids, with_prefix(id).c_str(), data, length);
+  for (int i = 0; i < node_ids->node_count; i++) {
+    count_sent(*stat_, ret);
+  }
+  return ret;
+}
+
+int64_t SubChannel::RecvFirstK(const NodeIDVec* node_ids, const char* id, char* data, uint64_t length, int k, int* which) {
+  int64_t ret = parent_->RecvFirstK(node_ids, with_prefix(id).c_str(), data, length, k, which);
+  for (int i = 0; i < k; i++) {
+    count_received(*stat_, ret < 0 ? ret : length);
+  }
+  return ret;
+}
+
+SendSpan SubChannel::AcquireSendBuffer(const char* node_id, const char* id, uint64_t length) {
+  // the span keeps the prefixed id, CommitSend hands it back as is
+  return parent_->AcquireSendBuffer(node_id, with_prefix(id).c_str(), length);
+}
+
+int64_t SubChannel::CommitSend(SendSpan& span) {
+  int64_t ret = parent_->CommitSend(span);
+  count_sent(*stat_, ret);
+  return ret;
+}
+
+int64_t SubChannel::SendV(MessageDesc* msgs, int count) {
+  vector<string> ids(count);
+  vector<MessageDesc> prefixed(msgs, msgs + count);
+  for (int i = 0; i < count; i++) {
+    ids[i] = with_prefix(msgs[i].id);
+    prefixed[i].id = ids[i].c_str();
+  }
+  int64_t ret = parent_->SendV(prefixed.data(), count);
+  for (int i = 0; i < count; i++) {
+    msgs[i].result = prefixed[i].result;
+    count_sent(*stat_, msgs[i].result);
+  }
+  return ret;
+}
+
+int64_t SubChannel::RecvV(MessageDesc* msgs, int count) {
+  vector<string> ids(count);
+  vector<MessageDesc> prefixed(msgs, msgs + count);
+  for (int i = 0; i < count; i++) {
+    ids[i] = with_prefix(msgs[i].id);
+    prefixed[i].id = ids[i].c_str();
+  }
+  int64_t ret = parent_->RecvV(prefixed.data(), count);
+  for (int i = 0; i < count; i++) {
+    msgs[i].result = prefixed[i].result;
+    count_received(*stat_, msgs[i].result);
+  }
+  return ret;
+}
+
+vector<shared_ptr<IChannel>> SubChannel::Fork(int n) {
+  uint32_t k = forks_++;
+  vector<shared_ptr<IChannel>> subs;
+  for (int j = 0; j < n; j++) {
+    subs.push_back(make_shared<SubChannel>(parent_, make_prefix(prefix_, k, j), release_));
+  }
+  return subs;
+}
+
+} // namespace io
+} // namespace rosetta
@@ -1,3 +1,3 @@
 #define CATCH_CONFIG_MAIN
 
-#include "cc/modules/io/tests/test.h"
+#include "test.h"
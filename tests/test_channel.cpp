@@ -0,0 +1,792 @@
+#include "test.h"
+
+#include <io/internal_channel.h>
+#include <io/channel.h>
+#include <io/internal/io_channel_impl.h>
+#include <io/internal/socket.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+using namespace rosetta::io;
+
+// nodes P0...P(parties-1) on 127.0.0.1, listening from port on
+static string channel_config(int parties, int port, const string& connect_params = "") {
+  string nodes, ids, computation;
+  for (int i = 0; i < parties; i++) {
+    string node = "\"P" + to_string(i) + "\"";
+    string sep = i > 0 ? "," : "";
+    nodes += sep + "{\"NAME\":" + node + ",\"HOST\":\"127.0.0.1\",\"PORT\":" + to_string(port + i) +
+      ",\"NODE_ID\":" + node + "}";
+    ids += sep + node;
+    computation += sep + node + ":" + to_string(i);
+  }
+  string config = "{\"NODE_INFO\":[" + nodes + "],\"DATA_NODES\":[" + ids + "],\"COMPUTATION_NODES\":{" +
+    computation + "},\"RESULT_NODES\":[" + ids + "]";
+  if (!connect_params.empty())
+    config += ",\"CONNECT_PARAMS\":{" + connect_params + "}";
+  return config + "}";
+}
+
+static string node_id(int party) { return "P" + to_string(party); }
+
+// the servers and clients behind the channels are per process, so each party runs in a process
+// of its own. a party fails on its first failed REQUIRE, or if it is still running after a minute
+static void run_parties(int parties, const function<void(int party)>& run_case) {
+  vector<pid_t> pids(parties);
+  // or the output buffered so far is written once more by each party
+  cout.flush();
+  fflush(stdout);
+  for (int i = 0; i < parties; i++) {
+    pids[i] = fork();
+    REQUIRE(pids[i] >= 0);
+    if (pids[i] == 0) {
+      alarm(60);
+      int code = 0;
+      try {
+        run_case(i);
+      } catch (...) {
+        code = 1;
+      }
+      cout.flush();
+      fflush(stdout);
+      _exit(code);
+    }
+  }
+  for (int i = 0; i < parties; i++) {
+    int status = 0;
+    REQUIRE(waitpid(pids[i], &status, 0) == pids[i]);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+  }
+}
+
+static double elapsed_ms(chrono::steady_clock::time_point beg) {
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - beg).count();
+}
+
+TEST_CASE("Channel 3PC, SendV/RecvV", "[rosetta][io]") {
+  int parties = 3;
+  size_t size = 100;
+  vector<int64_t> vi64_send;
+  rand_vec(vi64_send, size);
+
+  for (bool lazy : {false, true}) {
+    string config = channel_config(parties, lazy ? 22110 : 22100, lazy ? "\"LAZY_CONNECT\":true" : "");
+    auto run_case = [&](int party) {
+      string me = node_id(party);
+      IChannel* channel = CreateInternalChannel("sendv", me.c_str(), config.c_str(), nullptr);
+      REQUIRE(channel != nullptr);
+
+      ////////////////////////// BEGIN
+      vector<string> peers;
+      for (int i = 0; i < parties; i++) {
+        if (i != party)
+          peers.push_back(node_id(i));
+      }
+      int64_t mine = party;
+      vector<MessageDesc> sends;
+      for (auto& peer : peers) {
+        sends.push_back({peer.c_str(), "a0", (char*)vi64_send.data(), size * sizeof(int64_t), 0});
+        sends.push_back({peer.c_str(), "a1", (char*)&mine, sizeof(mine), 0});
+      }
+      REQUIRE(channel->SendV(sends.data(), sends.size()) == 2 * (size + 1) * sizeof(int64_t));
+
+      // the later message of each peer first, RecvV does not depend on the arrival order
+      vector<vector<int64_t>> vi64_recv(peers.size(), vector<int64_t>(size));
+      vector<int64_t> theirs(peers.size(), -1);
+      vector<MessageDesc> recvs;
+      for (int i = 0; i < peers.size(); i++) {
+        recvs.push_back({peers[i].c_str(), "a1", (char*)&theirs[i], sizeof(int64_t), 0});
+        recvs.push_back({peers[i].c_str(), "a0", (char*)vi64_recv[i].data(), size * sizeof(int64_t), 0});
+      }
+      REQUIRE(channel->RecvV(recvs.data(), recvs.size()) == 2 * (size + 1) * sizeof(int64_t));
+      for (int i = 0; i < peers.size(); i++) {
+        REQUIRE(recvs[2 * i].result == sizeof(int64_t));
+        REQUIRE(recvs[2 * i + 1].result == size * sizeof(int64_t));
+        REQUIRE(theirs[i] == peers[i][1] - '0');
+        REQUIRE(vi64_recv[i] == vi64_send);
+      }
+      ////////////////////////// END
+
+      DestroyInternalChannel(channel);
+    };
+    run_parties(parties, run_case);
+  }
+}
+
+TEST_CASE("Channel 3PC, collectives", "[rosetta][io]") {
+  int parties = 3;
+  for (bool lazy : {false, true}) {
+    string config = channel_config(parties, lazy ? 22130 : 22120, lazy ? "\"LAZY_CONNECT\":true" : "");
+    auto run_case = [&](int party) {
+      string me = node_id(party);
+      IChannel* channel = CreateInternalChannel("collective", me.c_str(), config.c_str(), nullptr);
+      REQUIRE(channel != nullptr);
+      char* ids[3] = {(char*)"P0", (char*)"P1", (char*)"P2"};
+      NodeIDVec nodes = {parties, ids};
+
+      ////////////////////////// BEGIN
+      for (int r = 0; r < 20; r++) {
+        // block i goes to node i, it is tagged with the round, the sender and the receiver
+        int send[3], recv[3];
+        for (int i = 0; i < parties; i++)
+          send[i] = r * 100 + party * 10 + i;
+        REQUIRE(channel->Exchange(&nodes, "e0", (char*)send, (char*)recv, sizeof(int)) == 0);
+        for (int i = 0; i < parties; i++)
+          REQUIRE(recv[i] == r * 100 + i * 10 + party);
+
+        int gathered[3] = {-1, -1, -1}, mine = r * 10 + party;
+        REQUIRE(channel->Gather("P1", &nodes, "e1", (char*)&mine, (char*)gathered, sizeof(int)) == 0);
+        if (party == 1) {
+          for (int i = 0; i < parties; i++)
+            REQUIRE(gathered[i] == r * 10 + i);
+        }
+
+        int scattered[3] = {r, r + 1, r + 2}, block = -1;
+        REQUIRE(channel->Scatter("P2", &nodes, "e2", (char*)scattered, (char*)&block, sizeof(int)) == 0);
+        REQUIRE(block == r + party);
+
+        REQUIRE(channel->Barrier(&nodes, "e3") == 0);
+      }
+      ////////////////////////// END
+
+      DestroyInternalChannel(channel);
+    };
+    run_parties(parties, run_case);
+  }
+}
+
+TEST_CASE("Channel 2PC, Recv timeout in milliseconds", "[rosetta][io]") {
+  int parties = 2;
+  string config = channel_config(parties, 22140);
+  auto run_case = [&](int party) {
+    string me = node_id(party);
+    IChannel* channel = CreateInternalChannel("timeout", me.c_str(), config.c_str(), nullptr);
+    REQUIRE(channel != nullptr);
+
+    ////////////////////////// BEGIN
+    char go = 1;
+    int64_t value = 0;
+    if (party == 0) {
+      REQUIRE(channel->Recv("P1", "0b", &go, 1) == 1);
+      value = 42;
+      REQUIRE(channel->Send("P1", "0a", (char*)&value, sizeof(value)) == sizeof(value));
+    } else {
+      // each path waits the 200 ms, not 200 us, and returns E_TIMEOUT
+      auto beg = chrono::steady_clock::now();
+      REQUIRE(channel->Recv("P0", "0a", (char*)&value, sizeof(value), 200) == E_TIMEOUT);
+      REQUIRE(elapsed_ms(beg) >= 150);
+      REQUIRE(elapsed_ms(beg) < 5000);
+
+      int peer = channel->ResolvePeer("P0");
+      int msg = channel->RegisterMessageId("0a");
+      REQUIRE(peer >= 0);
+      REQUIRE(msg >= 0);
+      beg = chrono::steady_clock::now();
+      REQUIRE(channel->Recv(peer, msg, (char*)&value, sizeof(value), 200) == E_TIMEOUT);
+      REQUIRE(elapsed_ms(beg) >= 150);
+
+      string message;
+      beg = chrono::steady_clock::now();
+      REQUIRE(channel->RecvMessage("P0", "0a", message, 200) == E_TIMEOUT);
+      REQUIRE(elapsed_ms(beg) >= 150);
+
+      beg = chrono::steady_clock::now();
+      REQUIRE(channel->Probe("P0", "0a", 200) == E_TIMEOUT);
+      REQUIRE(elapsed_ms(beg) >= 150);
+
+      // nothing was consumed, the message sent now is received as usual
+      REQUIRE(channel->Send("P0", "0b", &go, 1) == 1);
+      REQUIRE(channel->Recv("P0", "0a", (char*)&value, sizeof(value), 5000) == sizeof(value));
+      REQUIRE(value == 42);
+    }
+    ////////////////////////// END
+
+    DestroyInternalChannel(channel);
+  };
+  run_parties(parties, run_case);
+}
+
+TEST_CASE("Channel 2PC, peer disconnect while Recv is blocked", "[rosetta][io]") {
+  int parties = 2;
+  string config = channel_config(parties, 22150);
+  auto run_case = [&](int party) {
+    string me = node_id(party);
+    IChannel* channel = CreateInternalChannel("disconnect", me.c_str(), config.c_str(), nullptr);
+    REQUIRE(channel != nullptr);
+
+    ////////////////////////// BEGIN
+    char c = 1;
+    if (party == 0) {
+      REQUIRE(channel->Send("P1", "0a", &c, 1) == 1);
+      this_thread::sleep_for(chrono::milliseconds(200));
+      _exit(0); // gone without destroying the channel
+    }
+    REQUIRE(channel->Recv("P0", "0a", &c, 1) == 1);
+    // the message sent before the peer left is kept, the blocked receiver is failed
+    auto beg = chrono::steady_clock::now();
+    REQUIRE(channel->Recv("P0", "0b", &c, 1) == E_UNCONNECTED);
+    REQUIRE(elapsed_ms(beg) < 5000);
+    string message;
+    REQUIRE(channel->RecvMessage("P0", "0c", message) == E_UNCONNECTED);
+    ////////////////////////// END
+
+    DestroyInternalChannel(channel);
+  };
+  run_parties(parties, run_case);
+}
+
+TEST_CASE("Channel 2PC, Cancel and PurgeTask drop buffered bytes", "[rosetta][io]") {
+  int parties = 2;
+  string config = channel_config(parties, 22160);
+  auto run_case = [&](int party) {
+    string me = node_id(party);
+    IChannel* channel = CreateInternalChannel("cancel", me.c_str(), config.c_str(), nullptr);
+    REQUIRE(channel != nullptr);
+
+    ////////////////////////// BEGIN
+    vector<char> data(1024, 'x');
+    char ack = 1;
+    if (party == 0) {
+      channel->Send("P1", "aa01", data.data(), data.size());
+      channel->Send("P1", "aa02", data.data(), 8);
+      channel->Send("P1", "bb01", data.data(), 8);
+      REQUIRE(channel->Recv("P1", "01", &ack, 1) == 1);
+      channel->Send("P1", "aa03", data.data(), 8);
+      channel->Send("P1", "cc01", data.data(), 8);
+      channel->Send("P1", "cc02", data.data(), 8);
+      REQUIRE(channel->Recv("P1", "02", &ack, 1) == 1);
+    } else {
+      // messages of one node arrive in order, so aa01 and aa02 are buffered once bb01 is there
+      REQUIRE(channel->Recv("P0", "bb01", data.data(), 8) == 8);
+      REQUIRE(channel->PurgeTask("aa") == 1024 + 8);
+      REQUIRE(channel->Recv("P0", "aa01", data.data(), 8, 100) == E_TIMEOUT);
+      REQUIRE(channel->Send("P0", "01", &ack, 1) == 1);
+
+      // the task stays purged, its messages arriving later are dropped too
+      REQUIRE(channel->Recv("P0", "cc02", data.data(), 8) == 8);
+      REQUIRE(channel->Recv("P0", "aa03", data.data(), 8, 100) == E_TIMEOUT);
+      REQUIRE(channel->Cancel("P0", "cc01") == 8);
+      REQUIRE(channel->Recv("P0", "cc01", data.data(), 8, 100) == E_TIMEOUT);
+
+      // a blocked receiver is failed with E_CANCELED
+      int64_t blocked = 0;
+      thread receiver([&]() { blocked = channel->Recv("P0", "cc03", data.data(), 8); });
+      this_thread::sleep_for(chrono::milliseconds(100));
+      REQUIRE(channel->Cancel("P0", "cc03") == 0);
+      receiver.join();
+      REQUIRE(blocked == E_CANCELED);
+      REQUIRE(channel->Send("P0", "02", &ack, 1) == 1);
+    }
+    ////////////////////////// END
+
+    DestroyInternalChannel(channel);
+  };
+  run_parties(parties, run_case);
+}
+
+TEST_CASE("Channel 2PC, OnMessage prefix dispatch", "[rosetta][io]") {
+  int parties = 2;
+  string config = channel_config(parties, 22170);
+  auto run_case = [&](int party) {
+    string me = node_id(party);
+    IChannel* channel = CreateInternalChannel("onmessage", me.c_str(), config.c_str(), nullptr);
+    REQUIRE(channel != nullptr);
+
+    ////////////////////////// BEGIN
+    char ack = 1;
+    int64_t value = 0;
+    if (party == 0) {
+      REQUIRE(channel->Recv("P1", "01", &ack, 1) == 1);
+      for (string id : {"b200", "b2ffee", "c0"}) {
+        value = id.size();
+        REQUIRE(channel->Send("P1", id.c_str(), (char*)&value, sizeof(value)) == sizeof(value));
+      }
+      REQUIRE(channel->Recv("P1", "02", &ack, 1) == 1);
+    } else {
+      mutex handled_mtx;
+      vector<string> handled;
+      auto handler = [&](const string& tag) {
+        return [&, tag](const char* node_id, const char* id, const char* data, uint64_t length) {
+          int64_t v = 0;
+          memcpy(&v, data, length);
+          unique_lock<mutex> lck(handled_mtx);
+          handled.push_back(tag + ":" + node_id + ":" + id + ":" + to_string(v));
+        };
+      };
+      REQUIRE(channel->OnMessage(nullptr, "b2", handler("b2")) == 0);
+      REQUIRE(channel->OnMessage("P0", "b2ff", handler("b2ff")) == 0);
+      REQUIRE(channel->Send("P0", "01", &ack, 1) == 1);
+
+      // c0 is kept for Recv. it comes after the handled ids, whose handlers have run by then
+      REQUIRE(channel->Recv("P0", "c0", (char*)&value, sizeof(value)) == sizeof(value));
+      REQUIRE(value == 2);
+      for (int i = 0; i < 5000; i++) {
+        unique_lock<mutex> lck(handled_mtx);
+        if (handled.size() == 2)
+          break;
+        lck.unlock();
+        this_thread::sleep_for(chrono::milliseconds(1));
+      }
+      unique_lock<mutex> lck(handled_mtx);
+      REQUIRE(handled.size() == 2);
+      // the longest matching prefix wins
+      REQUIRE(handled[0] == "b2:P0:b200:4");
+      REQUIRE(handled[1] == "b2ff:P0:b2ffee:6");
+      lck.unlock();
+      REQUIRE(channel->Recv("P0", "b200", (char*)&value, sizeof(value), 100) == E_TIMEOUT);
+      REQUIRE(channel->Send("P0", "02", &ack, 1) == 1);
+    }
+    ////////////////////////// END
+
+    DestroyInternalChannel(channel);
+  };
+  run_parties(parties, run_case);
+}
+
+TEST_CASE("Channel 3PC, KEEP_CONNECTIONS pool reused across tasks", "[rosetta][io]") {
+  int parties = 3;
+  string config = channel_config(parties, 22180, "\"KEEP_CONNECTIONS\":true");
+  auto run_case = [&](int party) {
+    string me = node_id(party);
+
+    ////////////////////////// BEGIN
+    for (int t = 0; t < 3; t++) {
+      string task_id = "task" + to_string(t);
+      IChannel* channel = CreateInternalChannel(task_id.c_str(), me.c_str(), config.c_str(), nullptr);
+      REQUIRE(channel != nullptr);
+      char hello = t;
+      for (int i = 0; i < parties; i++) {
+        if (i != party)
+          REQUIRE(channel->Send(node_id(i).c_str(), "01", &hello, 1) == 1);
+      }
+      for (int i = 0; i < parties; i++) {
+        if (i == party)
+          continue;
+        REQUIRE(channel->Recv(node_id(i).c_str(), "01", &hello, 1) == 1);
+        REQUIRE(hello == t);
+        // the tasks after the first one take the connections of the pool over
+        NetStat stat = ((TCPChannel*)channel)->GetNetStat(node_id(i).c_str());
+        if (t > 0)
+          REQUIRE(stat.pool_hits() > 0);
+      }
+      DestroyInternalChannel(channel);
+    }
+    ////////////////////////// END
+  };
+  run_parties(parties, run_case);
+}
+
+TEST_CASE("Channel 2PC, message handles of two tasks on one connection", "[rosetta][io]") {
+  int parties = 2;
+  string config = channel_config(parties, 22190);
+  auto run_case = [&](int party) {
+    string me = node_id(party);
+    string peer_id = node_id(1 - party);
+    // both open at once, so they share the connection
+    IChannel* channels[2];
+    for (int t = 0; t < 2; t++) {
+      channels[t] = CreateInternalChannel(("handles" + to_string(t)).c_str(), me.c_str(), config.c_str(), nullptr);
+      REQUIRE(channels[t] != nullptr);
+    }
+
+    ////////////////////////// BEGIN
+    // each task registers an id of its own first, so both get the same handle
+    const char* ids[2] = {"a0", "b0"};
+    int peers[2], msgs[2];
+    for (int t = 0; t < 2; t++) {
+      peers[t] = channels[t]->ResolvePeer(peer_id.c_str());
+      msgs[t] = channels[t]->RegisterMessageId(ids[t]);
+      REQUIRE(peers[t] >= 0);
+      REQUIRE(msgs[t] == 0);
+    }
+    for (int r = 0; r < 3; r++) {
+      int64_t value = 0;
+      if (party == 0) {
+        for (int t = 0; t < 2; t++) {
+          value = r * 10 + t;
+          REQUIRE(channels[t]->Send(peers[t], msgs[t], (char*)&value, sizeof(value)) == sizeof(value));
+        }
+      } else {
+        // the later task first in every other round, each receives its own message
+        for (int i = 0; i < 2; i++) {
+          int t = (r + i) % 2;
+          REQUIRE(channels[t]->Recv(peers[t], msgs[t], (char*)&value, sizeof(value), 5000) == sizeof(value));
+          REQUIRE(value == r * 10 + t);
+        }
+      }
+    }
+    ////////////////////////// END
+
+    char ack = 1;
+    if (party == 0) {
+      REQUIRE(channels[0]->Recv("P1", "01", &ack, 1) == 1);
+    } else {
+      REQUIRE(channels[0]->Send("P0", "01", &ack, 1) == 1);
+    }
+    for (int t = 1; t >= 0; t--)
+      DestroyInternalChannel(channels[t]);
+  };
+  run_parties(parties, run_case);
+}
+
+TEST_CASE("Channel 2PC, Fork namespaces of two tasks on one connection", "[rosetta][io]") {
+  int parties = 2;
+  string config = channel_config(parties, 22200);
+  auto run_case = [&](int party) {
+    string me = node_id(party);
+    IChannel* channels[2];
+    vector<shared_ptr<IChannel>> subs[2];
+    for (int t = 0; t < 2; t++) {
+      channels[t] = CreateInternalChannel(("forks" + to_string(t)).c_str(), me.c_str(), config.c_str(), nullptr);
+      REQUIRE(channels[t] != nullptr);
+      // the first Fork of each task, the same k and j for both
+      subs[t] = channels[t]->Fork(1);
+      REQUIRE(subs[t].size() == 1);
+    }
+
+    ////////////////////////// BEGIN
+    char ack = 1;
+    int64_t value = 0;
+    if (party == 0) {
+      // the later task first, so its message is buffered when the other one is read
+      for (int t = 1; t >= 0; t--) {
+        value = t;
+        REQUIRE(subs[t][0]->Send("P1", "01", (char*)&value, sizeof(value)) == sizeof(value));
+      }
+      REQUIRE(channels[0]->Recv("P1", "02", &ack, 1) == 1);
+    } else {
+      REQUIRE(subs[0][0]->Recv("P0", "01", (char*)&value, sizeof(value), 5000) == sizeof(value));
+      REQUIRE(value == 0);
+      // dropping the sub-channel purges its namespace only
+      subs[0].clear();
+      REQUIRE(subs[1][0]->Recv("P0", "01", (char*)&value, sizeof(value), 5000) == sizeof(value));
+      REQUIRE(value == 1);
+
+      // the parent keeps the reserved ids to the sub-channels
+      REQUIRE(channels[0]->RegisterMessageId("fffe01") == -1);
+      REQUIRE(channels[0]->Send("P0", "fffe01", (char*)&value, sizeof(value)) == -1);
+      REQUIRE(channels[0]->Send("P0", "02", &ack, 1) == 1);
+    }
+    ////////////////////////// END
+
+    for (int t = 1; t >= 0; t--) {
+      subs[t].clear();
+      DestroyInternalChannel(channels[t]);
+    }
+  };
+  run_parties(parties, run_case);
+}
+
+TEST_CASE("Channel 2PC, Cancel of a posted receive coming in", "[rosetta][io]") {
+  int parties = 2;
+  string config = channel_config(parties, 22220);
+  auto run_case = [&](int party) {
+    string me = node_id(party);
+    IChannel* channel = CreateInternalChannel("cancelposted", me.c_str(), config.c_str(), nullptr);
+    REQUIRE(channel != nullptr);
+
+    ////////////////////////// BEGIN
+    const size_t size = 64 * 1024 * 1024;
+    char ack = 1;
+    if (party == 0) {
+      vector<char> large(size, 'x');
+      REQUIRE(channel->Recv("P1", "01", &ack, 1) == 1);
+      REQUIRE(channel->Send("P1", "02", &ack, 1) == 1);
+      REQUIRE(channel->Send("P1", "0b", large.data(), large.size()) == large.size());
+      REQUIRE(channel->Send("P1", "03", &ack, 1) == 1);
+      REQUIRE(channel->Recv("P1", "04", &ack, 1) == 1);
+    } else {
+      // canceled while the message may be coming in, the buffer is left alone from then on
+      vector<char> large(size, 0);
+      MessageDesc msg = {"P0", "0b", large.data(), large.size(), 0};
+      IORequestPtr request = channel->PostRecvs(&msg, 1)[0];
+      REQUIRE(channel->Send("P0", "01", &ack, 1) == 1);
+      REQUIRE(channel->Recv("P0", "02", &ack, 1) == 1);
+      this_thread::sleep_for(chrono::milliseconds(2));
+      channel->Cancel("P0", "0b");
+      REQUIRE(request->Wait(1000));
+      REQUIRE(request->Result() == E_CANCELED);
+      memset(large.data(), 'z', large.size());
+      // sent after it, so the whole message has been taken in by now
+      REQUIRE(channel->Recv("P0", "03", &ack, 1) == 1);
+      REQUIRE(large == vector<char>(large.size(), 'z'));
+      REQUIRE(channel->Send("P0", "04", &ack, 1) == 1);
+    }
+    ////////////////////////// END
+
+    DestroyInternalChannel(channel);
+  };
+  run_parties(parties, run_case);
+}
+
+TEST_CASE("Channel 2PC, PostRecvs placing large messages", "[rosetta][io]") {
+  int parties = 2;
+  string config = channel_config(parties, 22210);
+  auto run_case = [&](int party) {
+    string me = node_id(party);
+    IChannel* channel = CreateInternalChannel("postrecvs", me.c_str(), config.c_str(), nullptr);
+    REQUIRE(channel != nullptr);
+
+    ////////////////////////// BEGIN
+    const int rounds = 3;
+    const size_t size = 8 * 1024 * 1024;
+    char ack = 1;
+    if (party == 0) {
+      REQUIRE(channel->Recv("P1", "01", &ack, 1) == 1);
+      // the receives are posted by now, each round goes straight into its buffer
+      for (int r = 0; r < rounds; r++) {
+        vector<char> data(size, 'a' + r);
+        REQUIRE(channel->Send("P1", "0a", data.data(), size) == size);
+      }
+      REQUIRE(channel->Recv("P1", "02", &ack, 1) == 1);
+    } else {
+      vector<vector<char>> bufs(rounds, vector<char>(size));
+      vector<MessageDesc> msgs;
+      for (int r = 0; r < rounds; r++)
+        msgs.push_back({"P0", "0a", bufs[r].data(), size, 0});
+      vector<IORequestPtr> requests = channel->PostRecvs(msgs.data(), rounds);
+      REQUIRE(requests.size() == rounds);
+      REQUIRE(channel->Send("P0", "01", &ack, 1) == 1);
+      REQUIRE(IChannel::WaitAll(requests, 10000));
+      for (int r = 0; r < rounds; r++) {
+        REQUIRE(requests[r]->Result() == size);
+        REQUIRE(bufs[r] == vector<char>(size, 'a' + r));
+      }
+      REQUIRE(channel->Send("P0", "02", &ack, 1) == 1);
+    }
+    ////////////////////////// END
+
+    DestroyInternalChannel(channel);
+  };
+  run_parties(parties, run_case);
+}
+
+TEST_CASE("Channel 2PC, PurgeTask ends with the task on pooled connections", "[rosetta][io]") {
+  int parties = 2;
+  string config = channel_config(parties, 22230, "\"KEEP_CONNECTIONS\":true");
+  auto run_case = [&](int party) {
+    string me = node_id(party);
+
+    ////////////////////////// BEGIN
+    for (int t = 0; t < 2; t++) {
+      // the same task id both times, over the same connection
+      IChannel* channel = CreateInternalChannel("purged", me.c_str(), config.c_str(), nullptr);
+      REQUIRE(channel != nullptr);
+      char ack = 1;
+      int64_t value = 0;
+      if (party == 0) {
+        REQUIRE(channel->Recv("P1", "01", &ack, 1) == 1);
+        value = t;
+        REQUIRE(channel->Send("P1", "aa01", (char*)&value, sizeof(value)) == sizeof(value));
+        REQUIRE(channel->Send("P1", "02", &ack, 1) == 1);
+        REQUIRE(channel->Recv("P1", "03", &ack, 1) == 1);
+      } else {
+        if (t == 0)
+          REQUIRE(channel->PurgeTask("aa") == 0);
+        REQUIRE(channel->Send("P0", "01", &ack, 1) == 1);
+        REQUIRE(channel->Recv("P0", "02", &ack, 1) == 1);
+        if (t == 0) {
+          REQUIRE(channel->Recv("P0", "aa01", (char*)&value, sizeof(value), 100) == E_TIMEOUT);
+        } else {
+          REQUIRE(channel->Recv("P0", "aa01", (char*)&value, sizeof(value), 5000) == sizeof(value));
+          REQUIRE(value == 1);
+        }
+        REQUIRE(channel->Send("P0", "03", &ack, 1) == 1);
+      }
+      DestroyInternalChannel(channel);
+    }
+    ////////////////////////// END
+  };
+  run_parties(parties, run_case);
+}
+
+TEST_CASE("Channel 2PC, SetCorked of one task on a shared connection", "[rosetta][io]") {
+  int parties = 2;
+  string config = channel_config(parties, 22240);
+  auto run_case = [&](int party) {
+    string me = node_id(party);
+    IChannel* channels[2];
+    for (int t = 0; t < 2; t++) {
+      channels[t] = CreateInternalChannel(("corked" + to_string(t)).c_str(), me.c_str(), config.c_str(), nullptr);
+      REQUIRE(channels[t] != nullptr);
+    }
+
+    ////////////////////////// BEGIN
+    char ack = 1;
+    int64_t value = 0;
+    if (party == 0) {
+      channels[0]->SetCorked(true);
+      value = 1;
+      REQUIRE(channels[0]->Send("P1", "01", (char*)&value, sizeof(value)) == sizeof(value));
+      // the other task is not held, and takes the queue along
+      value = 2;
+      REQUIRE(channels[1]->Send("P1", "11", (char*)&value, sizeof(value)) == sizeof(value));
+      REQUIRE(channels[1]->Recv("P1", "02", &ack, 1) == 1);
+      value = 3;
+      REQUIRE(channels[0]->Send("P1", "03", (char*)&value, sizeof(value)) == sizeof(value));
+      REQUIRE(channels[1]->Recv("P1", "04", &ack, 1) == 1);
+      channels[0]->SetCorked(false);
+    } else {
+      REQUIRE(channels[1]->Recv("P0", "11", (char*)&value, sizeof(value), 1000) == sizeof(value));
+      REQUIRE(value == 2);
+      REQUIRE(channels[0]->Recv("P0", "01", (char*)&value, sizeof(value), 1000) == sizeof(value));
+      REQUIRE(value == 1);
+      REQUIRE(channels[1]->Send("P0", "02", &ack, 1) == 1);
+      // alone in the queue, the corked message waits for SetCorked(false)
+      REQUIRE(channels[0]->Recv("P0", "03", (char*)&value, sizeof(value), 200) == E_TIMEOUT);
+      REQUIRE(channels[1]->Send("P0", "04", &ack, 1) == 1);
+      REQUIRE(channels[0]->Recv("P0", "03", (char*)&value, sizeof(value), 5000) == sizeof(value));
+      REQUIRE(value == 3);
+    }
+    ////////////////////////// END
+
+    if (party == 0) {
+      REQUIRE(channels[0]->Recv("P1", "05", &ack, 1) == 1);
+    } else {
+      REQUIRE(channels[0]->Send("P0", "05", &ack, 1) == 1);
+    }
+    for (int t = 1; t >= 0; t--)
+      DestroyInternalChannel(channels[t]);
+  };
+  run_parties(parties, run_case);
+}
+
+TEST_CASE("Channel 2PC, OnMessage handlers end with their task", "[rosetta][io]") {
+  int parties = 2;
+  string config = channel_config(parties, 22250);
+  auto run_case = [&](int party) {
+    string me = node_id(party);
+    IChannel* channels[2];
+    for (int t = 0; t < 2; t++) {
+      channels[t] = CreateInternalChannel(("handled" + to_string(t)).c_str(), me.c_str(), config.c_str(), nullptr);
+      REQUIRE(channels[t] != nullptr);
+    }
+
+    ////////////////////////// BEGIN
+    char ack = 1;
+    int64_t value = 0;
+    atomic<int> handled{0};
+    IChannel::MessageHandler handler = [&](const char* node_id, const char* id, const char* data, uint64_t length) {
+      handled++;
+    };
+    if (party == 1) {
+      REQUIRE(channels[0]->OnMessage(nullptr, "aa", handler) == 0);
+      // the prefix is taken on the shared connection
+      REQUIRE(channels[1]->OnMessage(nullptr, "aa", handler) == -1);
+      REQUIRE(channels[0]->Send("P0", "01", &ack, 1) == 1);
+    } else {
+      REQUIRE(channels[0]->Recv("P1", "01", &ack, 1) == 1);
+      value = 1;
+      REQUIRE(channels[0]->Send("P1", "aa01", (char*)&value, sizeof(value)) == sizeof(value));
+      REQUIRE(channels[0]->Recv("P1", "02", &ack, 1) == 1);
+    }
+    if (party == 1) {
+      REQUIRE(channels[1]->Recv("P0", "aa01", (char*)&value, sizeof(value), 200) == E_TIMEOUT);
+      REQUIRE(handled == 1);
+      REQUIRE(channels[0]->Send("P0", "02", &ack, 1) == 1);
+    }
+    DestroyInternalChannel(channels[0]);
+
+    // the other task receives the prefix again
+    if (party == 0) {
+      value = 2;
+      REQUIRE(channels[1]->Send("P1", "aa01", (char*)&value, sizeof(value)) == sizeof(value));
+      REQUIRE(channels[1]->Recv("P1", "03", &ack, 1) == 1);
+    } else {
+      REQUIRE(channels[1]->Recv("P0", "aa01", (char*)&value, sizeof(value), 5000) == sizeof(value));
+      REQUIRE(value == 2);
+      REQUIRE(handled == 1);
+      REQUIRE(channels[1]->Send("P0", "03", &ack, 1) == 1);
+    }
+    ////////////////////////// END
+
+    DestroyInternalChannel(channels[1]);
+  };
+  run_parties(parties, run_case);
+}
+
+TEST_CASE("Channel 2PC, SendAsync to a peer gone", "[rosetta][io]") {
+  int parties = 2;
+  string config = channel_config(parties, 22260);
+  auto run_case = [&](int party) {
+    string me = node_id(party);
+    IChannel* channel = CreateInternalChannel("send_gone", me.c_str(), config.c_str(), nullptr);
+    REQUIRE(channel != nullptr);
+
+    ////////////////////////// BEGIN
+    char c = 1;
+    if (party == 0) {
+      REQUIRE(channel->Recv("P1", "0a", &c, 1) == 1);
+      _exit(0); // gone without destroying the channel
+    }
+    string data(16 * 1024 * 1024, 'x');
+    IORequestPtr sent = channel->SendAsync("P0", "0a", &c, 1);
+    REQUIRE(sent->Wait(5000));
+    REQUIRE(sent->Result() == 1);
+    REQUIRE(channel->Recv("P0", "0b", &c, 1) == E_UNCONNECTED);
+    // more than the socket buffers take, the write fails on the connection reset
+    sent = channel->SendAsync("P0", "0c", data.data(), data.size());
+    REQUIRE(sent->Wait(5000));
+    REQUIRE(sent->Result() < 0);
+    ////////////////////////// END
+
+    DestroyInternalChannel(channel);
+  };
+  run_parties(parties, run_case);
+}
+
+TEST_CASE("Channel 2PC, messages of one id keep their order across priorities", "[rosetta][io]") {
+  int parties = 2;
+  string config = channel_config(parties, 22270);
+  auto run_case = [&](int party) {
+    string me = node_id(party);
+    IChannel* channel = CreateInternalChannel("priorities", me.c_str(), config.c_str(), nullptr);
+    REQUIRE(channel != nullptr);
+
+    ////////////////////////// BEGIN
+    // bulk messages larger than the socket buffers are still queued when the class changes
+    const int count = 12;
+    if (party == 0) {
+      for (int i = 0; i < count; i++) {
+        string data(i % 4 == 3 ? sizeof(int64_t) : 2 * 1024 * 1024, 'x');
+        int64_t seq = i;
+        memcpy(&data[0], &seq, sizeof(seq));
+        if (i % 4 == 3) {
+          REQUIRE(channel->SendWithPriority("P1", "0a", data.data(), data.size(), MSG_PRIORITY_URGENT) == data.size());
+          channel->SetMessagePriority("0a", MSG_PRIORITY_BULK);
+        } else {
+          REQUIRE(channel->Send("P1", "0a", data.data(), data.size()) == data.size());
+        }
+      }
+      char ack = 0;
+      REQUIRE(channel->Recv("P1", "0b", &ack, 1) == 1);
+    } else {
+      this_thread::sleep_for(chrono::milliseconds(100));
+      for (int i = 0; i < count; i++) {
+        string data;
+        REQUIRE(channel->RecvMessage("P0", "0a", data, 5000) == (i % 4 == 3 ? sizeof(int64_t) : 2 * 1024 * 1024));
+        int64_t seq = -1;
+        memcpy(&seq, data.data(), sizeof(seq));
+        REQUIRE(seq == i);
+      }
+      char ack = 1;
+      REQUIRE(channel->Send("P0", "0b", &ack, 1) == 1);
+    }
+    ////////////////////////// END
+
+    DestroyInternalChannel(channel);
+  };
+  run_parties(parties, run_case);
+}